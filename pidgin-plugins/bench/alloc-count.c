@@ -0,0 +1,83 @@
+/*
+ * Counting heap allocations for the benchmarks. An executable's malloc()
+ * takes the place of libc's for every library it loads, so these count
+ * and hand the call on to glibc's own allocator.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+#include <stdlib.h>
+
+#include "alloc-count.h"
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static guint64 allocations = 0;
+
+void *
+malloc(size_t size)
+{
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+guint64
+alloc_count(void)
+{
+	return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+gboolean
+alloc_count_available(void)
+{
+	return TRUE;
+}
+#else
+guint64
+alloc_count(void)
+{
+	return 0;
+}
+
+gboolean
+alloc_count_available(void)
+{
+	return FALSE;
+}
+#endif
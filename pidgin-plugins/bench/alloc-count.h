@@ -0,0 +1,30 @@
+/*
+ * Counting heap allocations for the benchmarks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+#ifndef _BENCH_ALLOC_COUNT_H_
+#define _BENCH_ALLOC_COUNT_H_
+
+#include <glib.h>
+
+/* Calls to malloc(), calloc() and realloc() so far, from any thread and
+ * including those made inside GLib. Counting needs glibc; elsewhere this
+ * stays 0 and alloc_count_available() is FALSE. */
+guint64 alloc_count(void);
+gboolean alloc_count_available(void);
+
+#endif /* _BENCH_ALLOC_COUNT_H_ */
@@ -0,0 +1,205 @@
+/*
+ * Helpers shared by the benchmark drivers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+#include "internal.h"
+
+#include "bench-util.h"
+
+#define TRACE_RECORD_HEADER (1 + 8 + 4)
+
+guint64
+bench_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return (guint64)g_get_monotonic_time() * 1000;
+#endif
+}
+
+gint
+bench_sample_compare(gconstpointer a, gconstpointer b)
+{
+	guint64 x = *(const guint64 *)a, y = *(const guint64 *)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+double
+bench_percentile(GArray *samples, double p)
+{
+	if (samples->len == 0)
+		return 0;
+	return g_array_index(samples, guint64, MIN((guint)(samples->len * p), samples->len - 1)) / 1000.0;
+}
+
+double
+bench_per(guint64 count, guint n)
+{
+	return n > 0 ? count / (double)n : 0;
+}
+
+void
+bench_iterate(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+void
+bench_remove_tree(const char *path)
+{
+	GDir *dir;
+	const char *name;
+
+	if ((dir = g_dir_open(path, 0, NULL)) != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			char *child = g_build_filename(path, name, NULL);
+			if (g_file_test(child, G_FILE_TEST_IS_DIR))
+				bench_remove_tree(child);
+			else
+				g_unlink(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+	g_rmdir(path);
+}
+
+gboolean
+bench_set_pref(const char *dir, const char *setting)
+{
+	char **parts = g_strsplit(setting, "=", 2);
+	char *name, **items;
+	GList *list = NULL;
+	gboolean ok = TRUE;
+	int i;
+
+	if (parts[0] == NULL || parts[1] == NULL) {
+		g_strfreev(parts);
+		return FALSE;
+	}
+
+	name = g_strconcat(dir, "/", parts[0], NULL);
+	switch (purple_prefs_get_type(name)) {
+	case PURPLE_PREF_BOOLEAN:
+		purple_prefs_set_bool(name, atoi(parts[1]) != 0 ||
+		                            g_ascii_strcasecmp(parts[1], "true") == 0);
+		break;
+	case PURPLE_PREF_INT:
+		purple_prefs_set_int(name, atoi(parts[1]));
+		break;
+	case PURPLE_PREF_STRING:
+		purple_prefs_set_string(name, parts[1]);
+		break;
+	case PURPLE_PREF_STRING_LIST:
+		items = g_strsplit(parts[1], ",", -1);
+		for (i = 0; items[i] != NULL; i++)
+			if (*items[i])
+				list = g_list_append(list, items[i]);
+		purple_prefs_set_string_list(name, list);
+		g_list_free(list);
+		g_strfreev(items);
+		break;
+	default:
+		ok = FALSE;
+		break;
+	}
+
+	g_free(name);
+	g_strfreev(parts);
+	return ok;
+}
+
+gboolean
+bench_trace_open(BenchTrace *trace, const char *path, const char *magic, double speed)
+{
+	GError *error = NULL;
+
+	memset(trace, 0, sizeof(*trace));
+	if (!g_file_get_contents(path, &trace->contents, &trace->len, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	if (trace->len < strlen(magic) || memcmp(trace->contents, magic, strlen(magic)) != 0) {
+		fprintf(stderr, "%s is not a trace of this plugin, or is of an older version\n", path);
+		bench_trace_close(trace);
+		return FALSE;
+	}
+
+	trace->pos = strlen(magic);
+	trace->speed = MAX(speed, 0);
+	trace->start = g_get_monotonic_time();
+	return TRUE;
+}
+
+int
+bench_trace_next(BenchTrace *trace, char *type, const char **fields, int n)
+{
+	const guint8 *header = (const guint8 *)trace->contents + trace->pos;
+	const char *p, *end;
+	guint64 when;
+	guint32 len;
+	int i;
+
+	if (trace->len - trace->pos < TRACE_RECORD_HEADER)
+		return -1;
+	memcpy(&when, header + 1, 8);
+	memcpy(&len, header + 9, 4);
+	when = GUINT64_FROM_BE(when);
+	len = GUINT32_FROM_BE(len);
+	if (trace->len - trace->pos - TRACE_RECORD_HEADER < len) {
+		fprintf(stderr, "The trace ends in a partial record\n");
+		return -1;
+	}
+
+	/* The plugin's timers keep running while we wait */
+	if (trace->speed > 0) {
+		gint64 due = trace->start + (gint64)(when / trace->speed);
+		gint64 now;
+
+		while ((now = g_get_monotonic_time()) < due) {
+			bench_iterate();
+			g_usleep(MIN(due - now, 1000));
+		}
+	}
+
+	*type = header[0];
+	p = (const char *)header + TRACE_RECORD_HEADER;
+	end = p + len;
+	for (i = 0; i < n && p < end; i++) {
+		const char *nul = memchr(p, '\0', end - p);
+		if (nul == NULL)
+			break;
+		fields[i] = p;
+		p = nul + 1;
+	}
+
+	trace->pos += TRACE_RECORD_HEADER + len;
+	trace->records++;
+	return i;
+}
+
+void
+bench_trace_close(BenchTrace *trace)
+{
+	g_free(trace->contents);
+	trace->contents = NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * Helpers shared by the benchmark drivers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+#include <glib.h>
+
+/* Monotonic time in nanoseconds */
+guint64 bench_now(void);
+
+/* Latency samples are guint64 nanoseconds, sorted with this */
+gint bench_sample_compare(gconstpointer a, gconstpointer b);
+
+/* In microseconds, from sorted samples */
+double bench_percentile(GArray *samples, double p);
+
+double bench_per(guint64 count, guint n);
+
+/* Lets timers and idle callbacks the plugin added run */
+void bench_iterate(void);
+
+void bench_remove_tree(const char *path);
+
+/* Sets the pref NAME under dir from NAME=VALUE, by its type. String lists
+ * are given comma separated. */
+gboolean bench_set_pref(const char *dir, const char *setting);
+
+/* A trace as the plugins record them: a magic string, then records laid
+ * out as [type][time][length][fields], with the time in microseconds as a
+ * big-endian guint64, the length as a big-endian guint32, and the fields
+ * NUL-terminated strings. */
+typedef struct {
+	char *contents;
+	gsize len;
+	gsize pos;
+	double speed;      /* times the original pace, 0 for as fast as possible */
+	gint64 start;
+	guint records;
+} BenchTrace;
+
+/* Reads the whole trace, complaining on stderr if it can't */
+gboolean bench_trace_open(BenchTrace *trace, const char *path, const char *magic,
+                          double speed);
+
+/* Waits until the next record is due, running the main loop meanwhile, and
+ * splits up to n of its fields. Returns how many it found, or -1 at the
+ * end of the trace. */
+int bench_trace_next(BenchTrace *trace, char *type, const char **fields, int n);
+
+void bench_trace_close(BenchTrace *trace);
+
+#endif /* _BENCH_UTIL_H_ */
@@ -0,0 +1,1195 @@
+/*
+ * ColorNicks Logger benchmark - Drive the loggers with synthetic traffic
+ * without Pidgin
+ *
+ * The plugin is built into this driver against the stub libpurple, and
+ * loaded with a throwaway user directory. Each benchmark named on the
+ * command line ("write" if none is) prints what it measured.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+/* Its statics are what is being measured */
+#include "../colornicks_logger.c"
+
+#include <locale.h>
+
+#include "alloc-count.h"
+#include "bench-util.h"
+
+#define BENCH_IMAGES 8
+
+typedef struct {
+	int messages;
+	int nicks;
+	int size;
+	int markup;   /* percent of messages */
+	int images;   /* percent of messages */
+	int image_ids[BENCH_IMAGES];
+	int corpus;       /* megabytes of logs for search */
+	PurpleAccount *account;
+	char *trace;      /* for replay */
+	int speed;        /* times the original pace, 0 for as fast as possible */
+	char *logger;     /* the one replay writes through */
+} BenchParams;
+
+typedef struct {
+	const char *name;
+	void (*run)(const BenchParams *params);
+} Bench;
+
+/* Every run writes a log of its own buddy, so no catalog sees it twice */
+static char *
+bench_log_name(void)
+{
+	static int runs = 0;
+	return g_strdup_printf("bench%d", ++runs);
+}
+
+/* A message of about size bytes, in the shape picked by its number */
+static char *
+bench_message(const BenchParams *params, int n)
+{
+	static const char words[] = "the quick brown fox jumps over a lazy dog ";
+	GString *msg = g_string_sized_new(params->size + 64);
+	guint roll = ((guint)n * 2654435761u >> 8) % 100;
+
+	while ((int)msg->len < params->size)
+		g_string_append(msg, words + n % 10);
+	g_string_truncate(msg, params->size);
+
+	if (roll < (guint)params->images) {
+		g_string_append_printf(msg, " <img id=\"%d\">",
+		                       params->image_ids[n % BENCH_IMAGES]);
+	} else if (roll < (guint)(params->images + params->markup)) {
+		g_string_prepend(msg, "<b>");
+		g_string_append(msg, " &amp; <i>more</i></b>");
+	}
+
+	return g_string_free(msg, FALSE);
+}
+
+/* Messages are made up front, so making them is not measured */
+static char **
+bench_messages(const BenchParams *params)
+{
+	char **messages = g_new0(char *, params->messages + 1);
+	int i;
+
+	for (i = 0; i < params->messages; i++)
+		messages[i] = bench_message(params, i);
+	return messages;
+}
+
+static char **
+bench_nicks(int n)
+{
+	char **nicks = g_new0(char *, n + 1);
+	int i;
+
+	for (i = 0; i < n; i++)
+		nicks[i] = g_strdup_printf("nick%d", i);
+	return nicks;
+}
+
+/* Writes the traffic through a logger, timing each write, then reads the
+ * log back */
+static void
+bench_logger(const BenchParams *params, PurpleLogLogger *logger)
+{
+	PurpleLogType type = params->nicks > 2 ? PURPLE_LOG_CHAT : PURPLE_LOG_IM;
+	GArray *latencies = g_array_sized_new(FALSE, FALSE, sizeof(guint64), params->messages);
+	char **messages = bench_messages(params);
+	char **nicks = bench_nicks(params->nicks);
+	char *name = bench_log_name();
+	time_t now = time(NULL);
+	guint64 start, elapsed, flushed, allocs, read_time, read_allocs;
+	guint64 bytes = 0, read_bytes = 0;
+	PurpleConversation *conv;
+	PurpleLogReadFlags flags;
+	PurpleLog *log;
+	GList *logs;
+	int i;
+
+	/* Nick colors come from the conversation's palette */
+	conv = stub_conversation_new(type == PURPLE_LOG_CHAT ? PURPLE_CONV_TYPE_CHAT : PURPLE_CONV_TYPE_IM,
+	                             params->account, name);
+	log = purple_log_new(type, name, params->account, conv, now, NULL);
+	log->logger = logger;
+
+	allocs = alloc_count();
+	start = bench_now();
+	for (i = 0; i < params->messages; i++) {
+		PurpleMessageFlags flag = PURPLE_MESSAGE_RECV;
+		guint64 t;
+
+		/* In an IM every other message is our own */
+		if (type == PURPLE_LOG_IM && i % 2 == 0)
+			flag = PURPLE_MESSAGE_SEND;
+
+		t = bench_now();
+		bytes += logger->write(log, flag, nicks[i % params->nicks], now + i, messages[i]);
+		t = bench_now() - t;
+		g_array_append_val(latencies, t);
+	}
+	elapsed = bench_now() - start;
+
+	start = bench_now();
+	writer_flush_all();
+	flushed = bench_now() - start;
+	allocs = alloc_count() - allocs;
+	purple_log_free(log);
+	bench_iterate();
+
+	read_allocs = alloc_count();
+	start = bench_now();
+	logs = logger->list(type, name, params->account);
+	while (logs != NULL) {
+		char *text = logger->read(logs->data, &flags);
+		read_bytes += strlen(text);
+		g_free(text);
+		purple_log_free(logs->data);
+		logs = g_list_delete_link(logs, logs);
+	}
+	read_time = bench_now() - start;
+	read_allocs = alloc_count() - read_allocs;
+
+	g_array_sort(latencies, bench_sample_compare);
+	printf("%s\n"
+	       "  write: %.0f messages/s, %.1f allocations/message, %.1f bytes/message\n"
+	       "  write latency: p50 %.2f us, p99 %.2f us, max %.2f us\n"
+	       "  flush: %.2f ms\n"
+	       "  read: %.1f KB in %.2f ms, %" G_GUINT64_FORMAT " allocations\n",
+	       logger->id,
+	       elapsed > 0 ? params->messages * 1e9 / elapsed : 0.0,
+	       bench_per(allocs, params->messages), bench_per(bytes, params->messages),
+	       bench_percentile(latencies, 0.5), bench_percentile(latencies, 0.99),
+	       bench_percentile(latencies, 1),
+	       flushed / 1e6, read_bytes / 1024.0, read_time / 1e6, read_allocs);
+
+	stub_conversation_destroy(conv);
+	g_array_free(latencies, TRUE);
+	g_strfreev(messages);
+	g_strfreev(nicks);
+	g_free(name);
+}
+
+static void
+bench_write(const BenchParams *params)
+{
+	bench_logger(params, colornicks_logger);
+	bench_logger(params, colornicks_gz_logger);
+}
+
+/* Writes the traffic through a logger, then reads it back whole, as the
+ * log viewer does, and in windows, as the history plugin does through
+ * colornicks_logger_read_window() */
+static void
+bench_throughput_logger(const BenchParams *params, PurpleLogLogger *logger)
+{
+	char **messages = bench_messages(params);
+	char **nicks = bench_nicks(params->nicks);
+	char *name = bench_log_name();
+	time_t now = time(NULL);
+	guint64 start, wrote, read = G_MAXUINT64, first, bytes = 0, read_bytes = 0, disk = 0;
+	GArray *latest, *ranges;
+	PurpleLogReadFlags flags;
+	PurpleLog *log;
+	GList *logs, *l;
+	int i;
+
+	/* Ten messages a second, so a five second window holds fifty */
+	log = purple_log_new(PURPLE_LOG_IM, name, params->account, NULL, now, NULL);
+	log->logger = logger;
+	start = bench_now();
+	for (i = 0; i < params->messages; i++)
+		bytes += logger->write(log, i % 2 ? PURPLE_MESSAGE_RECV : PURPLE_MESSAGE_SEND,
+		                       nicks[i % params->nicks], now + i / 10, messages[i]);
+	writer_flush_all();
+	wrote = bench_now() - start;
+	purple_log_free(log);
+	bench_iterate();
+
+	logs = logger->list(PURPLE_LOG_IM, name, params->account);
+	for (l = logs; l != NULL; l = l->next) {
+		PurpleLogCommonLoggerData *data = ((PurpleLog *)l->data)->logger_data;
+		struct stat st;
+
+		if (g_stat(data->path, &st) == 0)
+			disk += st.st_size;
+	}
+
+	/* The best of a few, once the files are in the page cache */
+	for (i = 0; i < 5; i++) {
+		guint64 t = bench_now();
+
+		read_bytes = 0;
+		for (l = logs; l != NULL; l = l->next) {
+			char *text = logger->read(l->data, &flags);
+			read_bytes += strlen(text);
+			g_free(text);
+		}
+		read = MIN(read, bench_now() - t);
+	}
+
+	/* The first windowed read of a log builds its sidecar index */
+	log = logs->data;
+	start = bench_now();
+	g_free(colornicks_logger_read_window(log, 50, 0, 0, NULL));
+	first = bench_now() - start;
+
+	latest = g_array_new(FALSE, FALSE, sizeof(guint64));
+	ranges = g_array_new(FALSE, FALSE, sizeof(guint64));
+	for (i = 0; i < 100; i++) {
+		time_t from = log->time + (time_t)params->messages / 10 * i / 100;
+		guint64 t = bench_now();
+
+		g_free(colornicks_logger_read_window(log, 50, 0, 0, NULL));
+		t = bench_now() - t;
+		g_array_append_val(latest, t);
+
+		t = bench_now();
+		g_free(colornicks_logger_read_window(log, 0, from, from + 4, NULL));
+		t = bench_now() - t;
+		g_array_append_val(ranges, t);
+	}
+	g_array_sort(latest, bench_sample_compare);
+	g_array_sort(ranges, bench_sample_compare);
+
+	printf("%s\n"
+	       "  write: %.1f MB in %.2f s with the flush, %.1f MB/s; %.1f MB on disk (%.1fx)\n"
+	       "  read whole: %.1f MB/s\n"
+	       "  read window: first (indexing the log) %.2f ms; last 50 messages p50 %.3f ms, p99 %.3f ms;\n"
+	       "    5 s in the middle p50 %.3f ms, p99 %.3f ms\n",
+	       logger->id, bytes / 1048576.0, wrote / 1e9,
+	       wrote > 0 ? bytes * 1e9 / 1048576.0 / wrote : 0.0,
+	       disk / 1048576.0, disk > 0 ? (double)bytes / disk : 0.0,
+	       read > 0 ? read_bytes * 1e9 / 1048576.0 / read : 0.0,
+	       first / 1e6, bench_percentile(latest, 0.5) / 1e3, bench_percentile(latest, 0.99) / 1e3,
+	       bench_percentile(ranges, 0.5) / 1e3, bench_percentile(ranges, 0.99) / 1e3);
+
+	g_array_free(latest, TRUE);
+	g_array_free(ranges, TRUE);
+	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+	g_strfreev(messages);
+	g_strfreev(nicks);
+	g_free(name);
+}
+
+static void
+bench_throughput(const BenchParams *params)
+{
+	bench_throughput_logger(params, colornicks_logger);
+	bench_throughput_logger(params, colornicks_gz_logger);
+}
+
+static void
+bench_colors(const BenchParams *params)
+{
+	PurpleConversation *conv = stub_conversation_new(PURPLE_CONV_TYPE_CHAT, params->account, "colors");
+	PidginConversation *gtkconv = PIDGIN_CONVERSATION(conv);
+	char **nicks = bench_nicks(params->nicks);
+	guint64 start, elapsed, rebuild, allocs;
+	int i;
+
+	get_nick_color(gtkconv, nicks[0]);
+
+	allocs = alloc_count();
+	start = bench_now();
+	for (i = 0; i < params->messages; i++)
+		get_nick_color(gtkconv, nicks[i % params->nicks]);
+	elapsed = bench_now() - start;
+	allocs = alloc_count() - allocs;
+
+	/* A theme change drops the palette */
+	start = bench_now();
+	g_signal_emit_by_name(gtkconv->webview, NICK_COLOR_STYLE_SIGNAL);
+	get_nick_color(gtkconv, nicks[0]);
+	rebuild = bench_now() - start;
+
+	printf("get_nick_color\n"
+	       "  lookup: %.0f ns, %.2f allocations\n"
+	       "  palette rebuild: %.2f us\n",
+	       bench_per(elapsed, params->messages), bench_per(allocs, params->messages),
+	       rebuild / 1e3);
+
+	stub_conversation_destroy(conv);
+	g_strfreev(nicks);
+}
+
+/* Every message has an image, most of them already saved */
+static void
+bench_images(const BenchParams *params)
+{
+	char *name = bench_log_name();
+	PurpleLog *log = purple_log_new(PURPLE_LOG_IM, name, params->account, NULL, time(NULL), NULL);
+	char **messages = g_new0(char *, params->messages + 1);
+	guint64 start, elapsed, allocs;
+	char *dir;
+	int i;
+
+	log->logger = NULL;
+	for (i = 0; i < params->messages; i++)
+		messages[i] = g_strdup_printf("look at this <img id=\"%d\"> and this",
+		                              params->image_ids[i % BENCH_IMAGES]);
+	dir = purple_log_get_log_dir(log->type, log->name, log->account);
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	allocs = alloc_count();
+	start = bench_now();
+	for (i = 0; i < params->messages; i++) {
+		char *converted = convert_image_tags(log, messages[i]);
+		if (converted != messages[i])
+			g_free(converted);
+	}
+	elapsed = bench_now() - start;
+	allocs = alloc_count() - allocs;
+
+	printf("convert_image_tags\n"
+	       "  %.2f us, %.1f allocations per message with an image\n",
+	       bench_per(elapsed, params->messages) / 1e3, bench_per(allocs, params->messages));
+
+	purple_log_free(log);
+	g_strfreev(messages);
+	g_free(dir);
+	g_free(name);
+}
+
+/* Set when a benchmark finds the plugin got something wrong */
+static gboolean bench_failed = FALSE;
+
+/* A line the way the stock HTML logger writes it, the color left out for
+ * a line it would write in its fixed color */
+static char *
+recolor_bench_line(int kind, const char *color, const char *nick, const char *message, int n)
+{
+	char date[16];
+
+	g_snprintf(date, sizeof(date), "%02d:%02d:%02d", n / 3600 % 24, n / 60 % 60, n % 60);
+	switch (kind) {
+	case 0:
+		return g_strdup_printf("<font color=\"%s\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+		                       color ? color : "#A82F2F", date, nick, message);
+	case 1:
+		return g_strdup_printf("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+		                       date, nick, message);
+	default:
+		return g_strdup_printf("<font color=\"%s\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n",
+		                       color ? color : "#A82F2F", date, nick, message);
+	}
+}
+
+/* Recolors a log the stock HTML logger wrote, as "Recolor Old Logs" does,
+ * and checks every line: received lines and auto-replies in the fixed
+ * color get their nick's color, and sent lines and lines colored already
+ * are left as they were */
+static void
+bench_recolor(const BenchParams *params)
+{
+	PurpleConversation *conv = stub_conversation_new(PURPLE_CONV_TYPE_CHAT, params->account, "recolor");
+	PidginConversation *gtkconv = PIDGIN_CONVERSATION(conv);
+	char **messages = bench_messages(params);
+	char **nicks = bench_nicks(params->nicks);
+	GString *in = g_string_new("<html><head><title>Conversation with recolor</title></head>"
+	                           "<body><h3>Conversation with recolor</h3>\n");
+	GString *expected = g_string_new(in->str);
+	PurplePluginAction action;
+	NickColorCache *cache;
+	char *dir, *path, *contents = NULL;
+	guint64 start, elapsed;
+	guint recolored = 0;
+	int i;
+
+	/* The palette is taken from the only open conversation */
+	get_nick_color(gtkconv, "");
+	cache = g_object_get_data(G_OBJECT(gtkconv->webview), "colornicks-nick-colors");
+
+	for (i = 0; i < params->messages; i++) {
+		const char *nick = nicks[i % params->nicks];
+		const char *color = cache->palette[g_str_hash(nick) % cache->len];
+		int kind = i % 4 == 3 ? 0 : i % 4;
+		char *line;
+
+		/* Every fourth line has a nick color already */
+		line = recolor_bench_line(kind, i % 4 == 3 ? "#123456" : NULL, nick, messages[i], i);
+		g_string_append(in, line);
+		g_free(line);
+
+		if (kind != 1 && i % 4 != 3) {
+			line = recolor_bench_line(kind, color, nick, messages[i], i);
+			recolored++;
+		} else {
+			line = recolor_bench_line(kind, i % 4 == 3 ? "#123456" : NULL, nick, messages[i], i);
+		}
+		g_string_append(expected, line);
+		g_free(line);
+	}
+
+	dir = purple_log_get_log_dir(PURPLE_LOG_IM, "recolor", params->account);
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	path = g_build_filename(dir, "2014-01-01.120000+0000UTC.html", NULL);
+	g_file_set_contents(path, in->str, in->len, NULL);
+
+	/* The action refuses to run while the stock logger writes */
+	purple_prefs_set_string("/purple/logging/format", colornicks_logger->id);
+	memset(&action, 0, sizeof(action));
+	start = bench_now();
+	recolor_logs_action(&action);
+	while (recolor_job != NULL)
+		g_main_context_iteration(NULL, TRUE);
+	elapsed = bench_now() - start;
+	purple_prefs_set_string("/purple/logging/format", "html");
+
+	printf("recolor\n"
+	       "  %d lines, %u of them to recolor, %.1f MB in %.2f s, %.1f MB/s\n",
+	       params->messages, recolored, in->len / 1048576.0, elapsed / 1e9,
+	       elapsed > 0 ? in->len * 1e9 / 1048576.0 / elapsed : 0.0);
+
+	if (!g_file_get_contents(path, &contents, NULL, NULL) || strcmp(contents, expected->str) != 0) {
+		const char *got = contents ? contents : "";
+		gsize at = 0;
+
+		while (got[at] != '\0' && got[at] == expected->str[at])
+			at++;
+		while (at > 0 && expected->str[at - 1] != '\n')
+			at--;
+		printf("  FAILED, from:\n  got:      %.*s\n  expected: %.*s\n",
+		       (int)strcspn(got + at, "\n"), got + at,
+		       (int)strcspn(expected->str + at, "\n"), expected->str + at);
+		bench_failed = TRUE;
+	} else {
+		printf("  output as expected\n");
+	}
+
+	stub_conversation_destroy(conv);
+	g_free(contents);
+	g_free(path);
+	g_free(dir);
+	g_string_free(in, TRUE);
+	g_string_free(expected, TRUE);
+	g_strfreev(messages);
+	g_strfreev(nicks);
+}
+
+/* A message for the classify mixes: plain text from a few words to a
+ * paragraph, wrapped in markup the way rich text clients send it, or with
+ * an image */
+static char *
+classify_bench_message(const BenchParams *params, MessageClass kind, int n)
+{
+	static const char words[] = "sure, see you at 5 - it's fine (I think) ";
+	static const int lengths[] = { 12, 24, 40, 80, 80, 160, 400 };
+	GString *msg = g_string_new(NULL);
+	int len = lengths[n % G_N_ELEMENTS(lengths)];
+
+	while ((int)msg->len < len)
+		g_string_append(msg, words + n % 7);
+	g_string_truncate(msg, len);
+
+	if (kind == MESSAGE_IMAGES) {
+		g_string_append_printf(msg, " <img id=\"%d\">", params->image_ids[n % BENCH_IMAGES]);
+	} else if (kind == MESSAGE_MARKUP && n % 2 == 0) {
+		g_string_prepend(msg, "<FONT COLOR=\"#0000FF\"><B>");
+		g_string_append(msg, " &amp; more</B></FONT>");
+	} else if (kind == MESSAGE_MARKUP) {
+		g_string_append(msg, " <a href=\"http://example.com/?a=1&amp;b=2\">this</a>");
+	}
+
+	return g_string_free(msg, FALSE);
+}
+
+/* The message as it goes into a line, either the way every message used
+ * to be converted or the way colornicks_logger_write_common() converts it
+ * now */
+static char *
+classify_bench_convert(PurpleLog *log, const char *message, gboolean classify)
+{
+	char *image_corrected_msg, *msg_fixed;
+
+	if (classify) {
+		switch (classify_message(message)) {
+		case MESSAGE_PLAIN:
+			return g_strdup(message);
+		case MESSAGE_MARKUP:
+			purple_markup_html_to_xhtml(message, &msg_fixed, NULL);
+			return msg_fixed;
+		default:
+			break;
+		}
+	}
+
+	image_corrected_msg = convert_image_tags(log, message);
+	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
+	if (image_corrected_msg != message)
+		g_free(image_corrected_msg);
+	return msg_fixed;
+}
+
+/* Per message cost of getting messages ready to log, before and after
+ * classify_message(), over mixes of plain text, markup and images */
+static void
+bench_classify(const BenchParams *params)
+{
+	static const struct {
+		const char *name;
+		int markup;   /* percent of messages */
+		int images;   /* percent of messages */
+	} mixes[] = {
+		{ "plain text", 0, 0 },
+		{ "IM, mostly plain", 8, 1 },
+		{ "rich text client", 60, 1 },
+		{ "all markup", 100, 0 }
+	};
+	char *name = bench_log_name();
+	PurpleLog *log = purple_log_new(PURPLE_LOG_IM, name, params->account, NULL, time(NULL), NULL);
+	char **messages = g_new0(char *, params->messages + 1);
+	char *dir;
+	guint m;
+	int i;
+
+	log->logger = NULL;
+	dir = purple_log_get_log_dir(log->type, log->name, log->account);
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	printf("classify\n");
+	for (m = 0; m < G_N_ELEMENTS(mixes); m++) {
+		guint64 elapsed[2], allocs[2];
+		int pass;
+
+		for (i = 0; i < params->messages; i++) {
+			guint roll = ((guint)i * 2654435761u >> 8) % 100;
+			MessageClass kind = MESSAGE_PLAIN;
+
+			if (roll < (guint)mixes[m].images)
+				kind = MESSAGE_IMAGES;
+			else if (roll < (guint)(mixes[m].images + mixes[m].markup))
+				kind = MESSAGE_MARKUP;
+			messages[i] = classify_bench_message(params, kind, i);
+		}
+
+		/* Once so the images are stored, then without and with classifying */
+		for (pass = -1; pass < 2; pass++) {
+			guint64 start = bench_now(), count = alloc_count();
+
+			for (i = 0; i < params->messages; i++)
+				g_free(classify_bench_convert(log, messages[i], pass == 1));
+			if (pass >= 0) {
+				elapsed[pass] = bench_now() - start;
+				allocs[pass] = alloc_count() - count;
+			}
+		}
+
+		printf("  %s: before %.0f ns, %.1f allocations; after %.0f ns, %.1f allocations (%.1fx)\n",
+		       mixes[m].name,
+		       bench_per(elapsed[0], params->messages), bench_per(allocs[0], params->messages),
+		       bench_per(elapsed[1], params->messages), bench_per(allocs[1], params->messages),
+		       elapsed[1] > 0 ? (double)elapsed[0] / elapsed[1] : 0.0);
+
+		for (i = 0; i < params->messages; i++)
+			g_free(messages[i]);
+	}
+
+	purple_log_free(log);
+	g_free(messages);
+	g_free(dir);
+	g_free(name);
+}
+
+/* Words for the search corpus, unique by rank: the rank spelled in
+ * syllables, the commonest words having the fewest */
+static char *
+search_corpus_word(guint rank)
+{
+	static const char consonants[] = "bcdfghjklmnprstvwxyz";
+	static const char vowels[] = "aeiou";
+	char word[16];
+	guint span = 100, syllables = 1, i;
+
+	while (rank >= span && syllables < 7) {
+		rank -= span;
+		span *= 100;
+		syllables++;
+	}
+	for (i = syllables; i > 0; i--) {
+		word[2 * i - 2] = consonants[rank % 100 / 5];
+		word[2 * i - 1] = vowels[rank % 5];
+		rank /= 100;
+	}
+	word[2 * syllables] = '\0';
+	return g_strdup(word);
+}
+
+#define SEARCH_VOCABULARY 20000
+#define SEARCH_RANKS (1 << 20)
+
+/* Text with Zipf's frequencies, as in real conversations: the word ranked
+ * k turns up 1/k as often as the commonest. A random index into ranks,
+ * laid out by the cumulative frequency, picks the next word. */
+typedef struct {
+	char **words;
+	guint32 *ranks;
+	GRand *rand;
+} SearchCorpus;
+
+static void
+search_corpus_init(SearchCorpus *corpus)
+{
+	double total = 0, sum = 0;
+	guint i, k = 0;
+
+	corpus->words = g_new0(char *, SEARCH_VOCABULARY + 1);
+	corpus->ranks = g_new(guint32, SEARCH_RANKS);
+	corpus->rand = g_rand_new_with_seed(1);
+
+	for (i = 0; i < SEARCH_VOCABULARY; i++) {
+		corpus->words[i] = search_corpus_word(i);
+		total += 1.0 / (i + 1);
+	}
+	for (i = 0; i < SEARCH_VOCABULARY; i++) {
+		guint end;
+
+		sum += 1.0 / (i + 1);
+		end = MIN((guint)(sum / total * SEARCH_RANKS), SEARCH_RANKS);
+		for (; k < end; k++)
+			corpus->ranks[k] = i;
+	}
+	for (; k < SEARCH_RANKS; k++)
+		corpus->ranks[k] = SEARCH_VOCABULARY - 1;
+}
+
+static void
+search_corpus_free(SearchCorpus *corpus)
+{
+	g_strfreev(corpus->words);
+	g_free(corpus->ranks);
+	g_rand_free(corpus->rand);
+}
+
+/* Writes about bytes of logs laid out as the colornicks logger writes
+ * them, straight to the files, a day's conversation with one of the
+ * buddies to a file. Returns the number of messages. */
+static guint64
+search_corpus_write(SearchCorpus *corpus, const BenchParams *params, guint64 bytes,
+                    guint *files)
+{
+	GString *line = g_string_sized_new(params->size + 128);
+	time_t day = 1388577600;   /* noon, 1 January 2014 */
+	guint64 written = 0, messages = 0;
+	char **nicks = bench_nicks(params->nicks);
+	int buddy = 0;
+
+	*files = 0;
+	while (written < bytes) {
+		char *name = g_strdup_printf("buddy%d", buddy);
+		char *dir = purple_log_get_log_dir(PURPLE_LOG_IM, name, params->account);
+		char stamp[32], *path;
+		FILE *file;
+		guint64 end = MIN(written + 256 * 1024, bytes);
+		int i;
+
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d.%H%M%S", gmtime(&day));
+		path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s+0000UTC.htm", dir, stamp);
+		purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+		if ((file = g_fopen(path, "wb")) == NULL) {
+			fprintf(stderr, "Unable to write %s: %s\n", path, g_strerror(errno));
+			g_free(path);
+			g_free(dir);
+			g_free(name);
+			break;
+		}
+
+		g_string_printf(line, "<html><head><meta http-equiv=\"content-type\" "
+		                "content=\"text/html; charset=UTF-8\"><title>Conversation with %s "
+		                "at %s on %s (jabber)</title></head><body><h3>Conversation with %s "
+		                "at %s on %s (jabber)</h3>\n", name, stamp,
+		                purple_account_get_username(params->account), name, stamp,
+		                purple_account_get_username(params->account));
+		for (i = 0; written < end; i++) {
+			fwrite(line->str, line->len, 1, file);
+			written += line->len;
+
+			if (i % 2 == 0)
+				g_string_printf(line, "<font color=\"#16569E\"><font size=\"2\">(%02d:%02d:%02d)"
+				                "</font> <b>%s:</b></font> ", i / 3600 % 24, i / 60 % 60, i % 60,
+				                purple_account_get_username(params->account));
+			else
+				g_string_printf(line, "<font color=\"#A82F2F\"><font size=\"2\">(%02d:%02d:%02d)"
+				                "</font> <b>%s:</b></font> ", i / 3600 % 24, i / 60 % 60, i % 60,
+				                nicks[i / 2 % params->nicks]);
+			while ((int)line->len < params->size + 64) {
+				guint32 r = g_rand_int(corpus->rand);
+				g_string_append(line, corpus->words[corpus->ranks[r & (SEARCH_RANKS - 1)]]);
+				g_string_append_c(line, ' ');
+			}
+			g_string_truncate(line, line->len - 1);
+			g_string_append(line, "<br/>\n");
+			messages++;
+		}
+		fwrite(line->str, line->len, 1, file);
+		written += line->len;
+		fclose(file);
+		(*files)++;
+
+		/* Every buddy gets a log, then the next day starts */
+		if (++buddy == 64) {
+			buddy = 0;
+			day += 24 * 60 * 60;
+		}
+		g_free(path);
+		g_free(dir);
+		g_free(name);
+	}
+
+	g_strfreev(nicks);
+	g_string_free(line, TRUE);
+	return messages;
+}
+
+/* Bytes of logs under path, as the rebuild finds them */
+static guint64
+search_logs_size(const char *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+	guint64 size = 0;
+
+	if (dir == NULL)
+		return 0;
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		char *child = g_build_filename(path, name, NULL);
+		struct stat st;
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			size += search_logs_size(child);
+		else if ((purple_str_has_suffix(name, ".htm") || purple_str_has_suffix(name, CZ_EXTENSION)) &&
+		         g_stat(child, &st) == 0)
+			size += st.st_size;
+		g_free(child);
+	}
+	g_dir_close(dir);
+	return size;
+}
+
+/* Rebuilds the search index over a synthetic corpus of --corpus
+ * megabytes, loads it cold, and times queries of words from across the
+ * frequency range */
+static void
+bench_search(const BenchParams *params)
+{
+	static const struct {
+		const char *what;
+		guint ranks[3];
+		guint n;
+	} queries[] = {
+		{ "the commonest word", { 0 }, 1 },
+		{ "a rare word", { 15000 }, 1 },
+		{ "two common words", { 1, 2 }, 2 },
+		{ "a common and a rare word", { 0, 12000 }, 2 },
+		{ "three words", { 3, 10, 30 }, 3 },
+		{ "a word never used", { SEARCH_VOCABULARY + 1 }, 1 }
+	};
+	SearchCorpus corpus;
+	PurplePluginAction action;
+	GHashTableIter iter;
+	GArray *hits, *latencies;
+	struct stat st;
+	gpointer value;
+	char *path;
+	guint64 start, generated, rebuilt, loaded, lines, allocs, messages, scanned, postings = 0;
+	guint files, terms, q, i;
+
+	search_corpus_init(&corpus);
+	start = bench_now();
+	messages = search_corpus_write(&corpus, params, (guint64)params->corpus << 20, &files);
+	generated = bench_now() - start;
+
+	/* Logs the other benchmarks wrote are indexed too */
+	path = g_build_filename(purple_user_dir(), "logs", NULL);
+	scanned = search_logs_size(path);
+	g_free(path);
+
+	/* As the action runs it: a thread, reporting back from an idle callback */
+	memset(&action, 0, sizeof(action));
+	allocs = alloc_count();
+	start = bench_now();
+	search_rebuild_action(&action);
+	while (search_rebuild != NULL)
+		g_main_context_iteration(NULL, TRUE);
+	rebuilt = bench_now() - start;
+	allocs = alloc_count() - allocs;
+
+	g_mutex_lock(&search_lock);
+	terms = search_terms != NULL ? g_hash_table_size(search_terms) : 0;
+	if (search_terms != NULL) {
+		g_hash_table_iter_init(&iter, search_terms);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			postings += ((SearchTerm *)value)->postings->len;
+		g_hash_table_destroy(search_terms);
+		search_terms = NULL;
+	}
+	g_mutex_unlock(&search_lock);
+
+	path = search_index_path("postings");
+	if (g_stat(path, &st) != 0)
+		st.st_size = 0;
+	g_free(path);
+
+	/* The first search after Pidgin starts */
+	start = bench_now();
+	search_index_load_terms();
+	loaded = bench_now() - start;
+
+	printf("search\n"
+	       "  corpus: %.1f MB in %u logs, %" G_GUINT64_FORMAT " messages (written in %.2f s)\n"
+	       "  rebuild: %.1f MB of logs in %.2f s, %.1f MB/s, %.0f allocations/MB\n"
+	       "  index: %u terms, %" G_GUINT64_FORMAT " postings, %.1f MB on disk, %.1f MB of postings in memory\n"
+	       "  load: %.2f s\n",
+	       (double)params->corpus, files, messages, generated / 1e9,
+	       scanned / 1048576.0, rebuilt / 1e9,
+	       rebuilt > 0 ? scanned * 1e9 / 1048576.0 / rebuilt : 0.0,
+	       scanned > 0 ? allocs * 1048576.0 / scanned : 0.0,
+	       terms, postings, st.st_size / 1048576.0, postings * sizeof(guint64) / 1048576.0,
+	       loaded / 1e9);
+
+	latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+	for (q = 0; q < G_N_ELEMENTS(queries); q++) {
+		GString *query = g_string_new(NULL);
+		guint found = 0;
+
+		for (i = 0; i < queries[q].n; i++) {
+			char *word = search_corpus_word(queries[q].ranks[i]);
+			g_string_append_printf(query, "%s%s", i > 0 ? " " : "", word);
+			g_free(word);
+		}
+
+		g_array_set_size(latencies, 0);
+		for (i = 0; i < 100; i++) {
+			guint64 t = bench_now();
+			hits = search_index_query(query->str, 200);
+			t = bench_now() - t;
+			g_array_append_val(latencies, t);
+			found = hits->len;
+			g_array_free(hits, TRUE);
+		}
+		g_array_sort(latencies, bench_sample_compare);
+		printf("  \"%s\" (%s): %u hits, p50 %.3f ms, p99 %.3f ms\n",
+		       query->str, queries[q].what, found,
+		       bench_percentile(latencies, 0.5) / 1e3, bench_percentile(latencies, 0.99) / 1e3);
+		g_string_free(query, TRUE);
+	}
+
+	/* What the results window shows, as search_logs_cb() reads it */
+	hits = search_index_query(corpus.words[0], 200);
+	start = bench_now();
+	for (i = 0; i < hits->len; i++) {
+		guint64 posting = g_array_index(hits, guint64, i);
+		g_free(search_hit_line(g_ptr_array_index(search_files, SEARCH_POSTING_FILE(posting)),
+		                       SEARCH_POSTING_OFFSET(posting)));
+	}
+	lines = bench_now() - start;
+	printf("  reading the lines of %u hits: %.2f ms\n", hits->len, lines / 1e6);
+	g_array_free(hits, TRUE);
+
+	/* Leave the memory to the benchmarks after this one */
+	g_mutex_lock(&search_lock);
+	if (search_terms != NULL)
+		g_hash_table_destroy(search_terms);
+	search_terms = NULL;
+	g_mutex_unlock(&search_lock);
+
+	g_array_free(latencies, TRUE);
+	search_corpus_free(&corpus);
+}
+
+/* A log being replayed, with a conversation for its nick colors */
+typedef struct {
+	PurpleLog *log;
+	PurpleConversation *conv;
+} ReplayLog;
+
+static void
+replay_log_free(gpointer data)
+{
+	ReplayLog *rlog = data;
+
+	purple_log_free(rlog->log);
+	if (rlog->conv != NULL)
+		stub_conversation_destroy(rlog->conv);
+	g_free(rlog);
+}
+
+static PurpleAccount *
+bench_account(const char *username, const char *protocol_id)
+{
+	PurpleAccount *account = purple_accounts_find(username, protocol_id);
+	return account != NULL ? account : stub_account_new(username, protocol_id);
+}
+
+/* Writes what a trace recorded by the plugin logged again, into logs of
+ * the same names under the throwaway user directory */
+static void
+bench_replay(const BenchParams *params)
+{
+	PurpleLogLogger *logger = colornicks_logger;
+	GHashTable *logs;
+	GArray *latencies;
+	BenchTrace trace;
+	const char *fields[8];
+	guint64 start, elapsed, allocs, bytes = 0;
+	guint skipped = 0;
+	char type;
+	int n;
+
+	if (params->trace == NULL) {
+		fprintf(stderr, "The replay benchmark needs a trace, given with --trace\n");
+		return;
+	}
+	if (params->logger != NULL && strcmp(params->logger, colornicks_gz_logger->id) == 0) {
+		logger = colornicks_gz_logger;
+	} else if (params->logger != NULL && strcmp(params->logger, colornicks_logger->id) != 0) {
+		fprintf(stderr, "Unknown logger: %s (try %s or %s)\n", params->logger,
+		        colornicks_logger->id, colornicks_gz_logger->id);
+		return;
+	}
+	if (!bench_trace_open(&trace, params->trace, TRACE_MAGIC, params->speed))
+		return;
+
+	logs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, replay_log_free);
+	latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+	trace_replaying = TRUE;
+
+	allocs = alloc_count();
+	start = bench_now();
+	while ((n = bench_trace_next(&trace, &type, fields, G_N_ELEMENTS(fields))) >= 0) {
+		ReplayLog *rlog;
+		char *key;
+		guint64 t;
+
+		if (n < 4 || (type == 'W' && n < 8) || (type != 'W' && type != 'C')) {
+			skipped++;
+			continue;
+		}
+
+		key = g_strjoin("\n", fields[0], fields[1], fields[2], fields[3], NULL);
+		if (type == 'C') {
+			g_hash_table_remove(logs, key);
+			g_free(key);
+			continue;
+		}
+
+		if ((rlog = g_hash_table_lookup(logs, key)) == NULL) {
+			PurpleLogType log_type = atoi(fields[0]);
+			PurpleAccount *account = bench_account(fields[2], fields[3]);
+
+			rlog = g_new0(ReplayLog, 1);
+			if (log_type != PURPLE_LOG_SYSTEM)
+				rlog->conv = stub_conversation_new(log_type == PURPLE_LOG_CHAT ?
+				                                   PURPLE_CONV_TYPE_CHAT : PURPLE_CONV_TYPE_IM,
+				                                   account, fields[1]);
+			rlog->log = purple_log_new(log_type, fields[1], account, rlog->conv,
+			                           g_ascii_strtoll(fields[6], NULL, 10), NULL);
+			rlog->log->logger = logger;
+			g_hash_table_insert(logs, key, rlog);
+		} else {
+			g_free(key);
+		}
+
+		t = bench_now();
+		bytes += logger->write(rlog->log, atoi(fields[4]), fields[5],
+		                       g_ascii_strtoll(fields[6], NULL, 10), fields[7]);
+		t = bench_now() - t;
+		g_array_append_val(latencies, t);
+	}
+	g_hash_table_destroy(logs);
+	writer_flush_all();
+	elapsed = bench_now() - start;
+	allocs = alloc_count() - allocs;
+	trace_replaying = FALSE;
+
+	g_array_sort(latencies, bench_sample_compare);
+	printf("replay through %s\n"
+	       "  %u records (%u skipped), %u writes in %.2f s, %.0f writes/s\n"
+	       "  %.1f allocations/write, %.1f bytes/write\n"
+	       "  write latency: p50 %.2f us, p99 %.2f us, max %.2f us\n",
+	       logger->id, trace.records, skipped, latencies->len, elapsed / 1e9,
+	       elapsed > 0 ? latencies->len * 1e9 / elapsed : 0.0,
+	       bench_per(allocs, latencies->len), bench_per(bytes, latencies->len),
+	       bench_percentile(latencies, 0.5), bench_percentile(latencies, 0.99),
+	       bench_percentile(latencies, 1));
+
+	g_array_free(latencies, TRUE);
+	bench_trace_close(&trace);
+}
+
+static const Bench benches[] = {
+	{ "write", bench_write },     /* colornicks_logger_write() and _read(), both formats */
+	{ "throughput", bench_throughput },  /* MB/s written and read, whole and windowed, both formats */
+	{ "colors", bench_colors },   /* get_nick_color() */
+	{ "images", bench_images },   /* convert_image_tags() */
+	{ "classify", bench_classify },  /* converting messages to log, with and without classify_message() */
+	{ "search", bench_search },   /* the search index, rebuilt over a synthetic corpus */
+	{ "recolor", bench_recolor },  /* "Recolor Old Logs" over a stock HTML log, checked */
+	{ "replay", bench_replay }    /* a recorded trace, through one logger */
+};
+
+int
+main(int argc, char *argv[])
+{
+	static const guchar image[] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n', 0, 0, 0, 0, 'I', 'E', 'N', 'D',
+		0xae, 'B', 0x60, 0x82
+	};
+	BenchParams params;
+	char **prefs = NULL;
+	gboolean keep = FALSE, described = FALSE;
+	GOptionEntry entries[] = {
+		{ "messages", 'm', 0, G_OPTION_ARG_INT, NULL, "Messages per run (20000)", "N" },
+		{ "nicks", 'n', 0, G_OPTION_ARG_INT, NULL, "Nicks; more than 2 is a chat (2)", "N" },
+		{ "size", 's', 0, G_OPTION_ARG_INT, NULL, "Message size in bytes (80)", "BYTES" },
+		{ "markup", 0, 0, G_OPTION_ARG_INT, NULL, "Messages with markup (20)", "PERCENT" },
+		{ "images", 0, 0, G_OPTION_ARG_INT, NULL, "Messages with images (1)", "PERCENT" },
+		{ "pref", 'p', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "Set a plugin pref, like journal=1", "NAME=VALUE" },
+		{ "keep", 'k', 0, G_OPTION_ARG_NONE, NULL, "Keep the logs that were written", NULL },
+		{ "trace", 't', 0, G_OPTION_ARG_FILENAME, NULL, "Trace to replay", "FILE" },
+		{ "speed", 0, 0, G_OPTION_ARG_INT, NULL, "Replay at this many times the original pace (0, as fast as possible)", "N" },
+		{ "logger", 'l', 0, G_OPTION_ARG_STRING, NULL, "Logger to replay through (colornicks)", "ID" },
+		{ "corpus", 'c', 0, G_OPTION_ARG_INT, NULL, "Megabytes of logs to search (64)", "MB" },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GError *error = NULL;
+	PurplePlugin plugin;
+	char *dir;
+	gsize b;
+	int i;
+
+	/* Slices are allocations too */
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+	/* Arguments are in the locale's encoding */
+	setlocale(LC_ALL, "");
+
+	params.messages = 20000;
+	params.nicks = 2;
+	params.size = 80;
+	params.markup = 20;
+	params.images = 1;
+	params.trace = NULL;
+	params.speed = 0;
+	params.logger = NULL;
+	params.corpus = 64;
+	entries[0].arg_data = &params.messages;
+	entries[1].arg_data = &params.nicks;
+	entries[2].arg_data = &params.size;
+	entries[3].arg_data = &params.markup;
+	entries[4].arg_data = &params.images;
+	entries[5].arg_data = &prefs;
+	entries[6].arg_data = &keep;
+	entries[7].arg_data = &params.trace;
+	entries[8].arg_data = &params.speed;
+	entries[9].arg_data = &params.logger;
+	entries[10].arg_data = &params.corpus;
+
+	context = g_option_context_new("[BENCHMARK...]");
+	g_option_context_set_summary(context,
+		"Benchmarks: write (the default), throughput, colors, images, classify, search,\n"
+		"recolor, replay of a trace the plugin recorded, or all of them with \"all\"\n"
+		"(replay only if --trace is given). The exit status is 1 if one of them found\n"
+		"the plugin's output wrong.");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	params.messages = MAX(params.messages, 1);
+	params.nicks = MAX(params.nicks, 1);
+	params.size = MAX(params.size, 1);
+	params.markup = CLAMP(params.markup, 0, 100);
+	params.images = CLAMP(params.images, 0, 100 - params.markup);
+	params.corpus = MAX(params.corpus, 1);
+
+	if ((dir = g_dir_make_tmp("colornicks-bench-XXXXXX", &error)) == NULL) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	stub_init(dir);
+	params.account = stub_account_new("bench@example.com", "prpl-jabber");
+
+	memset(&plugin, 0, sizeof(plugin));
+	purple_init_plugin(&plugin);
+	for (i = 0; prefs != NULL && prefs[i] != NULL; i++) {
+		if (!bench_set_pref("/plugins/gtk/colornicks_logger", prefs[i])) {
+			fprintf(stderr, "Unknown pref: %s\n", prefs[i]);
+			return 1;
+		}
+	}
+	plugin.info->load(&plugin);
+
+	/* A few distinct images, so some of them are saved */
+	for (i = 0; i < BENCH_IMAGES; i++) {
+		guchar *data = g_malloc(sizeof(image));
+		memcpy(data, image, sizeof(image));
+		data[8] = i;
+		params.image_ids[i] = purple_imgstore_add_with_id(data, sizeof(image), "benchmark.png");
+	}
+
+	if (!alloc_count_available())
+		printf("Allocations are only counted with glibc\n");
+
+	for (b = 0; b < G_N_ELEMENTS(benches); b++) {
+		gboolean run = argc < 2 && b == 0;
+
+		for (i = 1; i < argc; i++)
+			if (strcmp(argv[i], benches[b].name) == 0 ||
+			    (strcmp(argv[i], "all") == 0 && (benches[b].run != bench_replay || params.trace != NULL)))
+				run = TRUE;
+		/* The synthetic messages, once, ahead of the first run to use them */
+		if (run && !described && benches[b].run != bench_replay) {
+			printf("%d messages of %d bytes from %d nicks, %d%% markup, %d%% images\n",
+			       params.messages, params.size, params.nicks, params.markup, params.images);
+			described = TRUE;
+		}
+		if (run) {
+			benches[b].run(&params);
+			bench_iterate();
+		}
+	}
+	for (i = 1; i < argc; i++) {
+		gboolean known = strcmp(argv[i], "all") == 0;
+		for (b = 0; b < G_N_ELEMENTS(benches); b++)
+			known = known || strcmp(argv[i], benches[b].name) == 0;
+		if (!known)
+			fprintf(stderr, "Unknown benchmark: %s\n", argv[i]);
+	}
+
+	for (i = 0; i < BENCH_IMAGES; i++)
+		purple_imgstore_unref_by_id(params.image_ids[i]);
+	plugin.info->unload(&plugin);
+	bench_iterate();
+	stub_uninit();
+
+	if (keep)
+		printf("Logs are in %s\n", dir);
+	else
+		bench_remove_tree(dir);
+	g_free(dir);
+	g_strfreev(prefs);
+	g_free(params.trace);
+	g_free(params.logger);
+	return bench_failed ? 1 : 0;
+}
@@ -0,0 +1,2034 @@
+/*
+ * Stub libpurple - just enough of libpurple and Pidgin to run the plugins
+ * headless, for benchmarks. Prefs, accounts, conversations and stored
+ * images live in memory; logs are written under a user directory of the
+ * caller's choosing, named as libpurple names them. The markup helpers
+ * follow libpurple's, simplified, so they cost about the same.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+#include "internal.h"
+#include "debug.h"
+#include "gtkconv.h"
+#include "request.h"
+
+struct _PurpleAccount {
+	char *username;
+	char *protocol_id;
+	PurpleConnection *gc;
+};
+
+struct _PurpleConnection {
+	PurpleAccount *account;
+};
+
+struct _PurpleConvChat {
+	PurpleConversation *conv;
+	int id;
+};
+
+struct _PurpleConversation {
+	PurpleConversationType type;
+	PurpleAccount *account;
+	char *name;
+	GHashTable *data;
+	PurpleConvChat *chat;
+	PidginConversation *ui_data;
+};
+
+struct _PurpleStoredImage {
+	int id;
+	int ref;
+	gpointer data;
+	size_t size;
+	char *filename;
+};
+
+struct _PurpleValue {
+	PurpleType type;
+};
+
+typedef struct {
+	PurplePrefType type;
+	int value;            /* bool and int */
+	char *string;
+	GList *list;          /* of char * */
+} StubPref;
+
+typedef struct {
+	guint id;
+	void *handle;
+	char *name;
+	PurplePrefCallback cb;
+	gpointer data;
+} StubPrefCallback;
+
+static char *user_dir = NULL;
+static GHashTable *prefs = NULL;         /* name -> StubPref */
+static GList *pref_callbacks = NULL;     /* StubPrefCallback */
+static guint pref_callback_id = 0;
+static GList *accounts = NULL;
+static GList *conversations = NULL;
+static GList *loggers = NULL;
+static GHashTable *images = NULL;        /* id -> PurpleStoredImage */
+static int image_id = 0;
+static GHashTable *prpls = NULL;         /* id -> PurplePlugin */
+static gulong signal_id = 0;
+static int chat_id = 0;
+static PidginWindow window = { NULL };
+static PurpleConversation *focused = NULL;   /* the active tab, if the window has focus */
+static UnityLauncherEntry *launcher = NULL;
+static GHashTable *menu_sources = NULL;      /* messaging menu source IDs */
+static guint remote_calls = 0;
+static GList *saved_statuses = NULL;
+static PurpleSavedStatus *current_status = NULL;
+static int log_handle;
+
+/* debug.c */
+
+static void
+stub_debug(const char *level, const char *category, const char *format, va_list args)
+{
+	char *msg = g_strdup_vprintf(format, args);
+	fprintf(stderr, "%s: %s: %s", level, category, msg);
+	g_free(msg);
+}
+
+void
+purple_debug_misc(const char *category, const char *format, ...)
+{
+}
+
+void
+purple_debug_info(const char *category, const char *format, ...)
+{
+	va_list args;
+
+	if (g_getenv("PURPLE_STUB_DEBUG") == NULL)
+		return;
+	va_start(args, format);
+	stub_debug("info", category, format, args);
+	va_end(args);
+}
+
+void
+purple_debug_warning(const char *category, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	stub_debug("warning", category, format, args);
+	va_end(args);
+}
+
+void
+purple_debug_error(const char *category, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	stub_debug("error", category, format, args);
+	va_end(args);
+}
+
+gboolean
+purple_debug_is_verbose(void)
+{
+	return FALSE;
+}
+
+/* util.c */
+
+const char *
+purple_user_dir(void)
+{
+	return user_dir;
+}
+
+int
+purple_build_dir(const char *path, int mode)
+{
+	return g_mkdir_with_parents(path, mode);
+}
+
+const char *
+purple_escape_filename(const char *str)
+{
+	static char buf[4096];
+	gsize i = 0;
+
+	for (; *str != '\0' && i < sizeof(buf) - 4; str++) {
+		if (g_ascii_isalnum(*str) || *str == '@' || *str == '-' ||
+		    *str == '_' || *str == '.' || *str == '#' || (guchar)*str >= 0x80)
+			buf[i++] = *str;
+		else
+			i += g_snprintf(buf + i, 4, "%%%02x", (guchar)*str);
+	}
+	buf[i] = '\0';
+	return buf;
+}
+
+const char *
+purple_unescape_filename(const char *str)
+{
+	static char buf[4096];
+	gsize i = 0;
+
+	for (; *str != '\0' && i < sizeof(buf) - 1; str++) {
+		if (*str == '%' && g_ascii_isxdigit(str[1]) && g_ascii_isxdigit(str[2])) {
+			buf[i++] = g_ascii_xdigit_value(str[1]) << 4 | g_ascii_xdigit_value(str[2]);
+			str += 2;
+		} else {
+			buf[i++] = *str;
+		}
+	}
+	buf[i] = '\0';
+	return buf;
+}
+
+const char *
+purple_utf8_strftime(const char *format, const struct tm *tm)
+{
+	static char buf[128];
+	time_t now;
+
+	if (tm == NULL) {
+		now = time(NULL);
+		tm = localtime(&now);
+	}
+	if (strftime(buf, sizeof(buf), format, tm) == 0)
+		buf[0] = '\0';
+	return buf;
+}
+
+const char *
+purple_date_format_long(const struct tm *tm)
+{
+	return purple_utf8_strftime("%x", tm);
+}
+
+const char *
+purple_date_format_full(const struct tm *tm)
+{
+	return purple_utf8_strftime("%c", tm);
+}
+
+const char *
+purple_time_format(const struct tm *tm)
+{
+	return purple_utf8_strftime("%X", tm);
+}
+
+/* Only the "%Y-%m-%d.%H%M%S%z" form log file names are in */
+time_t
+purple_str_to_time(const char *timestamp, gboolean utc, struct tm *tm,
+                   long *tz_off, const char **rest)
+{
+	struct tm t;
+	int n = 0;
+	time_t stamp;
+
+	memset(&t, 0, sizeof(t));
+	if (tz_off != NULL)
+		*tz_off = PURPLE_NO_TZ_OFF;
+	if (rest != NULL)
+		*rest = NULL;
+
+	if (sscanf(timestamp, "%4d-%2d-%2d.%2d%2d%2d%n", &t.tm_year, &t.tm_mon, &t.tm_mday,
+	           &t.tm_hour, &t.tm_min, &t.tm_sec, &n) < 6)
+		return 0;
+	t.tm_year -= 1900;
+	t.tm_mon -= 1;
+	t.tm_isdst = -1;
+	timestamp += n;
+
+	if ((*timestamp == '+' || *timestamp == '-') && strlen(timestamp) >= 5 &&
+	    g_ascii_isdigit(timestamp[1])) {
+		long off = ((timestamp[1] - '0') * 10 + timestamp[2] - '0') * 3600 +
+		           ((timestamp[3] - '0') * 10 + timestamp[4] - '0') * 60;
+		if (tz_off != NULL)
+			*tz_off = *timestamp == '-' ? -off : off;
+		timestamp += 5;
+	}
+	if (rest != NULL && *timestamp != '\0')
+		*rest = timestamp;
+
+	stamp = utc ? timegm(&t) : mktime(&t);
+	if (tm != NULL)
+		*tm = t;
+	return stamp;
+}
+
+gboolean
+purple_str_has_suffix(const char *s, const char *x)
+{
+	return g_str_has_suffix(s, x);
+}
+
+char *
+purple_util_get_image_filename(gconstpointer image_data, size_t image_len)
+{
+	const guchar *data = image_data;
+	const char *ext = "icon";
+	char *checksum, *filename;
+
+	if (image_len >= 4 && memcmp(data, "\x89PNG", 4) == 0)
+		ext = "png";
+	else if (image_len >= 4 && memcmp(data, "GIF8", 4) == 0)
+		ext = "gif";
+	else if (image_len >= 2 && data[0] == 0xff && data[1] == 0xd8)
+		ext = "jpg";
+	else if (image_len >= 2 && memcmp(data, "BM", 2) == 0)
+		ext = "bmp";
+
+	checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, image_data, image_len);
+	filename = g_strdup_printf("%s.%s", checksum, ext);
+	g_free(checksum);
+	return filename;
+}
+
+gboolean
+purple_markup_find_tag(const char *needle, const char *haystack,
+                       const char **start, const char **end, GData **attributes)
+{
+	gsize needlelen = strlen(needle);
+	const char *cur;
+
+	for (cur = strchr(haystack, '<'); cur != NULL; cur = strchr(cur + 1, '<')) {
+		const char *p = cur + 1 + needlelen;
+		GData *attribs;
+
+		if (g_ascii_strncasecmp(cur + 1, needle, needlelen) != 0 ||
+		    (*p != '>' && *p != '/' && !g_ascii_isspace(*p)))
+			continue;
+
+		g_datalist_init(&attribs);
+		while (*p != '\0' && *p != '>') {
+			const char *name = p, *value;
+			char *key;
+			gsize len;
+
+			if (g_ascii_isspace(*p) || *p == '/') {
+				p++;
+				continue;
+			}
+			while (*p != '\0' && *p != '=' && *p != '>' && !g_ascii_isspace(*p))
+				p++;
+			key = g_ascii_strdown(name, p - name);
+			if (*p != '=') {
+				g_free(key);
+				continue;
+			}
+			p++;
+			if (*p == '"' || *p == '\'') {
+				char quote = *p++;
+				value = p;
+				while (*p != '\0' && *p != quote)
+					p++;
+				len = p - value;
+				if (*p == quote)
+					p++;
+			} else {
+				value = p;
+				while (*p != '\0' && *p != '>' && !g_ascii_isspace(*p))
+					p++;
+				len = p - value;
+			}
+			g_datalist_set_data_full(&attribs, key, g_strndup(value, len), g_free);
+			g_free(key);
+		}
+
+		if (*p != '>') {
+			g_datalist_clear(&attribs);
+			return FALSE;
+		}
+		*start = cur;
+		*end = p;
+		*attributes = attribs;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+const char *
+purple_markup_unescape_entity(const char *text, int *length)
+{
+	static char buf[8];
+	static const struct {
+		const char *name;
+		const char *text;
+	} entities[] = {
+		{ "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&nbsp;", " " },
+		{ "&quot;", "\"" }, { "&apos;", "'" }, { "&copy;", "\xc2\xa9" },
+		{ "&reg;", "\xc2\xae" }
+	};
+	const char *end;
+	gsize i;
+
+	if (text == NULL || *text != '&')
+		return NULL;
+
+	for (i = 0; i < G_N_ELEMENTS(entities); i++) {
+		gsize len = strlen(entities[i].name);
+		if (g_ascii_strncasecmp(text, entities[i].name, len) == 0) {
+			if (length != NULL)
+				*length = len;
+			return entities[i].text;
+		}
+	}
+
+	if (text[1] == '#' && (end = strchr(text, ';')) != NULL) {
+		gunichar c = text[2] == 'x' || text[2] == 'X' ?
+			strtoul(text + 3, NULL, 16) : strtoul(text + 2, NULL, 10);
+		if (c == 0 || !g_unichar_validate(c))
+			return NULL;
+		buf[g_unichar_to_utf8(c, buf)] = '\0';
+		if (length != NULL)
+			*length = end - text + 1;
+		return buf;
+	}
+
+	return NULL;
+}
+
+/* Tags are passed on with their names in lower case and empty elements
+ * closed; stray '<' and '&' are escaped. */
+void
+purple_markup_html_to_xhtml(const char *html, char **dest_xhtml, char **dest_plain)
+{
+	GString *xhtml = g_string_sized_new(strlen(html) + 16);
+	GString *plain = g_string_sized_new(strlen(html));
+	const char *c;
+
+	for (c = html; *c != '\0'; c++) {
+		if (*c == '<') {
+			const char *close = strchr(c, '>');
+			const char *name = c + 1;
+			const char *p;
+
+			if (*name == '/')
+				name++;
+			if (close == NULL || !g_ascii_isalpha(*name)) {
+				g_string_append(xhtml, "&lt;");
+				g_string_append_c(plain, '<');
+				continue;
+			}
+
+			for (p = c; p < close; p++) {
+				if (p >= name && g_ascii_isalpha(*p) && (p == name || g_ascii_isalpha(p[-1])))
+					g_string_append_c(xhtml, g_ascii_tolower(*p));
+				else
+					g_string_append_c(xhtml, *p);
+			}
+			if (close[-1] != '/' &&
+			    (g_ascii_strncasecmp(name, "br", 2) == 0 ||
+			     g_ascii_strncasecmp(name, "img", 3) == 0 ||
+			     g_ascii_strncasecmp(name, "hr", 2) == 0))
+				g_string_append_c(xhtml, '/');
+			g_string_append_c(xhtml, '>');
+			if (g_ascii_strncasecmp(name, "br", 2) == 0)
+				g_string_append_c(plain, '\n');
+			c = close;
+		} else if (*c == '&') {
+			int len;
+			const char *entity = purple_markup_unescape_entity(c, &len);
+
+			if (entity != NULL) {
+				g_string_append_len(xhtml, c, len);
+				g_string_append(plain, entity);
+				c += len - 1;
+			} else {
+				g_string_append(xhtml, "&amp;");
+				g_string_append_c(plain, '&');
+			}
+		} else {
+			g_string_append_c(xhtml, *c);
+			g_string_append_c(plain, *c);
+		}
+	}
+
+	if (dest_xhtml != NULL)
+		*dest_xhtml = g_string_free(xhtml, FALSE);
+	else
+		g_string_free(xhtml, TRUE);
+	if (dest_plain != NULL)
+		*dest_plain = g_string_free(plain, FALSE);
+	else
+		g_string_free(plain, TRUE);
+}
+
+char *
+purple_markup_strip_html(const char *str)
+{
+	char *plain;
+
+	if (str == NULL)
+		return NULL;
+	purple_markup_html_to_xhtml(str, NULL, &plain);
+	return plain;
+}
+
+gboolean
+purple_message_meify(char *message, gssize len)
+{
+	char *c;
+	gboolean inside_html = FALSE;
+
+	g_return_val_if_fail(message != NULL, FALSE);
+
+	if (len == -1)
+		len = strlen(message);
+
+	for (c = message; len > 0; c++, len--) {
+		if (inside_html) {
+			if (*c == '>')
+				inside_html = FALSE;
+		} else if (*c == '<') {
+			inside_html = TRUE;
+		} else {
+			break;
+		}
+	}
+
+	if (len >= 4 && g_ascii_strncasecmp(c, "/me ", 4) == 0) {
+		memmove(c, c + 4, len - 3);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* imgstore.c */
+
+int
+purple_imgstore_add_with_id(gpointer data, size_t size, const char *filename)
+{
+	PurpleStoredImage *img = g_new0(PurpleStoredImage, 1);
+
+	img->id = ++image_id;
+	img->ref = 1;
+	img->data = data;
+	img->size = size;
+	img->filename = g_strdup(filename);
+	g_hash_table_insert(images, GINT_TO_POINTER(img->id), img);
+	return img->id;
+}
+
+PurpleStoredImage *
+purple_imgstore_find_by_id(int id)
+{
+	return g_hash_table_lookup(images, GINT_TO_POINTER(id));
+}
+
+gconstpointer
+purple_imgstore_get_data(PurpleStoredImage *img)
+{
+	return img->data;
+}
+
+size_t
+purple_imgstore_get_size(PurpleStoredImage *img)
+{
+	return img->size;
+}
+
+void
+purple_imgstore_unref_by_id(int id)
+{
+	PurpleStoredImage *img = purple_imgstore_find_by_id(id);
+
+	if (img != NULL && --img->ref == 0)
+		g_hash_table_remove(images, GINT_TO_POINTER(id));
+}
+
+static void
+image_free(gpointer data)
+{
+	PurpleStoredImage *img = data;
+
+	g_free(img->data);
+	g_free(img->filename);
+	g_free(img);
+}
+
+/* value.c */
+
+PurpleValue *
+purple_value_new(PurpleType type, ...)
+{
+	PurpleValue *value = g_new0(PurpleValue, 1);
+	value->type = type;
+	return value;
+}
+
+/* prefs.c */
+
+static void
+pref_free(gpointer data)
+{
+	StubPref *pref = data;
+
+	g_free(pref->string);
+	g_list_free_full(pref->list, g_free);
+	g_free(pref);
+}
+
+static StubPref *
+pref_add(const char *name, PurplePrefType type)
+{
+	StubPref *pref = g_hash_table_lookup(prefs, name);
+
+	if (pref != NULL)
+		return NULL;
+	pref = g_new0(StubPref, 1);
+	pref->type = type;
+	g_hash_table_insert(prefs, g_strdup(name), pref);
+	return pref;
+}
+
+static StubPref *
+pref_get(const char *name, PurplePrefType type)
+{
+	StubPref *pref = g_hash_table_lookup(prefs, name);
+
+	if (pref == NULL || pref->type != type) {
+		purple_debug_error("prefs", "%s is not a pref of type %d\n", name, type);
+		return NULL;
+	}
+	return pref;
+}
+
+static void
+pref_changed(const char *name, StubPref *pref)
+{
+	gconstpointer val;
+	GList *l;
+
+	switch (pref->type) {
+	case PURPLE_PREF_BOOLEAN:
+	case PURPLE_PREF_INT:
+		val = GINT_TO_POINTER(pref->value);
+		break;
+	case PURPLE_PREF_STRING:
+		val = pref->string;
+		break;
+	default:
+		val = pref->list;
+		break;
+	}
+
+	for (l = pref_callbacks; l != NULL; l = l->next) {
+		StubPrefCallback *cb = l->data;
+		if (strcmp(cb->name, name) == 0)
+			cb->cb(name, pref->type, val, cb->data);
+	}
+}
+
+void
+purple_prefs_add_none(const char *name)
+{
+	pref_add(name, PURPLE_PREF_NONE);
+}
+
+void
+purple_prefs_add_bool(const char *name, gboolean value)
+{
+	StubPref *pref = pref_add(name, PURPLE_PREF_BOOLEAN);
+	if (pref != NULL)
+		pref->value = value;
+}
+
+void
+purple_prefs_add_int(const char *name, int value)
+{
+	StubPref *pref = pref_add(name, PURPLE_PREF_INT);
+	if (pref != NULL)
+		pref->value = value;
+}
+
+void
+purple_prefs_add_string(const char *name, const char *value)
+{
+	StubPref *pref = pref_add(name, PURPLE_PREF_STRING);
+	if (pref != NULL)
+		pref->string = g_strdup(value);
+}
+
+void
+purple_prefs_add_string_list(const char *name, GList *value)
+{
+	StubPref *pref = pref_add(name, PURPLE_PREF_STRING_LIST);
+	for (; pref != NULL && value != NULL; value = value->next)
+		pref->list = g_list_append(pref->list, g_strdup(value->data));
+}
+
+void
+purple_prefs_set_bool(const char *name, gboolean value)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_BOOLEAN);
+
+	if (pref != NULL && pref->value != value) {
+		pref->value = value;
+		pref_changed(name, pref);
+	}
+}
+
+void
+purple_prefs_set_int(const char *name, int value)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_INT);
+
+	if (pref != NULL && pref->value != value) {
+		pref->value = value;
+		pref_changed(name, pref);
+	}
+}
+
+void
+purple_prefs_set_string(const char *name, const char *value)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_STRING);
+
+	if (pref != NULL && g_strcmp0(pref->string, value) != 0) {
+		g_free(pref->string);
+		pref->string = g_strdup(value);
+		pref_changed(name, pref);
+	}
+}
+
+void
+purple_prefs_set_string_list(const char *name, GList *value)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_STRING_LIST);
+
+	if (pref != NULL) {
+		g_list_free_full(pref->list, g_free);
+		pref->list = NULL;
+		for (; value != NULL; value = value->next)
+			pref->list = g_list_append(pref->list, g_strdup(value->data));
+		pref_changed(name, pref);
+	}
+}
+
+PurplePrefType
+purple_prefs_get_type(const char *name)
+{
+	StubPref *pref = g_hash_table_lookup(prefs, name);
+	return pref != NULL ? pref->type : PURPLE_PREF_NONE;
+}
+
+gboolean
+purple_prefs_get_bool(const char *name)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_BOOLEAN);
+	return pref != NULL ? pref->value : FALSE;
+}
+
+int
+purple_prefs_get_int(const char *name)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_INT);
+	return pref != NULL ? pref->value : 0;
+}
+
+const char *
+purple_prefs_get_string(const char *name)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_STRING);
+	return pref != NULL ? pref->string : NULL;
+}
+
+GList *
+purple_prefs_get_string_list(const char *name)
+{
+	StubPref *pref = pref_get(name, PURPLE_PREF_STRING_LIST);
+	GList *list = NULL, *l;
+
+	for (l = pref != NULL ? pref->list : NULL; l != NULL; l = l->next)
+		list = g_list_append(list, g_strdup(l->data));
+	return list;
+}
+
+guint
+purple_prefs_connect_callback(void *handle, const char *name,
+                              PurplePrefCallback cb, gpointer data)
+{
+	StubPrefCallback *callback = g_new0(StubPrefCallback, 1);
+
+	callback->id = ++pref_callback_id;
+	callback->handle = handle;
+	callback->name = g_strdup(name);
+	callback->cb = cb;
+	callback->data = data;
+	pref_callbacks = g_list_append(pref_callbacks, callback);
+	return callback->id;
+}
+
+static void
+pref_callback_free(gpointer data)
+{
+	StubPrefCallback *callback = data;
+
+	g_free(callback->name);
+	g_free(callback);
+}
+
+void
+purple_prefs_disconnect_by_handle(void *handle)
+{
+	GList *l = pref_callbacks;
+
+	while (l != NULL) {
+		GList *next = l->next;
+		StubPrefCallback *callback = l->data;
+
+		if (callback->handle == handle) {
+			pref_callback_free(callback);
+			pref_callbacks = g_list_delete_link(pref_callbacks, l);
+		}
+		l = next;
+	}
+}
+
+/* signals.c: nothing is emitted, so handlers are only counted */
+
+gulong
+purple_signal_connect(void *instance, const char *signal, void *handle,
+                      PurpleCallback func, void *data)
+{
+	return ++signal_id;
+}
+
+void *
+purple_signal_emit_return_1(void *instance, const char *signal, ...)
+{
+	return NULL;
+}
+
+void
+purple_marshal_VOID__POINTER(PurpleCallback cb, va_list args,
+                             void *data, void **return_val)
+{
+	void *arg1 = va_arg(args, void *);
+
+	((void (*)(void *, void *))cb)(arg1, data);
+}
+
+void
+purple_marshal_POINTER__POINTER(PurpleCallback cb, va_list args,
+                                void *data, void **return_val)
+{
+	void *arg1 = va_arg(args, void *);
+	gpointer ret = ((gpointer (*)(void *, void *))cb)(arg1, data);
+
+	if (return_val != NULL)
+		*return_val = ret;
+}
+
+void
+purple_marshal_POINTER__POINTER_INT(PurpleCallback cb, va_list args,
+                                    void *data, void **return_val)
+{
+	void *arg1 = va_arg(args, void *);
+	gint arg2 = va_arg(args, gint);
+	gpointer ret = ((gpointer (*)(void *, gint, void *))cb)(arg1, arg2, data);
+
+	if (return_val != NULL)
+		*return_val = ret;
+}
+
+void
+purple_marshal_POINTER__POINTER_POINTER(PurpleCallback cb, va_list args,
+                                        void *data, void **return_val)
+{
+	void *arg1 = va_arg(args, void *);
+	void *arg2 = va_arg(args, void *);
+	gpointer ret = ((gpointer (*)(void *, void *, void *))cb)(arg1, arg2, data);
+
+	if (return_val != NULL)
+		*return_val = ret;
+}
+
+/* account.c */
+
+const char *
+purple_account_get_username(const PurpleAccount *account)
+{
+	return account->username;
+}
+
+const char *
+purple_account_get_protocol_id(const PurpleAccount *account)
+{
+	return account->protocol_id;
+}
+
+PurpleConnection *
+purple_account_get_connection(const PurpleAccount *account)
+{
+	return account->gc;
+}
+
+PurpleAccount *
+purple_accounts_find(const char *name, const char *protocol)
+{
+	GList *l;
+
+	for (l = accounts; l != NULL; l = l->next) {
+		PurpleAccount *account = l->data;
+		if (strcmp(account->username, name) == 0 &&
+		    (protocol == NULL || strcmp(account->protocol_id, protocol) == 0))
+			return account;
+	}
+	return NULL;
+}
+
+GList *
+purple_accounts_get_all_active(void)
+{
+	return g_list_copy(accounts);
+}
+
+PurpleAccount *
+stub_account_new(const char *username, const char *protocol_id)
+{
+	PurpleAccount *account = g_new0(PurpleAccount, 1);
+
+	account->username = g_strdup(username);
+	account->protocol_id = g_strdup(protocol_id);
+	account->gc = g_new0(PurpleConnection, 1);
+	account->gc->account = account;
+	accounts = g_list_append(accounts, account);
+	return account;
+}
+
+static void
+account_free(gpointer data)
+{
+	PurpleAccount *account = data;
+
+	g_free(account->username);
+	g_free(account->protocol_id);
+	g_free(account->gc);
+	g_free(account);
+}
+
+/* prpl.c: every protocol uses the part of its id after "prpl-" as its icon */
+
+static const char *
+stub_list_icon(PurpleAccount *account, PurpleBuddy *buddy)
+{
+	const char *id = purple_account_get_protocol_id(account);
+	return g_str_has_prefix(id, "prpl-") ? id + 5 : id;
+}
+
+static void
+prpl_free(gpointer data)
+{
+	PurplePlugin *plugin = data;
+
+	g_free(plugin->info->extra_info);
+	g_free(plugin->info);
+	g_free(plugin);
+}
+
+PurplePlugin *
+purple_find_prpl(const char *id)
+{
+	PurplePlugin *plugin = g_hash_table_lookup(prpls, id);
+
+	if (plugin == NULL) {
+		PurplePluginProtocolInfo *prpl_info = g_new0(PurplePluginProtocolInfo, 1);
+
+		prpl_info->list_icon = stub_list_icon;
+		plugin = g_new0(PurplePlugin, 1);
+		plugin->info = g_new0(PurplePluginInfo, 1);
+		plugin->info->type = PURPLE_PLUGIN_PROTOCOL;
+		plugin->info->extra_info = prpl_info;
+		g_hash_table_insert(prpls, g_strdup(id), plugin);
+	}
+	return plugin;
+}
+
+/* Widgets are GObjects that can only emit the signals the plugins use, and
+ * keep what is set on them as object data */
+
+static GType
+stub_widget_get_type(void)
+{
+	static const char *plain[] = {
+		"style-updated", "destroy", "changed", "toggled", "value-changed"
+	};
+	static GType type = 0;
+	gsize i;
+
+	if (type == 0) {
+		type = g_type_register_static_simple(G_TYPE_OBJECT, "StubWidget",
+		                                     sizeof(GObjectClass), NULL,
+		                                     sizeof(GtkWidget), NULL, 0);
+		for (i = 0; i < G_N_ELEMENTS(plain); i++)
+			g_signal_new(plain[i], type, G_SIGNAL_RUN_FIRST, 0, NULL, NULL,
+			             NULL, G_TYPE_NONE, 0);
+		g_signal_new("focus-in-event", type, G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+		             NULL, G_TYPE_BOOLEAN, 1, G_TYPE_POINTER);
+		g_signal_new("focus-out-event", type, G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+		             NULL, G_TYPE_BOOLEAN, 1, G_TYPE_POINTER);
+		g_signal_new("activate-source", type, G_SIGNAL_RUN_FIRST, 0, NULL, NULL,
+		             NULL, G_TYPE_NONE, 1, G_TYPE_STRING);
+		g_signal_new("status-changed", type, G_SIGNAL_RUN_FIRST, 0, NULL, NULL,
+		             NULL, G_TYPE_NONE, 1, G_TYPE_INT);
+	}
+	return type;
+}
+
+static GtkWidget *
+stub_widget_new(void)
+{
+	return g_object_new(stub_widget_get_type(), NULL);
+}
+
+/* Children are kept until their parent goes */
+static void
+stub_widget_adopt(GtkWidget *parent, GtkWidget *child)
+{
+	char key[32];
+
+	g_snprintf(key, sizeof(key), "child-%p", (void *)child);
+	g_object_set_data_full(G_OBJECT(parent), key, child, g_object_unref);
+}
+
+GdkWindow *
+gtk_widget_get_window(GtkWidget *widget)
+{
+	return (GdkWindow *)widget;
+}
+
+void
+gtk_widget_set_size_request(GtkWidget *widget, gint width, gint height)
+{
+}
+
+void
+gtk_widget_show_all(GtkWidget *widget)
+{
+}
+
+void
+gdk_window_focus(GdkWindow *window, guint32 timestamp)
+{
+}
+
+GtkWidget *
+gtk_box_new(GtkOrientation orientation, gint spacing)
+{
+	return stub_widget_new();
+}
+
+void
+gtk_box_pack_start(GtkBox *box, GtkWidget *child, gboolean expand,
+                   gboolean fill, guint padding)
+{
+	stub_widget_adopt(box, child);
+}
+
+void
+gtk_container_add(GtkContainer *container, GtkWidget *widget)
+{
+	stub_widget_adopt(container, widget);
+}
+
+void
+gtk_container_set_border_width(GtkContainer *container, guint border_width)
+{
+}
+
+GtkWidget *
+gtk_label_new_with_mnemonic(const gchar *str)
+{
+	return stub_widget_new();
+}
+
+void
+gtk_label_set_mnemonic_widget(GtkLabel *label, GtkWidget *widget)
+{
+}
+
+void
+gtk_misc_set_alignment(GtkMisc *misc, gfloat xalign, gfloat yalign)
+{
+}
+
+GtkWidget *
+gtk_check_button_new_with_mnemonic(const gchar *label)
+{
+	return stub_widget_new();
+}
+
+GtkWidget *
+gtk_radio_button_new_with_mnemonic(GSList *group, const gchar *label)
+{
+	return stub_widget_new();
+}
+
+GtkWidget *
+gtk_radio_button_new_with_mnemonic_from_widget(GtkRadioButton *radio_group_member,
+                                               const gchar *label)
+{
+	return stub_widget_new();
+}
+
+gboolean
+gtk_toggle_button_get_active(GtkToggleButton *toggle_button)
+{
+	return GPOINTER_TO_INT(g_object_get_data(G_OBJECT(toggle_button), "active"));
+}
+
+void
+gtk_toggle_button_set_active(GtkToggleButton *toggle_button, gboolean is_active)
+{
+	g_object_set_data(G_OBJECT(toggle_button), "active", GINT_TO_POINTER(is_active));
+	g_signal_emit_by_name(toggle_button, "toggled");
+}
+
+GtkWidget *
+gtk_spin_button_new_with_range(gdouble min, gdouble max, gdouble step)
+{
+	return stub_widget_new();
+}
+
+void
+gtk_spin_button_set_value(GtkSpinButton *spin_button, gdouble value)
+{
+	g_object_set_data(G_OBJECT(spin_button), "value", GINT_TO_POINTER((gint)value));
+	g_signal_emit_by_name(spin_button, "value-changed");
+}
+
+gint
+gtk_spin_button_get_value_as_int(GtkSpinButton *spin_button)
+{
+	return GPOINTER_TO_INT(g_object_get_data(G_OBJECT(spin_button), "value"));
+}
+
+GtkWidget *
+gtk_scrolled_window_new(GtkAdjustment *hadjustment, GtkAdjustment *vadjustment)
+{
+	return stub_widget_new();
+}
+
+void
+gtk_scrolled_window_set_policy(GtkScrolledWindow *scrolled_window,
+                               GtkPolicyType hscrollbar_policy,
+                               GtkPolicyType vscrollbar_policy)
+{
+}
+
+void
+gtk_scrolled_window_set_shadow_type(GtkScrolledWindow *scrolled_window, GtkShadowType type)
+{
+}
+
+static void
+text_free(gpointer data)
+{
+	g_string_free(data, TRUE);
+}
+
+GtkWidget *
+gtk_text_view_new(void)
+{
+	GtkWidget *view = stub_widget_new();
+	GtkTextBuffer *buffer = stub_widget_new();
+
+	g_object_set_data_full(G_OBJECT(buffer), "text", g_string_new(NULL), text_free);
+	g_object_set_data_full(G_OBJECT(view), "buffer", buffer, g_object_unref);
+	return view;
+}
+
+GtkTextBuffer *
+gtk_text_view_get_buffer(GtkTextView *text_view)
+{
+	return g_object_get_data(G_OBJECT(text_view), "buffer");
+}
+
+void
+gtk_text_buffer_get_bounds(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end)
+{
+	memset(start, 0, sizeof(*start));
+	memset(end, 0, sizeof(*end));
+}
+
+gchar *
+gtk_text_buffer_get_text(GtkTextBuffer *buffer, const GtkTextIter *start,
+                         const GtkTextIter *end, gboolean include_hidden_chars)
+{
+	GString *text = g_object_get_data(G_OBJECT(buffer), "text");
+	return g_strdup(text->str);
+}
+
+void
+gtk_text_buffer_insert_at_cursor(GtkTextBuffer *buffer, const gchar *text, gint len)
+{
+	g_string_append_len(g_object_get_data(G_OBJECT(buffer), "text"), text, len);
+	g_signal_emit_by_name(buffer, "changed");
+}
+
+GtkWidget *
+pidgin_make_frame(GtkWidget *parent, const char *title)
+{
+	GtkWidget *frame = stub_widget_new();
+
+	stub_widget_adopt(parent, frame);
+	return frame;
+}
+
+/* Colors of a light theme */
+GtkStyle *
+gtk_widget_get_style(GtkWidget *widget)
+{
+	static GtkStyle style;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		style.base[i].red = style.base[i].green = style.base[i].blue = 0xffff;
+		style.text[i].red = style.text[i].green = style.text[i].blue = 0;
+	}
+	style.white.red = style.white.green = style.white.blue = 0xffff;
+	return &style;
+}
+
+/* Unity and the messaging menu: only the launcher count and the menu's
+ * sources are kept */
+
+UnityLauncherEntry *
+unity_launcher_entry_get_for_desktop_id(const gchar *desktop_id)
+{
+	if (launcher == NULL)
+		launcher = g_object_new(stub_widget_get_type(), NULL);
+	return launcher;
+}
+
+void
+unity_launcher_entry_set_count(UnityLauncherEntry *self, gint64 value)
+{
+	remote_calls++;
+}
+
+void
+unity_launcher_entry_set_count_visible(UnityLauncherEntry *self, gboolean value)
+{
+	remote_calls++;
+}
+
+MessagingMenuApp *
+messaging_menu_app_new(const gchar *desktop_id)
+{
+	return g_object_new(stub_widget_get_type(), NULL);
+}
+
+void
+messaging_menu_app_register(MessagingMenuApp *app)
+{
+	remote_calls++;
+}
+
+void
+messaging_menu_app_unregister(MessagingMenuApp *app)
+{
+	remote_calls++;
+	g_hash_table_remove_all(menu_sources);
+}
+
+void
+messaging_menu_app_set_status(MessagingMenuApp *app, MessagingMenuStatus status)
+{
+	remote_calls++;
+}
+
+gboolean
+messaging_menu_app_has_source(MessagingMenuApp *app, const gchar *source_id)
+{
+	return g_hash_table_contains(menu_sources, source_id);
+}
+
+void
+messaging_menu_app_append_source(MessagingMenuApp *app, const gchar *id,
+                                 GIcon *icon, const gchar *label)
+{
+	remote_calls++;
+	g_hash_table_add(menu_sources, g_strdup(id));
+}
+
+void
+messaging_menu_app_remove_source(MessagingMenuApp *app, const gchar *source_id)
+{
+	remote_calls++;
+	g_hash_table_remove(menu_sources, source_id);
+}
+
+void
+messaging_menu_app_set_source_count(MessagingMenuApp *app, const gchar *source_id,
+                                    guint count)
+{
+	remote_calls++;
+}
+
+void
+messaging_menu_app_set_source_time(MessagingMenuApp *app, const gchar *source_id,
+                                   gint64 time)
+{
+	remote_calls++;
+}
+
+void
+messaging_menu_app_draw_attention(MessagingMenuApp *app, const gchar *source_id)
+{
+	remote_calls++;
+}
+
+guint
+stub_remote_calls(void)
+{
+	return remote_calls;
+}
+
+/* savedstatuses.c: statuses are only kept, never applied to accounts */
+
+struct _PurpleSavedStatus {
+	PurpleStatusPrimitive type;
+};
+
+void *
+purple_savedstatuses_get_handle(void)
+{
+	static int handle;
+	return &handle;
+}
+
+PurpleSavedStatus *
+purple_savedstatus_new(const char *title, PurpleStatusPrimitive type)
+{
+	PurpleSavedStatus *status = g_new0(PurpleSavedStatus, 1);
+
+	status->type = type;
+	saved_statuses = g_list_append(saved_statuses, status);
+	return status;
+}
+
+void
+purple_savedstatus_set_substatus(PurpleSavedStatus *status, const PurpleAccount *account,
+                                 const PurpleStatusType *type, const char *message)
+{
+}
+
+PurpleStatusPrimitive
+purple_savedstatus_get_type(const PurpleSavedStatus *saved_status)
+{
+	return saved_status->type;
+}
+
+PurpleSavedStatus *
+purple_savedstatus_find_transient_by_type_and_message(PurpleStatusPrimitive type,
+                                                      const char *message)
+{
+	GList *l;
+
+	for (l = saved_statuses; l != NULL; l = l->next) {
+		PurpleSavedStatus *status = l->data;
+		if (status->type == type)
+			return status;
+	}
+	return NULL;
+}
+
+void
+purple_savedstatus_activate(PurpleSavedStatus *saved_status)
+{
+	current_status = saved_status;
+}
+
+PurpleSavedStatus *
+purple_savedstatus_get_current(void)
+{
+	if (current_status == NULL)
+		current_status = purple_savedstatus_new(NULL, PURPLE_STATUS_AVAILABLE);
+	return current_status;
+}
+
+/* conversation.c */
+
+void *
+purple_conversations_get_handle(void)
+{
+	static int handle;
+	return &handle;
+}
+
+GList *
+purple_get_conversations(void)
+{
+	return conversations;
+}
+
+PurpleConversation *
+purple_find_conversation_with_account(PurpleConversationType type, const char *name,
+                                      const PurpleAccount *account)
+{
+	GList *l;
+
+	for (l = conversations; l != NULL; l = l->next) {
+		PurpleConversation *conv = l->data;
+		if ((type == PURPLE_CONV_TYPE_ANY || conv->type == type) &&
+		    conv->account == account && strcmp(conv->name, name) == 0)
+			return conv;
+	}
+	return NULL;
+}
+
+PurpleConversation *
+purple_find_chat(const PurpleConnection *gc, int id)
+{
+	GList *l;
+
+	for (l = conversations; l != NULL; l = l->next) {
+		PurpleConversation *conv = l->data;
+		if (conv->chat != NULL && conv->chat->id == id && conv->account->gc == gc)
+			return conv;
+	}
+	return NULL;
+}
+
+PurpleConvChat *
+purple_conversation_get_chat_data(const PurpleConversation *conv)
+{
+	return conv->chat;
+}
+
+int
+purple_conv_chat_get_id(const PurpleConvChat *chat)
+{
+	return chat->id;
+}
+
+PurpleConversationType
+purple_conversation_get_type(const PurpleConversation *conv)
+{
+	return conv->type;
+}
+
+PurpleAccount *
+purple_conversation_get_account(const PurpleConversation *conv)
+{
+	return conv->account;
+}
+
+const char *
+purple_conversation_get_name(const PurpleConversation *conv)
+{
+	return conv->name;
+}
+
+const char *
+purple_conversation_get_title(const PurpleConversation *conv)
+{
+	return conv->name;
+}
+
+gpointer
+purple_conversation_get_ui_data(const PurpleConversation *conv)
+{
+	return conv->ui_data;
+}
+
+void
+purple_conversation_set_data(PurpleConversation *conv, const char *key, gpointer data)
+{
+	g_hash_table_replace(conv->data, g_strdup(key), data);
+}
+
+gpointer
+purple_conversation_get_data(PurpleConversation *conv, const char *key)
+{
+	return g_hash_table_lookup(conv->data, key);
+}
+
+/* Logs are made by the caller, not kept by the conversation */
+void
+purple_conversation_close_logs(PurpleConversation *conv)
+{
+}
+
+/* gtkconv.c */
+
+void *
+pidgin_conversations_get_handle(void)
+{
+	static int handle;
+	return &handle;
+}
+
+gboolean
+pidgin_conv_window_has_focus(PidginWindow *win)
+{
+	return focused != NULL;
+}
+
+gboolean
+pidgin_conv_window_is_active_conversation(const PurpleConversation *conv)
+{
+	return conv == focused;
+}
+
+void
+pidgin_conv_window_switch_gtkconv(PidginWindow *win, PidginConversation *gtkconv)
+{
+	stub_conversation_focus(gtkconv->active_conv);
+}
+
+/* Each conversation has an entry, a webview and Pidgin's default nick
+ * colors, and is a tab of the one window */
+PurpleConversation *
+stub_conversation_new(PurpleConversationType type, PurpleAccount *account,
+                      const char *name)
+{
+	static const guint16 nick_colors[][3] = {
+		{ 47616, 46336, 43776 }, { 47871, 0, 19455 }, { 64000, 35328, 0 },
+		{ 22016, 46336, 34560 }, { 9728, 35840, 51200 }, { 40192, 6912, 52992 },
+		{ 26112, 44544, 29440 }, { 24576, 22784, 19456 }, { 45312, 14336, 57856 },
+		{ 0, 29696, 59904 }, { 49152, 6144, 13312 }, { 15872, 45056, 31744 }
+	};
+	PurpleConversation *conv = g_new0(PurpleConversation, 1);
+	PidginConversation *gtkconv = g_new0(PidginConversation, 1);
+	gsize i;
+
+	conv->type = type;
+	conv->account = account;
+	conv->name = g_strdup(name);
+	conv->data = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	conv->ui_data = gtkconv;
+	if (type == PURPLE_CONV_TYPE_CHAT) {
+		conv->chat = g_new0(PurpleConvChat, 1);
+		conv->chat->conv = conv;
+		conv->chat->id = ++chat_id;
+	}
+
+	if (window.window == NULL)
+		window.window = stub_widget_new();
+	gtkconv->active_conv = conv;
+	gtkconv->win = &window;
+	gtkconv->entry = stub_widget_new();
+	gtkconv->webview = stub_widget_new();
+	gtkconv->nick_colors = g_array_new(FALSE, FALSE, sizeof(GdkColor));
+	for (i = 0; i < G_N_ELEMENTS(nick_colors); i++) {
+		GdkColor color = { 0, 0, 0, 0 };
+		color.red = nick_colors[i][0];
+		color.green = nick_colors[i][1];
+		color.blue = nick_colors[i][2];
+		g_array_append_val(gtkconv->nick_colors, color);
+	}
+
+	conversations = g_list_append(conversations, conv);
+	return conv;
+}
+
+void
+stub_conversation_destroy(PurpleConversation *conv)
+{
+	PidginConversation *gtkconv = conv->ui_data;
+
+	conversations = g_list_remove(conversations, conv);
+	if (focused == conv)
+		focused = NULL;
+	g_object_unref(gtkconv->entry);
+	g_object_unref(gtkconv->webview);
+	g_array_free(gtkconv->nick_colors, TRUE);
+	g_free(gtkconv);
+	g_hash_table_destroy(conv->data);
+	g_free(conv->chat);
+	g_free(conv->name);
+	g_free(conv);
+}
+
+void
+stub_conversation_focus(PurpleConversation *conv)
+{
+	gboolean handled;
+
+	focused = conv;
+	g_signal_emit_by_name(window.window, conv != NULL ? "focus-in-event" : "focus-out-event",
+	                      NULL, &handled);
+	if (conv != NULL)
+		g_signal_emit_by_name(conv->ui_data->webview, "focus-in-event", NULL, &handled);
+}
+
+/* log.c */
+
+void *
+purple_log_get_handle(void)
+{
+	return &log_handle;
+}
+
+static PurpleLogLogger *
+log_logger_get(void)
+{
+	const char *id = purple_prefs_get_string("/purple/logging/format");
+	GList *l;
+
+	for (l = loggers; l != NULL; l = l->next) {
+		PurpleLogLogger *logger = l->data;
+		if (g_strcmp0(logger->id, id) == 0)
+			return logger;
+	}
+	return NULL;
+}
+
+PurpleLog *
+purple_log_new(PurpleLogType type, const char *name, PurpleAccount *account,
+               PurpleConversation *conv, time_t time, const struct tm *tm)
+{
+	PurpleLog *log = g_slice_new(PurpleLog);
+
+	log->type = type;
+	log->name = g_strdup(name);
+	log->account = account;
+	log->conv = conv;
+	log->time = time;
+	log->logger = log_logger_get();
+	log->logger_data = NULL;
+	if (tm == NULL) {
+		log->tm = NULL;
+	} else {
+		log->tm = g_slice_new(struct tm);
+		*log->tm = *tm;
+	}
+
+	if (log->logger != NULL && log->logger->create != NULL)
+		log->logger->create(log);
+	return log;
+}
+
+void
+purple_log_free(PurpleLog *log)
+{
+	if (log->logger != NULL && log->logger->finalize != NULL)
+		log->logger->finalize(log);
+	g_free(log->name);
+	if (log->tm != NULL)
+		g_slice_free(struct tm, log->tm);
+	g_slice_free(PurpleLog, log);
+}
+
+char *
+purple_log_get_log_dir(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	PurplePlugin *prpl = purple_find_prpl(purple_account_get_protocol_id(account));
+	const char *prpl_name = PURPLE_PLUGIN_PROTOCOL_INFO(prpl)->list_icon(account, NULL);
+	char *acct_name = g_strdup(purple_escape_filename(purple_account_get_username(account)));
+	char *target, *dir;
+
+	if (type == PURPLE_LOG_CHAT) {
+		char *temp = g_strdup_printf("%s.chat", name);
+		target = g_strdup(purple_escape_filename(temp));
+		g_free(temp);
+	} else if (type == PURPLE_LOG_SYSTEM) {
+		target = g_strdup(".system");
+	} else {
+		target = g_strdup(purple_escape_filename(name));
+	}
+
+	dir = g_build_filename(purple_user_dir(), "logs", prpl_name, acct_name, target, NULL);
+	g_free(acct_name);
+	g_free(target);
+	return dir;
+}
+
+PurpleLogLogger *
+purple_log_logger_new(const char *id, const char *name, int functions, ...)
+{
+	PurpleLogLogger *logger = g_new0(PurpleLogLogger, 1);
+	va_list args;
+
+	logger->id = g_strdup(id);
+	logger->name = g_strdup(name);
+
+	va_start(args, functions);
+	if (functions >= 1)
+		logger->create = va_arg(args, void *);
+	if (functions >= 2)
+		logger->write = va_arg(args, void *);
+	if (functions >= 3)
+		logger->finalize = va_arg(args, void *);
+	if (functions >= 4)
+		logger->list = va_arg(args, void *);
+	if (functions >= 5)
+		logger->read = va_arg(args, void *);
+	if (functions >= 6)
+		logger->size = va_arg(args, void *);
+	if (functions >= 7)
+		logger->total_size = va_arg(args, void *);
+	if (functions >= 8)
+		logger->list_syslog = va_arg(args, void *);
+	if (functions >= 9)
+		logger->get_log_sets = va_arg(args, void *);
+	if (functions >= 10)
+		logger->remove = va_arg(args, void *);
+	if (functions >= 11)
+		logger->is_deletable = va_arg(args, void *);
+	va_end(args);
+
+	return logger;
+}
+
+void
+purple_log_logger_free(PurpleLogLogger *logger)
+{
+	g_free(logger->name);
+	g_free(logger->id);
+	g_free(logger);
+}
+
+void
+purple_log_logger_add(PurpleLogLogger *logger)
+{
+	if (g_list_find(loggers, logger) == NULL)
+		loggers = g_list_append(loggers, logger);
+}
+
+void
+purple_log_logger_remove(PurpleLogLogger *logger)
+{
+	loggers = g_list_remove(loggers, logger);
+}
+
+void
+purple_log_common_writer(PurpleLog *log, const char *ext)
+{
+	PurpleLogCommonLoggerData *data;
+	struct tm *tm;
+	char *dir, *tz, *filename, *path;
+
+	if (log->logger_data != NULL)
+		return;
+
+	dir = purple_log_get_log_dir(log->type, log->name, log->account);
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	tm = localtime(&log->time);
+	tz = g_strdup(purple_escape_filename(purple_utf8_strftime("%Z", tm)));
+	filename = g_strdup_printf("%s%s%s", purple_utf8_strftime("%Y-%m-%d.%H%M%S%z", tm),
+	                           tz, ext ? ext : "");
+	path = g_build_filename(dir, filename, NULL);
+	g_free(dir);
+	g_free(tz);
+	g_free(filename);
+
+	log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->file = g_fopen(path, "a");
+	if (data->file == NULL) {
+		purple_debug_error("log", "Could not create log file %s\n", path);
+		g_free(path);
+		return;
+	}
+	data->path = path;
+}
+
+int
+purple_log_common_sizer(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	GStatBuf st;
+
+	if (data == NULL || data->path == NULL || g_stat(data->path, &st) != 0)
+		return 0;
+	return st.st_size;
+}
+
+gboolean
+purple_log_common_deleter(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+
+	if (data == NULL || data->path == NULL)
+		return FALSE;
+	return g_unlink(data->path) == 0;
+}
+
+gboolean
+purple_log_common_is_deletable(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	return data != NULL && data->path != NULL;
+}
+
+/* plugin.c and pluginpref.c: nothing here is shown */
+
+struct _PurplePluginPrefFrame {
+	GList *prefs;
+};
+
+struct _PurplePluginPref {
+	char *name;
+	char *label;
+	int min;
+	int max;
+};
+
+PurplePluginAction *
+purple_plugin_action_new(const char *label, void (*callback)(PurplePluginAction *))
+{
+	PurplePluginAction *action = g_new0(PurplePluginAction, 1);
+
+	action->label = g_strdup(label);
+	action->callback = callback;
+	return action;
+}
+
+gboolean
+purple_plugin_ipc_register(PurplePlugin *plugin, const char *command,
+                           PurpleCallback func, PurpleSignalMarshalFunc marshal,
+                           PurpleValue *ret_value, int num_params, ...)
+{
+	va_list args;
+	int i;
+
+	va_start(args, num_params);
+	for (i = 0; i < num_params; i++)
+		g_free(va_arg(args, PurpleValue *));
+	va_end(args);
+	g_free(ret_value);
+	return TRUE;
+}
+
+void
+purple_plugin_ipc_unregister_all(PurplePlugin *plugin)
+{
+}
+
+PurplePluginPrefFrame *
+purple_plugin_pref_frame_new(void)
+{
+	return g_new0(PurplePluginPrefFrame, 1);
+}
+
+void
+purple_plugin_pref_frame_add(PurplePluginPrefFrame *frame, PurplePluginPref *pref)
+{
+	frame->prefs = g_list_append(frame->prefs, pref);
+}
+
+PurplePluginPref *
+purple_plugin_pref_new_with_label(const char *label)
+{
+	return purple_plugin_pref_new_with_name_and_label(NULL, label);
+}
+
+PurplePluginPref *
+purple_plugin_pref_new_with_name_and_label(const char *name, const char *label)
+{
+	PurplePluginPref *pref = g_new0(PurplePluginPref, 1);
+
+	pref->name = g_strdup(name);
+	pref->label = g_strdup(label);
+	return pref;
+}
+
+void
+purple_plugin_pref_set_bounds(PurplePluginPref *pref, int min, int max)
+{
+	pref->min = min;
+	pref->max = max;
+}
+
+/* notify.c: messages go to stdout, as there is no one to show them to */
+
+void *
+purple_notify_message(void *handle, PurpleNotifyMsgType type,
+                      const char *title, const char *primary,
+                      const char *secondary, PurpleNotifyCloseCallback cb,
+                      gpointer user_data)
+{
+	printf("%s: %s\n", title, primary);
+	if (secondary != NULL)
+		printf("%s\n", secondary);
+	if (cb != NULL)
+		cb(user_data);
+	return NULL;
+}
+
+void *
+purple_notify_formatted(void *handle, const char *title, const char *primary,
+                        const char *secondary, const char *text,
+                        PurpleNotifyCloseCallback cb, gpointer user_data)
+{
+	char *plain = purple_markup_strip_html(text);
+
+	printf("%s: %s\n%s\n", title, primary, plain);
+	g_free(plain);
+	if (cb != NULL)
+		cb(user_data);
+	return NULL;
+}
+
+/* request.c: requests are cancelled right away */
+
+struct _PurpleRequestFields {
+	GList *groups;
+	GHashTable *values;    /* id -> int */
+};
+
+struct _PurpleRequestFieldGroup {
+	PurpleRequestFields *fields;
+	GList *pending;        /* added before the group was */
+};
+
+struct _PurpleRequestField {
+	char *id;
+	int value;
+};
+
+PurpleRequestFields *
+purple_request_fields_new(void)
+{
+	PurpleRequestFields *fields = g_new0(PurpleRequestFields, 1);
+
+	fields->values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	return fields;
+}
+
+static void
+request_fields_add(PurpleRequestFields *fields, PurpleRequestField *field)
+{
+	g_hash_table_replace(fields->values, field->id, GINT_TO_POINTER(field->value));
+	g_free(field);
+}
+
+void
+purple_request_fields_add_group(PurpleRequestFields *fields, PurpleRequestFieldGroup *group)
+{
+	group->fields = fields;
+	fields->groups = g_list_append(fields->groups, group);
+	while (group->pending != NULL) {
+		request_fields_add(fields, group->pending->data);
+		group->pending = g_list_delete_link(group->pending, group->pending);
+	}
+}
+
+int
+purple_request_fields_get_integer(const PurpleRequestFields *fields, const char *id)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(fields->values, id));
+}
+
+PurpleRequestFieldGroup *
+purple_request_field_group_new(const char *title)
+{
+	return g_new0(PurpleRequestFieldGroup, 1);
+}
+
+void
+purple_request_field_group_add_field(PurpleRequestFieldGroup *group, PurpleRequestField *field)
+{
+	if (group->fields != NULL)
+		request_fields_add(group->fields, field);
+	else
+		group->pending = g_list_append(group->pending, field);
+}
+
+PurpleRequestField *
+purple_request_field_int_new(const char *id, const char *text, int value)
+{
+	PurpleRequestField *field = g_new0(PurpleRequestField, 1);
+
+	field->id = g_strdup(id);
+	field->value = value;
+	return field;
+}
+
+void *
+purple_request_fields(void *handle, const char *title, const char *primary,
+                      const char *secondary, PurpleRequestFields *fields,
+                      const char *ok_text, GCallback ok_cb,
+                      const char *cancel_text, GCallback cancel_cb,
+                      PurpleAccount *account, const char *who,
+                      PurpleConversation *conv, void *user_data)
+{
+	if (cancel_cb != NULL)
+		((void (*)(void *, PurpleRequestFields *))cancel_cb)(user_data, fields);
+	g_list_free_full(fields->groups, g_free);
+	g_hash_table_destroy(fields->values);
+	g_free(fields);
+	return NULL;
+}
+
+void *
+purple_request_input(void *handle, const char *title, const char *primary,
+                     const char *secondary, const char *default_value,
+                     gboolean multiline, gboolean masked, gchar *hint,
+                     const char *ok_text, GCallback ok_cb,
+                     const char *cancel_text, GCallback cancel_cb,
+                     PurpleAccount *account, const char *who,
+                     PurpleConversation *conv, void *user_data)
+{
+	if (cancel_cb != NULL)
+		((void (*)(void *, const char *))cancel_cb)(user_data, default_value);
+	return NULL;
+}
+
+/* Setting up and tearing down */
+
+void
+stub_init(const char *dir)
+{
+	user_dir = g_strdup(dir);
+	prefs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, pref_free);
+	images = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, image_free);
+	prpls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, prpl_free);
+	menu_sources = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	purple_prefs_add_none("/purple");
+	purple_prefs_add_none("/purple/logging");
+	purple_prefs_add_string("/purple/logging/format", "html");
+	purple_prefs_add_none("/plugins");
+}
+
+void
+stub_uninit(void)
+{
+	while (conversations != NULL)
+		stub_conversation_destroy(conversations->data);
+	g_list_free_full(accounts, account_free);
+	accounts = NULL;
+	g_list_free_full(pref_callbacks, pref_callback_free);
+	pref_callbacks = NULL;
+	g_list_free(loggers);
+	loggers = NULL;
+	g_hash_table_destroy(prefs);
+	g_hash_table_destroy(images);
+	g_hash_table_destroy(prpls);
+	g_hash_table_destroy(menu_sources);
+	g_list_free_full(saved_statuses, g_free);
+	saved_statuses = NULL;
+	current_status = NULL;
+	if (window.window != NULL)
+		g_object_unref(window.window);
+	window.window = NULL;
+	if (launcher != NULL)
+		g_object_unref(launcher);
+	launcher = NULL;
+	remote_calls = 0;
+	g_free(user_dir);
+	user_dir = NULL;
+}
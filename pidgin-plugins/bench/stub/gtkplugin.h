@@ -0,0 +1,2 @@
+/* Declared in internal.h */
+#include "internal.h"
@@ -0,0 +1,691 @@
+/*
+ * Stand-in for the libpurple and Pidgin headers, for building the plugins
+ * outside of Pidgin. Only what the plugins use is declared, with the names
+ * and signatures of Pidgin 3.0.0; purple-stub.c implements it. The other
+ * headers in this directory just include this one.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+#ifndef _PURPLE_STUB_INTERNAL_H_
+#define _PURPLE_STUB_INTERNAL_H_
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#define _(String) (String)
+#define N_(String) (String)
+
+/* version.h */
+#define PURPLE_MAJOR_VERSION 3
+#define PURPLE_MINOR_VERSION 0
+#define PURPLE_MICRO_VERSION 0
+
+/* GTK+ */
+#define GTK_MAJOR_VERSION 3
+#define GTK_MINOR_VERSION 0
+#define GTK_MICRO_VERSION 0
+#define GTK_CHECK_VERSION(major, minor, micro) \
+	(GTK_MAJOR_VERSION > (major) || \
+	 (GTK_MAJOR_VERSION == (major) && GTK_MINOR_VERSION > (minor)) || \
+	 (GTK_MAJOR_VERSION == (major) && GTK_MINOR_VERSION == (minor) && \
+	  GTK_MICRO_VERSION >= (micro)))
+
+typedef enum {
+	GTK_STATE_NORMAL,
+	GTK_STATE_ACTIVE,
+	GTK_STATE_PRELIGHT,
+	GTK_STATE_SELECTED,
+	GTK_STATE_INSENSITIVE
+} GtkStateType;
+
+typedef struct {
+	guint32 pixel;
+	guint16 red;
+	guint16 green;
+	guint16 blue;
+} GdkColor;
+
+typedef struct {
+	GdkColor fg[5];
+	GdkColor bg[5];
+	GdkColor text[5];
+	GdkColor base[5];
+	GdkColor black;
+	GdkColor white;
+} GtkStyle;
+
+/* A bare GObject with the signals the plugins connect to */
+typedef struct _GtkWidget {
+	GObject parent;
+} GtkWidget;
+
+/* Every other widget is one too */
+typedef struct _GtkWidget GtkBox;
+typedef struct _GtkWidget GtkContainer;
+typedef struct _GtkWidget GtkLabel;
+typedef struct _GtkWidget GtkMisc;
+typedef struct _GtkWidget GtkRadioButton;
+typedef struct _GtkWidget GtkScrolledWindow;
+typedef struct _GtkWidget GtkSpinButton;
+typedef struct _GtkWidget GtkTextBuffer;
+typedef struct _GtkWidget GtkTextView;
+typedef struct _GtkWidget GtkToggleButton;
+typedef struct _GtkAdjustment GtkAdjustment;
+typedef struct _GdkWindow GdkWindow;
+typedef union _GdkEvent GdkEvent;
+
+typedef struct {
+	gpointer dummy[14];
+} GtkTextIter;
+
+#define GTK_BOX(obj) ((GtkBox *)(obj))
+#define GTK_CONTAINER(obj) ((GtkContainer *)(obj))
+#define GTK_LABEL(obj) ((GtkLabel *)(obj))
+#define GTK_MISC(obj) ((GtkMisc *)(obj))
+#define GTK_RADIO_BUTTON(obj) ((GtkRadioButton *)(obj))
+#define GTK_SCROLLED_WINDOW(obj) ((GtkScrolledWindow *)(obj))
+#define GTK_SPIN_BUTTON(obj) ((GtkSpinButton *)(obj))
+#define GTK_TEXT_VIEW(obj) ((GtkTextView *)(obj))
+#define GTK_TOGGLE_BUTTON(obj) ((GtkToggleButton *)(obj))
+
+typedef enum {
+	GTK_ORIENTATION_HORIZONTAL,
+	GTK_ORIENTATION_VERTICAL
+} GtkOrientation;
+
+typedef enum {
+	GTK_POLICY_ALWAYS,
+	GTK_POLICY_AUTOMATIC,
+	GTK_POLICY_NEVER
+} GtkPolicyType;
+
+typedef enum {
+	GTK_SHADOW_NONE,
+	GTK_SHADOW_IN,
+	GTK_SHADOW_OUT,
+	GTK_SHADOW_ETCHED_IN,
+	GTK_SHADOW_ETCHED_OUT
+} GtkShadowType;
+
+GtkStyle *gtk_widget_get_style(GtkWidget *widget);
+GdkWindow *gtk_widget_get_window(GtkWidget *widget);
+void gtk_widget_set_size_request(GtkWidget *widget, gint width, gint height);
+void gtk_widget_show_all(GtkWidget *widget);
+void gdk_window_focus(GdkWindow *window, guint32 timestamp);
+GtkWidget *gtk_box_new(GtkOrientation orientation, gint spacing);
+void gtk_box_pack_start(GtkBox *box, GtkWidget *child, gboolean expand,
+                        gboolean fill, guint padding);
+void gtk_container_add(GtkContainer *container, GtkWidget *widget);
+void gtk_container_set_border_width(GtkContainer *container, guint border_width);
+GtkWidget *gtk_label_new_with_mnemonic(const gchar *str);
+void gtk_label_set_mnemonic_widget(GtkLabel *label, GtkWidget *widget);
+void gtk_misc_set_alignment(GtkMisc *misc, gfloat xalign, gfloat yalign);
+GtkWidget *gtk_check_button_new_with_mnemonic(const gchar *label);
+GtkWidget *gtk_radio_button_new_with_mnemonic(GSList *group, const gchar *label);
+GtkWidget *gtk_radio_button_new_with_mnemonic_from_widget(GtkRadioButton *radio_group_member,
+                                                          const gchar *label);
+gboolean gtk_toggle_button_get_active(GtkToggleButton *toggle_button);
+void gtk_toggle_button_set_active(GtkToggleButton *toggle_button, gboolean is_active);
+GtkWidget *gtk_spin_button_new_with_range(gdouble min, gdouble max, gdouble step);
+void gtk_spin_button_set_value(GtkSpinButton *spin_button, gdouble value);
+gint gtk_spin_button_get_value_as_int(GtkSpinButton *spin_button);
+GtkWidget *gtk_scrolled_window_new(GtkAdjustment *hadjustment, GtkAdjustment *vadjustment);
+void gtk_scrolled_window_set_policy(GtkScrolledWindow *scrolled_window,
+                                    GtkPolicyType hscrollbar_policy,
+                                    GtkPolicyType vscrollbar_policy);
+void gtk_scrolled_window_set_shadow_type(GtkScrolledWindow *scrolled_window, GtkShadowType type);
+GtkWidget *gtk_text_view_new(void);
+GtkTextBuffer *gtk_text_view_get_buffer(GtkTextView *text_view);
+void gtk_text_buffer_get_bounds(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end);
+gchar *gtk_text_buffer_get_text(GtkTextBuffer *buffer, const GtkTextIter *start,
+                                const GtkTextIter *end, gboolean include_hidden_chars);
+void gtk_text_buffer_insert_at_cursor(GtkTextBuffer *buffer, const gchar *text, gint len);
+
+/* unity.h and messaging-menu.h: calls are counted, as each would be a
+ * D-Bus message */
+typedef struct _UnityLauncherEntry {
+	GObject parent;
+} UnityLauncherEntry;
+
+UnityLauncherEntry *unity_launcher_entry_get_for_desktop_id(const gchar *desktop_id);
+void unity_launcher_entry_set_count(UnityLauncherEntry *self, gint64 value);
+void unity_launcher_entry_set_count_visible(UnityLauncherEntry *self, gboolean value);
+
+typedef struct _MessagingMenuApp {
+	GObject parent;
+} MessagingMenuApp;
+
+typedef enum {
+	MESSAGING_MENU_STATUS_AVAILABLE,
+	MESSAGING_MENU_STATUS_AWAY,
+	MESSAGING_MENU_STATUS_BUSY,
+	MESSAGING_MENU_STATUS_INVISIBLE,
+	MESSAGING_MENU_STATUS_OFFLINE
+} MessagingMenuStatus;
+
+MessagingMenuApp *messaging_menu_app_new(const gchar *desktop_id);
+void messaging_menu_app_register(MessagingMenuApp *app);
+void messaging_menu_app_unregister(MessagingMenuApp *app);
+void messaging_menu_app_set_status(MessagingMenuApp *app, MessagingMenuStatus status);
+gboolean messaging_menu_app_has_source(MessagingMenuApp *app, const gchar *source_id);
+void messaging_menu_app_append_source(MessagingMenuApp *app, const gchar *id,
+                                      GIcon *icon, const gchar *label);
+void messaging_menu_app_remove_source(MessagingMenuApp *app, const gchar *source_id);
+void messaging_menu_app_set_source_count(MessagingMenuApp *app, const gchar *source_id,
+                                         guint count);
+void messaging_menu_app_set_source_time(MessagingMenuApp *app, const gchar *source_id,
+                                        gint64 time);
+void messaging_menu_app_draw_attention(MessagingMenuApp *app, const gchar *source_id);
+
+/* Basic types */
+typedef void (*PurpleCallback)(void);
+#define PURPLE_CALLBACK(func) ((PurpleCallback)func)
+
+typedef void (*PurpleSignalMarshalFunc)(PurpleCallback cb, va_list args,
+                                        void *data, void **return_val);
+
+typedef enum {
+	PURPLE_TYPE_UNKNOWN = 0,
+	PURPLE_TYPE_SUBTYPE,
+	PURPLE_TYPE_CHAR,
+	PURPLE_TYPE_UCHAR,
+	PURPLE_TYPE_BOOLEAN,
+	PURPLE_TYPE_SHORT,
+	PURPLE_TYPE_USHORT,
+	PURPLE_TYPE_INT,
+	PURPLE_TYPE_UINT,
+	PURPLE_TYPE_LONG,
+	PURPLE_TYPE_ULONG,
+	PURPLE_TYPE_INT64,
+	PURPLE_TYPE_UINT64,
+	PURPLE_TYPE_STRING,
+	PURPLE_TYPE_OBJECT,
+	PURPLE_TYPE_POINTER,
+	PURPLE_TYPE_ENUM,
+	PURPLE_TYPE_BOXED
+} PurpleType;
+
+typedef struct _PurpleValue PurpleValue;
+typedef struct _PurpleAccount PurpleAccount;
+typedef struct _PurpleBuddy PurpleBuddy;
+typedef struct _PurpleConnection PurpleConnection;
+typedef struct _PurpleConversation PurpleConversation;
+typedef struct _PurplePlugin PurplePlugin;
+typedef struct _PurplePluginInfo PurplePluginInfo;
+typedef struct _PurplePluginAction PurplePluginAction;
+typedef struct _PurplePluginUiInfo PurplePluginUiInfo;
+typedef struct _PurplePluginPref PurplePluginPref;
+typedef struct _PurplePluginPrefFrame PurplePluginPrefFrame;
+typedef struct _PurpleStoredImage PurpleStoredImage;
+typedef struct _PurpleRequestFields PurpleRequestFields;
+typedef struct _PurpleRequestFieldGroup PurpleRequestFieldGroup;
+typedef struct _PurpleRequestField PurpleRequestField;
+
+PurpleValue *purple_value_new(PurpleType type, ...);
+
+/* debug.h */
+void purple_debug_misc(const char *category, const char *format, ...) G_GNUC_PRINTF(2, 3);
+void purple_debug_info(const char *category, const char *format, ...) G_GNUC_PRINTF(2, 3);
+void purple_debug_warning(const char *category, const char *format, ...) G_GNUC_PRINTF(2, 3);
+void purple_debug_error(const char *category, const char *format, ...) G_GNUC_PRINTF(2, 3);
+gboolean purple_debug_is_verbose(void);
+
+/* util.h */
+#define PURPLE_NO_TZ_OFF -500000
+
+const char *purple_user_dir(void);
+int purple_build_dir(const char *path, int mode);
+const char *purple_escape_filename(const char *str);
+const char *purple_unescape_filename(const char *str);
+const char *purple_utf8_strftime(const char *format, const struct tm *tm);
+const char *purple_date_format_long(const struct tm *tm);
+const char *purple_date_format_full(const struct tm *tm);
+const char *purple_time_format(const struct tm *tm);
+time_t purple_str_to_time(const char *timestamp, gboolean utc, struct tm *tm,
+                          long *tz_off, const char **rest);
+gboolean purple_str_has_suffix(const char *s, const char *x);
+char *purple_util_get_image_filename(gconstpointer image_data, size_t image_len);
+gboolean purple_markup_find_tag(const char *needle, const char *haystack,
+                                const char **start, const char **end,
+                                GData **attributes);
+void purple_markup_html_to_xhtml(const char *html, char **dest_xhtml,
+                                 char **dest_plain);
+char *purple_markup_strip_html(const char *str);
+const char *purple_markup_unescape_entity(const char *text, int *length);
+gboolean purple_message_meify(char *message, gssize len);
+
+/* imgstore.h */
+int purple_imgstore_add_with_id(gpointer data, size_t size, const char *filename);
+PurpleStoredImage *purple_imgstore_find_by_id(int id);
+gconstpointer purple_imgstore_get_data(PurpleStoredImage *img);
+size_t purple_imgstore_get_size(PurpleStoredImage *img);
+void purple_imgstore_unref_by_id(int id);
+
+/* prefs.h */
+typedef enum {
+	PURPLE_PREF_NONE,
+	PURPLE_PREF_BOOLEAN,
+	PURPLE_PREF_INT,
+	PURPLE_PREF_STRING,
+	PURPLE_PREF_STRING_LIST,
+	PURPLE_PREF_PATH,
+	PURPLE_PREF_PATH_LIST
+} PurplePrefType;
+
+typedef void (*PurplePrefCallback)(const char *name, PurplePrefType type,
+                                   gconstpointer val, gpointer data);
+
+void purple_prefs_add_none(const char *name);
+void purple_prefs_add_bool(const char *name, gboolean value);
+void purple_prefs_add_int(const char *name, int value);
+void purple_prefs_add_string(const char *name, const char *value);
+void purple_prefs_add_string_list(const char *name, GList *value);
+void purple_prefs_set_bool(const char *name, gboolean value);
+void purple_prefs_set_int(const char *name, int value);
+void purple_prefs_set_string(const char *name, const char *value);
+void purple_prefs_set_string_list(const char *name, GList *value);
+PurplePrefType purple_prefs_get_type(const char *name);
+gboolean purple_prefs_get_bool(const char *name);
+int purple_prefs_get_int(const char *name);
+const char *purple_prefs_get_string(const char *name);
+GList *purple_prefs_get_string_list(const char *name);
+guint purple_prefs_connect_callback(void *handle, const char *name,
+                                    PurplePrefCallback cb, gpointer data);
+void purple_prefs_disconnect_by_handle(void *handle);
+
+/* signals.h */
+gulong purple_signal_connect(void *instance, const char *signal, void *handle,
+                             PurpleCallback func, void *data);
+void *purple_signal_emit_return_1(void *instance, const char *signal, ...);
+
+void purple_marshal_VOID__POINTER(PurpleCallback cb, va_list args,
+                                  void *data, void **return_val);
+void purple_marshal_POINTER__POINTER(PurpleCallback cb, va_list args,
+                                     void *data, void **return_val);
+void purple_marshal_POINTER__POINTER_INT(PurpleCallback cb, va_list args,
+                                         void *data, void **return_val);
+void purple_marshal_POINTER__POINTER_POINTER(PurpleCallback cb, va_list args,
+                                             void *data, void **return_val);
+
+/* account.h */
+const char *purple_account_get_username(const PurpleAccount *account);
+const char *purple_account_get_protocol_id(const PurpleAccount *account);
+PurpleConnection *purple_account_get_connection(const PurpleAccount *account);
+PurpleAccount *purple_accounts_find(const char *name, const char *protocol);
+GList *purple_accounts_get_all_active(void);
+
+/* conversation.h */
+typedef enum {
+	PURPLE_CONV_TYPE_UNKNOWN = 0,
+	PURPLE_CONV_TYPE_IM,
+	PURPLE_CONV_TYPE_CHAT,
+	PURPLE_CONV_TYPE_MISC,
+	PURPLE_CONV_TYPE_ANY
+} PurpleConversationType;
+
+typedef enum {
+	PURPLE_MESSAGE_SEND        = 0x0001,
+	PURPLE_MESSAGE_RECV        = 0x0002,
+	PURPLE_MESSAGE_SYSTEM      = 0x0004,
+	PURPLE_MESSAGE_AUTO_RESP   = 0x0008,
+	PURPLE_MESSAGE_ACTIVE_ONLY = 0x0010,
+	PURPLE_MESSAGE_NICK        = 0x0020,
+	PURPLE_MESSAGE_NO_LOG      = 0x0040,
+	PURPLE_MESSAGE_WHISPER     = 0x0080,
+	PURPLE_MESSAGE_ERROR       = 0x0200,
+	PURPLE_MESSAGE_DELAYED     = 0x0400,
+	PURPLE_MESSAGE_RAW         = 0x0800,
+	PURPLE_MESSAGE_IMAGES      = 0x1000,
+	PURPLE_MESSAGE_NOTIFY      = 0x2000,
+	PURPLE_MESSAGE_NO_LINKIFY  = 0x4000,
+	PURPLE_MESSAGE_INVISIBLE   = 0x8000
+} PurpleMessageFlags;
+
+typedef struct _PurpleConvChat PurpleConvChat;
+
+#define PURPLE_CONV_CHAT(c) (purple_conversation_get_chat_data(c))
+
+void *purple_conversations_get_handle(void);
+GList *purple_get_conversations(void);
+PurpleConversation *purple_find_conversation_with_account(PurpleConversationType type,
+                                                          const char *name,
+                                                          const PurpleAccount *account);
+PurpleConversation *purple_find_chat(const PurpleConnection *gc, int id);
+PurpleConvChat *purple_conversation_get_chat_data(const PurpleConversation *conv);
+int purple_conv_chat_get_id(const PurpleConvChat *chat);
+PurpleConversationType purple_conversation_get_type(const PurpleConversation *conv);
+PurpleAccount *purple_conversation_get_account(const PurpleConversation *conv);
+const char *purple_conversation_get_name(const PurpleConversation *conv);
+const char *purple_conversation_get_title(const PurpleConversation *conv);
+gpointer purple_conversation_get_ui_data(const PurpleConversation *conv);
+void purple_conversation_set_data(PurpleConversation *conv, const char *key, gpointer data);
+gpointer purple_conversation_get_data(PurpleConversation *conv, const char *key);
+void purple_conversation_close_logs(PurpleConversation *conv);
+
+/* status.h and savedstatuses.h */
+typedef struct _PurpleSavedStatus PurpleSavedStatus;
+typedef struct _PurpleStatusType PurpleStatusType;
+
+typedef enum {
+	PURPLE_STATUS_UNSET = 0,
+	PURPLE_STATUS_OFFLINE,
+	PURPLE_STATUS_AVAILABLE,
+	PURPLE_STATUS_UNAVAILABLE,
+	PURPLE_STATUS_INVISIBLE,
+	PURPLE_STATUS_AWAY,
+	PURPLE_STATUS_EXTENDED_AWAY,
+	PURPLE_STATUS_MOBILE,
+	PURPLE_STATUS_TUNE,
+	PURPLE_STATUS_MOOD,
+	PURPLE_STATUS_NUM_PRIMITIVES
+} PurpleStatusPrimitive;
+
+void *purple_savedstatuses_get_handle(void);
+PurpleSavedStatus *purple_savedstatus_new(const char *title, PurpleStatusPrimitive type);
+void purple_savedstatus_set_substatus(PurpleSavedStatus *status, const PurpleAccount *account,
+                                      const PurpleStatusType *type, const char *message);
+PurpleStatusPrimitive purple_savedstatus_get_type(const PurpleSavedStatus *saved_status);
+PurpleSavedStatus *purple_savedstatus_find_transient_by_type_and_message(PurpleStatusPrimitive type,
+                                                                         const char *message);
+void purple_savedstatus_activate(PurpleSavedStatus *saved_status);
+PurpleSavedStatus *purple_savedstatus_get_current(void);
+
+/* log.h */
+typedef enum {
+	PURPLE_LOG_IM,
+	PURPLE_LOG_CHAT,
+	PURPLE_LOG_SYSTEM
+} PurpleLogType;
+
+typedef enum {
+	PURPLE_LOG_READ_NO_NEWLINE = 1
+} PurpleLogReadFlags;
+
+typedef struct _PurpleLog PurpleLog;
+typedef struct _PurpleLogLogger PurpleLogLogger;
+typedef struct _PurpleLogCommonLoggerData PurpleLogCommonLoggerData;
+typedef struct _PurpleLogSet PurpleLogSet;
+
+typedef void (*PurpleLogSetCallback)(GHashTable *sets, PurpleLogSet *set);
+
+struct _PurpleLogLogger {
+	char *name;
+	char *id;
+	void (*create)(PurpleLog *log);
+	gsize (*write)(PurpleLog *log, PurpleMessageFlags type, const char *from,
+	               time_t time, const char *message);
+	void (*finalize)(PurpleLog *log);
+	GList *(*list)(PurpleLogType type, const char *name, PurpleAccount *account);
+	char *(*read)(PurpleLog *log, PurpleLogReadFlags *flags);
+	int (*size)(PurpleLog *log);
+	int (*total_size)(PurpleLogType type, const char *name, PurpleAccount *account);
+	GList *(*list_syslog)(PurpleAccount *account);
+	void (*get_log_sets)(PurpleLogSetCallback cb, GHashTable *sets);
+	gboolean (*remove)(PurpleLog *log);
+	gboolean (*is_deletable)(PurpleLog *log);
+};
+
+struct _PurpleLog {
+	PurpleLogType type;
+	char *name;
+	PurpleAccount *account;
+	PurpleConversation *conv;
+	time_t time;
+	PurpleLogLogger *logger;
+	void *logger_data;
+	struct tm *tm;
+};
+
+struct _PurpleLogCommonLoggerData {
+	char *path;
+	FILE *file;
+	void *extra;
+};
+
+void *purple_log_get_handle(void);
+PurpleLog *purple_log_new(PurpleLogType type, const char *name, PurpleAccount *account,
+                          PurpleConversation *conv, time_t time, const struct tm *tm);
+void purple_log_free(PurpleLog *log);
+char *purple_log_get_log_dir(PurpleLogType type, const char *name, PurpleAccount *account);
+PurpleLogLogger *purple_log_logger_new(const char *id, const char *name, int functions, ...);
+void purple_log_logger_free(PurpleLogLogger *logger);
+void purple_log_logger_add(PurpleLogLogger *logger);
+void purple_log_logger_remove(PurpleLogLogger *logger);
+void purple_log_common_writer(PurpleLog *log, const char *ext);
+int purple_log_common_sizer(PurpleLog *log);
+gboolean purple_log_common_deleter(PurpleLog *log);
+gboolean purple_log_common_is_deletable(PurpleLog *log);
+
+/* plugin.h */
+typedef enum {
+	PURPLE_PLUGIN_UNKNOWN = -1,
+	PURPLE_PLUGIN_STANDARD = 0,
+	PURPLE_PLUGIN_LOADER,
+	PURPLE_PLUGIN_PROTOCOL
+} PurplePluginType;
+
+#define PURPLE_PRIORITY_DEFAULT 0
+#define PURPLE_PLUGIN_MAGIC 5
+
+struct _PurplePluginInfo {
+	unsigned int magic;
+	unsigned int major_version;
+	unsigned int minor_version;
+	PurplePluginType type;
+	char *ui_requirement;
+	unsigned long flags;
+	GList *dependencies;
+	int priority;
+
+	char *id;
+	char *name;
+	char *version;
+	char *summary;
+	char *description;
+	char *author;
+	char *homepage;
+
+	gboolean (*load)(PurplePlugin *plugin);
+	gboolean (*unload)(PurplePlugin *plugin);
+	void (*destroy)(PurplePlugin *plugin);
+
+	void *ui_info;
+	void *extra_info;
+	PurplePluginUiInfo *prefs_info;
+	GList *(*actions)(PurplePlugin *plugin, gpointer context);
+
+	void (*_purple_reserved1)(void);
+	void (*_purple_reserved2)(void);
+	void (*_purple_reserved3)(void);
+	void (*_purple_reserved4)(void);
+};
+
+struct _PurplePlugin {
+	gboolean native_plugin;
+	gboolean loaded;
+	void *handle;
+	char *path;
+	PurplePluginInfo *info;
+	char *error;
+	void *ipc_data;
+	void *extra;
+	gboolean unloadable;
+	GList *dependent_plugins;
+};
+
+struct _PurplePluginAction {
+	char *label;
+	void (*callback)(PurplePluginAction *action);
+	PurplePlugin *plugin;
+	gpointer context;
+	gpointer user_data;
+};
+
+struct _PurplePluginUiInfo {
+	PurplePluginPrefFrame *(*get_plugin_pref_frame)(PurplePlugin *plugin);
+	int page_num;
+	PurplePluginPrefFrame *frame;
+
+	void (*_purple_reserved1)(void);
+	void (*_purple_reserved2)(void);
+	void (*_purple_reserved3)(void);
+	void (*_purple_reserved4)(void);
+};
+
+/* Plugins are linked in, so init_plugin is run by calling this */
+#define PURPLE_INIT_PLUGIN(pluginname, initfunc, plugininfo) \
+	gboolean purple_init_plugin(PurplePlugin *plugin); \
+	gboolean purple_init_plugin(PurplePlugin *plugin) \
+	{ \
+		plugin->info = &(plugininfo); \
+		initfunc((plugin)); \
+		return TRUE; \
+	}
+
+PurplePluginAction *purple_plugin_action_new(const char *label,
+                                             void (*callback)(PurplePluginAction *));
+gboolean purple_plugin_ipc_register(PurplePlugin *plugin, const char *command,
+                                    PurpleCallback func, PurpleSignalMarshalFunc marshal,
+                                    PurpleValue *ret_value, int num_params, ...);
+void purple_plugin_ipc_unregister_all(PurplePlugin *plugin);
+
+PurplePluginPrefFrame *purple_plugin_pref_frame_new(void);
+void purple_plugin_pref_frame_add(PurplePluginPrefFrame *frame, PurplePluginPref *pref);
+PurplePluginPref *purple_plugin_pref_new_with_label(const char *label);
+PurplePluginPref *purple_plugin_pref_new_with_name_and_label(const char *name, const char *label);
+void purple_plugin_pref_set_bounds(PurplePluginPref *pref, int min, int max);
+
+/* prpl.h */
+typedef struct {
+	const char *(*list_icon)(PurpleAccount *account, PurpleBuddy *buddy);
+} PurplePluginProtocolInfo;
+
+#define PURPLE_PLUGIN_PROTOCOL_INFO(plugin) \
+	((PurplePluginProtocolInfo *)(plugin)->info->extra_info)
+
+PurplePlugin *purple_find_prpl(const char *id);
+
+/* notify.h */
+typedef enum {
+	PURPLE_NOTIFY_MSG_ERROR = 0,
+	PURPLE_NOTIFY_MSG_WARNING,
+	PURPLE_NOTIFY_MSG_INFO
+} PurpleNotifyMsgType;
+
+typedef void (*PurpleNotifyCloseCallback)(gpointer user_data);
+
+void *purple_notify_message(void *handle, PurpleNotifyMsgType type,
+                            const char *title, const char *primary,
+                            const char *secondary, PurpleNotifyCloseCallback cb,
+                            gpointer user_data);
+void *purple_notify_formatted(void *handle, const char *title, const char *primary,
+                              const char *secondary, const char *text,
+                              PurpleNotifyCloseCallback cb, gpointer user_data);
+
+#define purple_notify_error(handle, title, primary, secondary) \
+	purple_notify_message((handle), PURPLE_NOTIFY_MSG_ERROR, (title), \
+	                      (primary), (secondary), NULL, NULL)
+#define purple_notify_info(handle, title, primary, secondary) \
+	purple_notify_message((handle), PURPLE_NOTIFY_MSG_INFO, (title), \
+	                      (primary), (secondary), NULL, NULL)
+
+/* request.h */
+PurpleRequestFields *purple_request_fields_new(void);
+void purple_request_fields_add_group(PurpleRequestFields *fields,
+                                     PurpleRequestFieldGroup *group);
+int purple_request_fields_get_integer(const PurpleRequestFields *fields, const char *id);
+PurpleRequestFieldGroup *purple_request_field_group_new(const char *title);
+void purple_request_field_group_add_field(PurpleRequestFieldGroup *group,
+                                          PurpleRequestField *field);
+PurpleRequestField *purple_request_field_int_new(const char *id, const char *text,
+                                                 int value);
+void *purple_request_fields(void *handle, const char *title, const char *primary,
+                            const char *secondary, PurpleRequestFields *fields,
+                            const char *ok_text, GCallback ok_cb,
+                            const char *cancel_text, GCallback cancel_cb,
+                            PurpleAccount *account, const char *who,
+                            PurpleConversation *conv, void *user_data);
+void *purple_request_input(void *handle, const char *title, const char *primary,
+                           const char *secondary, const char *default_value,
+                           gboolean multiline, gboolean masked, gchar *hint,
+                           const char *ok_text, GCallback ok_cb,
+                           const char *cancel_text, GCallback cancel_cb,
+                           PurpleAccount *account, const char *who,
+                           PurpleConversation *conv, void *user_data);
+
+/* gtkplugin.h, gtkconv.h and gtkutils.h */
+#define PIDGIN_PLUGIN_TYPE "gtk"
+
+typedef struct _PidginPluginUiInfo {
+	GtkWidget *(*get_config_frame)(PurplePlugin *plugin);
+	int page_num;
+
+	void (*_pidgin_reserved1)(void);
+	void (*_pidgin_reserved2)(void);
+	void (*_pidgin_reserved3)(void);
+	void (*_pidgin_reserved4)(void);
+} PidginPluginUiInfo;
+
+/* All conversations share one window, as tabs */
+typedef struct _PidginWindow {
+	GtkWidget *window;
+} PidginWindow;
+
+typedef struct _PidginConversation {
+	PurpleConversation *active_conv;
+	PidginWindow *win;
+	GtkWidget *entry;
+	GtkWidget *webview;
+	GArray *nick_colors;
+} PidginConversation;
+
+#define PIDGIN_CONVERSATION(conv) \
+	((PidginConversation *)purple_conversation_get_ui_data(conv))
+
+void *pidgin_conversations_get_handle(void);
+gboolean pidgin_conv_window_has_focus(PidginWindow *win);
+gboolean pidgin_conv_window_is_active_conversation(const PurpleConversation *conv);
+void pidgin_conv_window_switch_gtkconv(PidginWindow *win, PidginConversation *gtkconv);
+GtkWidget *pidgin_make_frame(GtkWidget *parent, const char *title);
+
+/* Not in libpurple: setting up what Pidgin would have */
+void stub_init(const char *user_dir);
+void stub_uninit(void);
+PurpleAccount *stub_account_new(const char *username, const char *protocol_id);
+PurpleConversation *stub_conversation_new(PurpleConversationType type,
+                                          PurpleAccount *account, const char *name);
+void stub_conversation_destroy(PurpleConversation *conv);
+
+/* Focuses the window on conv's tab and its message view, as a click on
+ * it would, or takes the focus away from the window if conv is NULL */
+void stub_conversation_focus(PurpleConversation *conv);
+
+/* Calls made to the messaging menu and the launcher so far */
+guint stub_remote_calls(void);
+
+#endif /* _PURPLE_STUB_INTERNAL_H_ */
@@ -0,0 +1,480 @@
+/*
+ * Unity Integration benchmark - Feed conversation events to the plugin
+ * without Pidgin
+ *
+ * The plugin is built into this driver against the stub libpurple, whose
+ * messaging menu and launcher only count the calls made to them. Each
+ * benchmark named on the command line ("replay" if none is) prints what it
+ * measured.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301, USA.
+ */
+
+/* Its statics are what is being measured */
+#include "../unityinteg.c"
+
+#include <locale.h>
+
+#include "alloc-count.h"
+#include "bench-util.h"
+
+typedef struct {
+	char *trace;
+	int speed;        /* times the original pace, 0 for as fast as possible */
+	int conversations;  /* open for states */
+	int patterns;     /* made-up words for highlights */
+	int regexes;      /* made-up /regex/ patterns for highlights */
+	int messages;     /* scanned by highlights */
+} BenchParams;
+
+typedef struct {
+	const char *name;
+	void (*run)(const BenchParams *params);
+} Bench;
+
+static PurpleAccount *
+bench_account(const char *username, const char *protocol_id)
+{
+	PurpleAccount *account = purple_accounts_find(username, protocol_id);
+	return account != NULL ? account : stub_account_new(username, protocol_id);
+}
+
+/* The conversation a record is about. One the trace never saw created was
+ * open when it started, so it is opened the way plugin_load() finds it. */
+static PurpleConversation *
+replay_conversation(const char **fields)
+{
+	PurpleConversationType type = atoi(fields[0]);
+	PurpleAccount *account = bench_account(fields[2], fields[3]);
+	PurpleConversation *conv;
+
+	conv = purple_find_conversation_with_account(type, fields[1], account);
+	if (conv == NULL) {
+		conv = stub_conversation_new(type, account, fields[1]);
+		attach_signals(conv);
+	}
+	return conv;
+}
+
+/* Feeds the events of a trace recorded by the plugin to its handlers
+ * again. The trace has the focus coming to a conversation but not leaving
+ * the window, so the window keeps it from the first 'F' on. */
+static void
+bench_replay(const BenchParams *params)
+{
+	GArray *latencies;
+	BenchTrace trace;
+	const char *fields[6];
+	guint64 start, elapsed, allocs;
+	guint skipped = 0, messages = 0, alerts = 0, calls = stub_remote_calls();
+	char type;
+	int n;
+
+	if (params->trace == NULL) {
+		fprintf(stderr, "The replay benchmark needs a trace, given with --trace\n");
+		return;
+	}
+	if (!bench_trace_open(&trace, params->trace, TRACE_MAGIC, params->speed))
+		return;
+
+	latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+	trace_replaying = TRUE;
+
+	allocs = alloc_count();
+	start = bench_now();
+	while ((n = bench_trace_next(&trace, &type, fields, G_N_ELEMENTS(fields))) >= 0) {
+		PurpleConversation *conv;
+		PurpleAccount *account;
+		gint unread;
+		guint64 t;
+
+		if (n < 4 || (type == 'M' && n < 6) || strchr("MSNDF", type) == NULL) {
+			skipped++;
+			continue;
+		}
+
+		if (type == 'N') {
+			account = bench_account(fields[2], fields[3]);
+			if (purple_find_conversation_with_account(atoi(fields[0]), fields[1], account) != NULL) {
+				skipped++;
+				continue;
+			}
+			conv = stub_conversation_new(atoi(fields[0]), account, fields[1]);
+		} else {
+			conv = replay_conversation(fields);
+			account = purple_conversation_get_account(conv);
+		}
+		unread = conv_unread(conv);
+
+		t = bench_now();
+		switch (type) {
+		case 'M':
+			message_displayed_cb(account, NULL, (char *)fields[5], conv, atoi(fields[4]));
+			break;
+		case 'S':
+			if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT)
+				chat_sent_im(account, NULL, purple_conv_chat_get_id(PURPLE_CONV_CHAT(conv)));
+			else
+				im_sent_im(account, purple_conversation_get_name(conv), NULL);
+			break;
+		case 'N':
+			conv_created(conv);
+			break;
+		case 'D':
+			deleting_conv(conv);
+			break;
+		case 'F':
+			stub_conversation_focus(conv);
+			break;
+		}
+		t = bench_now() - t;
+		g_array_append_val(latencies, t);
+
+		if (type == 'M') {
+			messages++;
+			if (conv_unread(conv) > unread)
+				alerts++;
+		} else if (type == 'D') {
+			stub_conversation_destroy(conv);
+		}
+	}
+	flush_updates();
+	elapsed = bench_now() - start;
+	allocs = alloc_count() - allocs;
+	trace_replaying = FALSE;
+
+	g_array_sort(latencies, bench_sample_compare);
+	printf("replay\n"
+	       "  %u records (%u skipped) in %.2f s, %.0f events/s, %.1f allocations/event\n"
+	       "  handler latency: p50 %.2f us, p99 %.2f us, max %.2f us\n"
+	       "  %u messages, %u alerted, %u alerts gathered from bursts\n"
+	       "  %u messaging menu and launcher calls; %u of %u source and %u of %u launcher updates made\n"
+	       "  focus checks: %u cached, %u looked up\n"
+	       "  unread at the end: %u messages in %u conversations\n",
+	       trace.records, skipped, elapsed / 1e9,
+	       elapsed > 0 ? latencies->len * 1e9 / elapsed : 0.0,
+	       bench_per(allocs, latencies->len),
+	       bench_percentile(latencies, 0.5), bench_percentile(latencies, 0.99),
+	       bench_percentile(latencies, 1),
+	       messages, alerts, alerts_gathered,
+	       stub_remote_calls() - calls, source_updates_made, source_updates_queued,
+	       launcher_updates_made, launcher_updates_queued,
+	       focus_cache_hits, focus_cache_misses,
+	       n_messages, n_sources);
+
+	g_array_free(latencies, TRUE);
+	bench_trace_close(&trace);
+}
+
+#define STATES_MESSAGES (1 << 20)
+#define STATES_SWEEPS (1 << 12)
+
+/* ConvState as the per-message path sees it, against the string-keyed
+ * conversation data the plugin used to keep its counts in: a count bumped
+ * for each message in a conversation picked at random, and the unread
+ * total summed over every conversation */
+static void
+bench_states(const BenchParams *params)
+{
+	static const char *data_keys[] = {
+		"unityinteg-message-count", "unityinteg-entry-signal", "unityinteg-webview-signal"
+	};
+	/* What alert() and alert_throttled() read and write */
+	static const struct {
+		gsize offset;
+		gsize size;
+	} hot[] = {
+		{ G_STRUCT_OFFSET(ConvState, count), sizeof(gint) },
+		{ G_STRUCT_OFFSET(ConvState, last_alert), sizeof(gint64) },
+		{ G_STRUCT_OFFSET(ConvState, burst_start), sizeof(gint64) },
+		{ G_STRUCT_OFFSET(ConvState, burst), sizeof(guint) },
+		{ G_STRUCT_OFFSET(ConvState, rate), sizeof(double) },
+		{ G_STRUCT_OFFSET(ConvState, gather_source), sizeof(guint) },
+		{ G_STRUCT_OFFSET(ConvState, visible), sizeof(gboolean) },
+		{ G_STRUCT_OFFSET(ConvState, visible_epoch), sizeof(guint) }
+	};
+	PurpleAccount *account = bench_account("bench@example.com", "prpl-jabber");
+	PurpleConversation **convs = g_new(PurpleConversation *, params->conversations);
+	guint64 start, table, data, table_allocs, data_allocs, table_sweep, data_sweep;
+	gsize first = sizeof(ConvState), last = 0;
+	GHashTableIter iter;
+	gpointer value;
+	volatile glong total = 0;   /* so the sums are not optimized away */
+	guint i, k;
+
+	for (i = 0; i < (guint)params->conversations; i++) {
+		char *name = g_strdup_printf("states%u", i);
+
+		convs[i] = stub_conversation_new(i % 2 ? PURPLE_CONV_TYPE_CHAT : PURPLE_CONV_TYPE_IM,
+		                                 account, name);
+		conv_created(convs[i]);
+		for (k = 0; k < G_N_ELEMENTS(data_keys); k++)
+			purple_conversation_set_data(convs[i], data_keys[k], GINT_TO_POINTER(k));
+		g_free(name);
+	}
+
+	table_allocs = alloc_count();
+	start = bench_now();
+	for (i = 0; i < STATES_MESSAGES; i++) {
+		PurpleConversation *conv = convs[(i * 2654435761u >> 8) % params->conversations];
+		conv_state(conv)->count++;
+	}
+	table = bench_now() - start;
+	table_allocs = alloc_count() - table_allocs;
+
+	data_allocs = alloc_count();
+	start = bench_now();
+	for (i = 0; i < STATES_MESSAGES; i++) {
+		PurpleConversation *conv = convs[(i * 2654435761u >> 8) % params->conversations];
+		gint count = GPOINTER_TO_INT(purple_conversation_get_data(conv, data_keys[0]));
+		purple_conversation_set_data(conv, data_keys[0], GINT_TO_POINTER(count + 1));
+	}
+	data = bench_now() - start;
+	data_allocs = alloc_count() - data_allocs;
+
+	start = bench_now();
+	for (i = 0; i < STATES_SWEEPS; i++) {
+		g_hash_table_iter_init(&iter, conv_states);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			total += ((ConvState *)value)->count;
+	}
+	table_sweep = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < STATES_SWEEPS; i++) {
+		GList *l;
+		for (l = purple_get_conversations(); l != NULL; l = l->next)
+			total += GPOINTER_TO_INT(purple_conversation_get_data(l->data, data_keys[0]));
+	}
+	data_sweep = bench_now() - start;
+
+	for (k = 0; k < G_N_ELEMENTS(hot); k++) {
+		first = MIN(first, hot[k].offset);
+		last = MAX(last, hot[k].offset + hot[k].size);
+	}
+
+	printf("states (%d conversations)\n"
+	       "  ConvState: %" G_GSIZE_FORMAT " bytes; the per-message fields are in bytes %"
+	       G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT ", %" G_GSIZE_FORMAT " cache line%s at best\n"
+	       "  per message: pointer table %.1f ns, %.2f allocations; conversation data %.1f ns, %.2f allocations\n"
+	       "  over all conversations: pointer table %.2f us, conversation data %.2f us\n",
+	       params->conversations, sizeof(ConvState), first, last - 1, (last - first + 63) / 64,
+	       last - first > 64 ? "s" : "",
+	       bench_per(table, STATES_MESSAGES), bench_per(table_allocs, STATES_MESSAGES),
+	       bench_per(data, STATES_MESSAGES), bench_per(data_allocs, STATES_MESSAGES),
+	       bench_per(table_sweep, STATES_SWEEPS) / 1e3, bench_per(data_sweep, STATES_SWEEPS) / 1e3);
+
+	/* The counts were never real alerts, so the totals are not touched */
+	for (i = 0; i < (guint)params->conversations; i++) {
+		conv_state(convs[i])->count = 0;
+		deleting_conv(convs[i]);
+		stub_conversation_destroy(convs[i]);
+	}
+	flush_updates();
+	g_free(convs);
+}
+
+/* What a busy room is expected to keep up with */
+#define HIGHLIGHTS_TARGET 10000
+
+/* Scans synthetic chat traffic, about one message in a hundred mentioning
+ * a word, with made-up words and regexes, and with the patterns set in
+ * the highlights pref if there are any */
+static void
+bench_highlights(const BenchParams *params)
+{
+	static const char words[] = "<font color=\"#123456\">the quick brown fox jumps over the lazy dog</font> ";
+	GList *patterns = NULL;
+	HighlightMatcher *matcher;
+	GPtrArray *messages = g_ptr_array_new_with_free_func(g_free);
+	GArray *latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+	char *mention = g_strdup_printf("keyword%03d", params->patterns / 2);
+	gsize bytes = 0;
+	guint i;
+	int run;
+
+	for (i = 0; i < (guint)params->patterns; i++)
+		patterns = g_list_prepend(patterns, g_strdup_printf("Keyword%03u", i));
+	for (i = 0; i < (guint)params->regexes; i++)
+		patterns = g_list_prepend(patterns, g_strdup_printf("/ticket-%u\\d+/", i));
+	matcher = highlight_matcher_new(patterns);
+	g_list_free_full(patterns, g_free);
+
+	for (i = 0; i < (guint)params->messages; i++) {
+		char *msg = g_strdup_printf("%s%s %s", words, words + i % 20,
+		                            i % 100 == 0 ? mention : "nothing here");
+		bytes += strlen(msg);
+		g_ptr_array_add(messages, msg);
+	}
+
+	printf("highlights (%u messages, %.1f MB)\n", messages->len, bytes / 1048576.0);
+	for (run = 0; run < 2; run++) {
+		const HighlightMatcher *m = run == 0 ? matcher : highlights;
+		guint64 start, elapsed, allocs;
+		guint matched = 0;
+		double rate;
+
+		if (run == 1 && highlights->n_classes == 1 && highlights->regex == NULL)
+			break;
+
+		g_array_set_size(latencies, 0);
+		allocs = alloc_count();
+		start = bench_now();
+		for (i = 0; i < messages->len; i++) {
+			guint64 t = bench_now();
+
+			if (highlight_matcher_match(m, g_ptr_array_index(messages, i)))
+				matched++;
+			t = bench_now() - t;
+			g_array_append_val(latencies, t);
+		}
+		elapsed = MAX(bench_now() - start, 1);
+		allocs = alloc_count() - allocs;
+		rate = messages->len * 1e9 / elapsed;
+
+		g_array_sort(latencies, bench_sample_compare);
+		if (run == 0)
+			printf("  %d words and %d regexes:", params->patterns, params->regexes);
+		else
+			printf("  the highlights pref:");
+		printf(" %.0f messages/s, %.1f MB/s, %.2f allocations/message, %u matched\n"
+		       "    latency: p50 %.2f us, p99 %.2f us, max %.2f us\n"
+		       "    %s the target of %d messages/s\n",
+		       rate, bytes / 1048576.0 * 1e9 / elapsed,
+		       bench_per(allocs, messages->len), matched,
+		       bench_percentile(latencies, 0.5), bench_percentile(latencies, 0.99),
+		       bench_percentile(latencies, 1),
+		       rate >= HIGHLIGHTS_TARGET ? "meets" : "MISSES", HIGHLIGHTS_TARGET);
+	}
+
+	highlight_matcher_free(matcher);
+	g_ptr_array_free(messages, TRUE);
+	g_array_free(latencies, TRUE);
+	g_free(mention);
+}
+
+static const Bench benches[] = {
+	{ "replay", bench_replay },    /* a recorded trace, through the signal handlers */
+	{ "states", bench_states },    /* ConvState, against string-keyed conversation data */
+	{ "highlights", bench_highlights }   /* the highlight matcher on synthetic chat traffic */
+};
+
+int
+main(int argc, char *argv[])
+{
+	BenchParams params;
+	char **prefs = NULL;
+	GOptionEntry entries[] = {
+		{ "trace", 't', 0, G_OPTION_ARG_FILENAME, NULL, "Trace to replay", "FILE" },
+		{ "speed", 0, 0, G_OPTION_ARG_INT, NULL, "Replay at this many times the original pace (0, as fast as possible)", "N" },
+		{ "pref", 'p', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "Set a plugin pref, like alert_burst=0", "NAME=VALUE" },
+		{ "conversations", 'c', 0, G_OPTION_ARG_INT, NULL, "Conversations open for states (100)", "N" },
+		{ "patterns", 0, 0, G_OPTION_ARG_INT, NULL, "Made-up words for highlights (300)", "N" },
+		{ "regexes", 0, 0, G_OPTION_ARG_INT, NULL, "Made-up /regex/ patterns for highlights (5)", "N" },
+		{ "messages", 'm', 0, G_OPTION_ARG_INT, NULL, "Messages scanned by highlights (20000)", "N" },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GError *error = NULL;
+	PurplePlugin plugin;
+	char *dir;
+	gsize b;
+	int i;
+
+	/* Slices are allocations too */
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+	/* Arguments are in the locale's encoding */
+	setlocale(LC_ALL, "");
+
+	params.trace = NULL;
+	params.speed = 0;
+	params.conversations = 100;
+	params.patterns = 300;
+	params.regexes = 5;
+	params.messages = 20000;
+	entries[0].arg_data = &params.trace;
+	entries[1].arg_data = &params.speed;
+	entries[2].arg_data = &prefs;
+	entries[3].arg_data = &params.conversations;
+	entries[4].arg_data = &params.patterns;
+	entries[5].arg_data = &params.regexes;
+	entries[6].arg_data = &params.messages;
+
+	context = g_option_context_new("[BENCHMARK...]");
+	g_option_context_set_summary(context,
+		"Benchmarks: replay of a trace the plugin recorded (the default), states,\n"
+		"highlights, or all of them with \"all\" (replay only if --trace is given).");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+	params.conversations = MAX(params.conversations, 1);
+	params.patterns = MAX(params.patterns, 0);
+	params.regexes = MAX(params.regexes, 0);
+	params.messages = MAX(params.messages, 1);
+
+	if ((dir = g_dir_make_tmp("unityinteg-bench-XXXXXX", &error)) == NULL) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	stub_init(dir);
+
+	memset(&plugin, 0, sizeof(plugin));
+	purple_init_plugin(&plugin);
+	for (i = 0; prefs != NULL && prefs[i] != NULL; i++) {
+		if (!bench_set_pref("/plugins/gtk/unityinteg", prefs[i])) {
+			fprintf(stderr, "Unknown pref: %s\n", prefs[i]);
+			return 1;
+		}
+	}
+	plugin.info->load(&plugin);
+
+	if (!alloc_count_available())
+		printf("Allocations are only counted with glibc\n");
+
+	for (b = 0; b < G_N_ELEMENTS(benches); b++) {
+		gboolean run = argc < 2 && b == 0;
+
+		for (i = 1; i < argc; i++)
+			if (strcmp(argv[i], benches[b].name) == 0 ||
+			    (strcmp(argv[i], "all") == 0 && (benches[b].run != bench_replay || params.trace != NULL)))
+				run = TRUE;
+		if (run) {
+			benches[b].run(&params);
+			bench_iterate();
+		}
+	}
+	for (i = 1; i < argc; i++) {
+		gboolean known = strcmp(argv[i], "all") == 0;
+		for (b = 0; b < G_N_ELEMENTS(benches); b++)
+			known = known || strcmp(argv[i], benches[b].name) == 0;
+		if (!known)
+			fprintf(stderr, "Unknown benchmark: %s\n", argv[i]);
+	}
+
+	plugin.info->unload(&plugin);
+	bench_iterate();
+	stub_uninit();
+
+	bench_remove_tree(dir);
+	g_free(dir);
+	g_strfreev(prefs);
+	g_free(params.trace);
+	return 0;
+}
@@ -23,335 +23,4960 @@
 #include "gtkplugin.h"
 #include "version.h"
 #include "gtkconv.h"
+#include "request.h"
+
+#include <gio/gio.h>
+#include <fcntl.h>
+#include <locale.h>
 
 #define LUMINANCE(c) (float)((0.3*(c.red))+(0.59*(c.green))+(0.11*(c.blue)))
 
 static gsize colornicks_logger_write(PurpleLog *log, PurpleMessageFlags type,
 							  const char *from, time_t time, const char *message);
 static void colornicks_logger_finalize(PurpleLog *log);
+static void colornicks_logger_close(PurpleLogCommonLoggerData *data);
 static GList *colornicks_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
 static GList *colornicks_logger_list_syslog(PurpleAccount *account);
 static char *colornicks_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
 static int colornicks_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+static gsize colornicks_gz_logger_write(PurpleLog *log, PurpleMessageFlags type,
+                                       const char *from, time_t time, const char *message);
+static GList *colornicks_gz_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
+static GList *colornicks_gz_logger_list_syslog(PurpleAccount *account);
+static int colornicks_gz_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
+
+static void search_index_flush(void);
+static void search_index_forget(const char *path);
+static void search_index_add(const char *path, guint64 offset, const char *message);
+static void log_catalog_update(const char *path);
 
 static PurpleLogLogger *colornicks_logger;
+static PurpleLogLogger *colornicks_gz_logger;
+
+/* The debug window is not thread-safe, so errors hit on other threads
+ * are queued here and logged from the main loop. */
+static GThread *main_thread = NULL;
+static GMutex error_lock;
+static GString *error_pending = NULL;  /* protected by error_lock */
+static guint error_source = 0;         /* protected by error_lock */
+
+static void
+error_flush(void)
+{
+	GString *pending;
+
+	g_mutex_lock(&error_lock);
+	pending = error_pending;
+	error_pending = NULL;
+	if (error_source != 0)
+		g_source_remove(error_source);
+	error_source = 0;
+	g_mutex_unlock(&error_lock);
+
+	if (pending != NULL) {
+		purple_debug_error("colornicks", "%s", pending->str);
+		g_string_free(pending, TRUE);
+	}
+}
+
+static gboolean
+error_flush_cb(gpointer data)
+{
+	g_mutex_lock(&error_lock);
+	error_source = 0;
+	g_mutex_unlock(&error_lock);
+	error_flush();
+	return FALSE;
+}
+
+/* purple_debug_error() that may be called from any thread */
+static void
+report_error(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	if (g_thread_self() == main_thread) {
+		char *msg = g_strdup_vprintf(format, args);
+		purple_debug_error("colornicks", "%s", msg);
+		g_free(msg);
+	} else {
+		g_mutex_lock(&error_lock);
+		if (error_pending == NULL)
+			error_pending = g_string_new(NULL);
+		g_string_append_vprintf(error_pending, format, args);
+		if (error_source == 0)
+			error_source = g_idle_add(error_flush_cb, NULL);
+		g_mutex_unlock(&error_lock);
+	}
+	va_end(args);
+}
+
+/* Per-log state, hung off PurpleLogCommonLoggerData->extra. Messages are
+ * formatted on the main thread into the pending buffer, and the writer
+ * thread writes them out in batches. */
+typedef struct {
+	FILE *file;           /* same as data->file, owned by the log */
+	char *path;
+	GString *pending;     /* protected by writer_lock */
+	GByteArray *pending_index; /* protected by writer_lock */
+	guint64 offset;       /* file length once pending is written, protected by writer_lock */
+	gboolean dirty;       /* queued in writer_dirty, protected by writer_lock */
+	GMutex io_lock;       /* held while writing to file */
+	char *index_path;     /* sidecar offset index, NULL if not kept */
+	FILE *index_file;     /* protected by io_lock */
+	gboolean compressed;
+	GString *block;       /* compressed logs: data for the next block, protected by io_lock */
+	char *stamp;          /* last formatted timestamp, main thread only */
+	time_t stamp_when;
+	gboolean stamp_show_date;
+	guint stamp_epoch;
+	PurpleLogCommonLoggerData *log_data;  /* main thread only, NULL once finalized */
+	GList *pool_link;     /* in file_pool while the file is open, main thread only */
+	GString *staged;      /* taken from pending, not yet written out, protected by io_lock */
+	GByteArray *staged_index;  /* protected by io_lock */
+	guint journal_id;     /* 0 if not in the journal, protected by journal_lock */
+	time_t segment_start; /* main thread only */
+	guint lines;          /* messages in this segment, main thread only */
+	gint ref;
+} ColorNicksLogData;
+
+/* The sidecar index next to each log has one record per message: the
+ * byte offset of its line in the log and its timestamp, as big-endian
+ * 64-bit integers. */
+#define LOG_INDEX_SUFFIX ".idx"
+#define LOG_INDEX_RECORD_SIZE 16
+
+typedef struct {
+	guint64 offset;
+	gint64 time;
+} LogIndexEntry;
+
+/* The compressed format holds the same HTML as a series of independently
+ * compressed blocks: [BE u32 compressed length][BE u32 length][raw
+ * deflate data]. Blocks end on line boundaries and offsets in the sidecar
+ * index are into the uncompressed HTML, so a windowed read finds its
+ * blocks by hopping from header to header and only inflates those.
+ * Blocks are cut at CZ_BLOCK_SIZE, or shorter each flush interval so a
+ * crash loses no more than an uncompressed log would. */
+#define CZ_EXTENSION ".htmz"
+#define CZ_BLOCK_SIZE (64 * 1024)
+#define CZ_BLOCK_HEADER 8
+
+typedef struct {
+	guint64 file_offset;  /* of the compressed data */
+	guint64 start;        /* offset of the first uncompressed byte */
+	guint32 clen;
+	guint32 len;
+} CzBlock;
+
+/* Runs all of in through converter, appending the result to out */
+static gboolean
+cz_convert(GConverter *converter, const char *in, gsize len, GString *out)
+{
+	char buf[16 * 1024];
+	GConverterResult result;
+	GError *error = NULL;
+
+	do {
+		gsize read = 0, written = 0;
+
+		result = g_converter_convert(converter, in, len, buf, sizeof(buf),
+		                             G_CONVERTER_INPUT_AT_END, &read, &written, &error);
+		if (result == G_CONVERTER_ERROR) {
+			report_error("Compression error: %s\n", error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+		in += read;
+		len -= read;
+		g_string_append_len(out, buf, written);
+	} while (result != G_CONVERTER_FINISHED);
+
+	return TRUE;
+}
+
+/* Compresses data into a new block at the end of file */
+static gboolean
+cz_write_block(FILE *file, const char *data, gsize len)
+{
+	GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, -1);
+	GString *out = g_string_sized_new(CZ_BLOCK_HEADER + len / 4);
+	guint32 header[2];
+	gboolean ok;
+
+	g_string_set_size(out, CZ_BLOCK_HEADER);
+	ok = cz_convert(G_CONVERTER(compressor), data, len, out);
+	if (ok) {
+		header[0] = GUINT32_TO_BE(out->len - CZ_BLOCK_HEADER);
+		header[1] = GUINT32_TO_BE(len);
+		memcpy(out->str, header, CZ_BLOCK_HEADER);
+		ok = fwrite(out->str, out->len, 1, file) == 1 && fflush(file) == 0;
+	}
+
+	g_string_free(out, TRUE);
+	g_object_unref(compressor);
+	return ok;
+}
+
+/* Lists the blocks of a compressed log, stopping at one that is cut short,
+ * and puts the uncompressed length of those in *len. */
+static GArray *
+cz_blocks(FILE *file, guint64 *len)
+{
+	GArray *blocks = g_array_new(FALSE, FALSE, sizeof(CzBlock));
+	guint64 pos = 0, size;
+	guint32 header[2];
+
+	*len = 0;
+	if (fseek(file, 0, SEEK_END) != 0)
+		return blocks;
+	size = ftell(file);
+
+	while (pos + CZ_BLOCK_HEADER <= size &&
+	       fseek(file, (long)pos, SEEK_SET) == 0 &&
+	       fread(header, CZ_BLOCK_HEADER, 1, file) == 1) {
+		CzBlock block;
+
+		block.file_offset = pos + CZ_BLOCK_HEADER;
+		block.start = *len;
+		block.clen = GUINT32_FROM_BE(header[0]);
+		block.len = GUINT32_FROM_BE(header[1]);
+		if (block.file_offset + block.clen > size)
+			break;
+
+		g_array_append_val(blocks, block);
+		pos = block.file_offset + block.clen;
+		*len += block.len;
+	}
+
+	return blocks;
+}
+
+/* Inflates the blocks of path that overlap [start, end). The result holds
+ * everything from the start of the first of them, which is put in *base;
+ * *len gets the uncompressed length of the whole log. Returns NULL if the
+ * file cannot be opened. Only touches the file, so any thread may call it. */
+static GString *
+cz_read(const char *path, guint64 start, guint64 end, guint64 *base, guint64 *len)
+{
+	FILE *file = g_fopen(path, "rb");
+	GArray *blocks;
+	GString *out;
+	guint i;
+
+	if (file == NULL)
+		return NULL;
+
+	blocks = cz_blocks(file, len);
+	out = g_string_new(NULL);
+	*base = MIN(start, *len);
+
+	for (i = 0; i < blocks->len; i++) {
+		CzBlock *block = &g_array_index(blocks, CzBlock, i);
+		GZlibDecompressor *decompressor;
+		char *compressed;
+		gboolean ok;
+
+		if (block->start + block->len <= start)
+			continue;
+		if (block->start >= end)
+			break;
+		if (out->len == 0)
+			*base = block->start;
+
+		compressed = g_malloc(block->clen);
+		ok = fseek(file, (long)block->file_offset, SEEK_SET) == 0 &&
+		     fread(compressed, block->clen, 1, file) == 1;
+		if (ok) {
+			decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW);
+			ok = cz_convert(G_CONVERTER(decompressor), compressed, block->clen, out);
+			g_object_unref(decompressor);
+		}
+		g_free(compressed);
+
+		/* Whatever follows a bad block is not where the headers say */
+		if (!ok) {
+			*len = block->start;
+			g_string_truncate(out, block->start - *base);
+			break;
+		}
+	}
+
+	g_array_free(blocks, TRUE);
+	fclose(file);
+	return out;
+}
+
+/* Logs being written, by path, so readers can drain them first. Main thread only. */
+static GHashTable *writer_logs = NULL;
+
+static GThread *writer_thread = NULL;
+static GMutex writer_lock;
+static GCond writer_cond;
+static GQueue writer_dirty = G_QUEUE_INIT;
+static gsize writer_pending_bytes = 0;
+static gboolean writer_running = FALSE;
+static gint flush_interval;   /* ms, 0 to write synchronously */
+static gint flush_threshold;  /* bytes */
+static gint read_last_messages = 0;  /* 0 to read whole logs */
+static gint max_open_logs;
+static gint segment_max_kb = 0;      /* 0 for no limit */
+static gint segment_max_lines = 0;   /* 0 for no limit */
+static gboolean segment_daily = FALSE;
+static gboolean use_search_index = FALSE;
+
+static ColorNicksLogData *
+cn_log_data_new(FILE *file, const char *path, gboolean compressed)
+{
+	ColorNicksLogData *cdata = g_slice_new0(ColorNicksLogData);
+	GStatBuf st;
+
+	cdata->file = file;
+	cdata->path = g_strdup(path);
+	cdata->pending = g_string_new(NULL);
+	cdata->pending_index = g_byte_array_new();
+	cdata->staged = g_string_new(NULL);
+	cdata->staged_index = g_byte_array_new();
+	cdata->ref = 1;
+	cdata->compressed = compressed;
+	if (compressed)
+		cdata->block = g_string_sized_new(CZ_BLOCK_SIZE);
+	g_mutex_init(&cdata->io_lock);
+
+	/* Only index logs we write from the start; the index of a log we
+	 * append to is rebuilt by log_index_load() when it is needed. */
+	if (g_stat(path, &st) == 0 && st.st_size > 0) {
+		cdata->offset = st.st_size;
+		if (compressed) {
+			FILE *existing = g_fopen(path, "rb");
+			if (existing != NULL) {
+				g_array_free(cz_blocks(existing, &cdata->offset), TRUE);
+				fclose(existing);
+			}
+		}
+	} else {
+		cdata->index_path = g_strconcat(path, LOG_INDEX_SUFFIX, NULL);
+	}
+
+	if (writer_logs != NULL)
+		g_hash_table_insert(writer_logs, cdata->path, cdata);
+	return cdata;
+}
+
+static void
+cn_log_data_unref(ColorNicksLogData *cdata)
+{
+	if (!g_atomic_int_dec_and_test(&cdata->ref))
+		return;
+
+	if (cdata->index_file)
+		fclose(cdata->index_file);
+	g_mutex_clear(&cdata->io_lock);
+	g_string_free(cdata->pending, TRUE);
+	g_byte_array_free(cdata->pending_index, TRUE);
+	g_string_free(cdata->staged, TRUE);
+	g_byte_array_free(cdata->staged_index, TRUE);
+	if (cdata->block)
+		g_string_free(cdata->block, TRUE);
+	g_free(cdata->stamp);
+	g_free(cdata->index_path);
+	g_free(cdata->path);
+	g_slice_free(ColorNicksLogData, cdata);
+}
+
+/* Optional timing of each stage of a write, in histograms with eight
+ * buckets for each power of two of nanoseconds, like HdrHistogram with a
+ * precision of an eighth. Messages, bytes and images are also counted for
+ * each account. While it is off each stage costs one test of
+ * stats_enabled. */
+#define STATS_SUB_BUCKETS 8
+#define STATS_BUCKETS ((64 - 2) * STATS_SUB_BUCKETS)
+
+typedef enum {
+	STAGE_WRITE,       /* the whole of colornicks_logger_write() */
+	STAGE_OPEN,        /* opening a log and writing its header */
+	STAGE_COLOR,
+	STAGE_XHTML,
+	STAGE_IMAGES,
+	STAGE_TIMESTAMP,
+	STAGE_RENDER,
+	STAGE_QUEUE,       /* handing the line to the writer */
+	STAGE_SEARCH,
+	STAGE_FLUSH,       /* writing out a batch, on the writer thread */
+	STAGES
+} StatsStage;
+
+static const char * const stats_stage_names[STAGES] = {
+	"write", "open", "color", "xhtml", "images", "timestamp",
+	"render", "queue", "search", "flush"
+};
+
+typedef struct {
+	guint64 count;
+	guint64 sum;
+	guint64 max;
+	guint32 buckets[STATS_BUCKETS];
+} StatsHistogram;
+
+typedef struct {
+	char *name;           /* "account (protocol)", so dumps don't touch the account */
+	guint64 messages;
+	guint64 bytes;
+	guint64 images;
+} StatsAccount;
+
+static gboolean stats_enabled = FALSE;
+static GMutex stats_lock;                   /* protects stats_stages */
+static StatsHistogram stats_stages[STAGES];
+static GHashTable *stats_accounts = NULL;   /* PurpleAccount -> StatsAccount, main thread */
+
+static guint64
+stats_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return (guint64)g_get_monotonic_time() * 1000;
+#endif
+}
+
+/* The time to start a stage at, or 0 when timing is off */
+static guint64
+stats_clock(void)
+{
+	return stats_enabled ? stats_now() : 0;
+}
+
+static guint
+stats_bucket(guint64 ns)
+{
+	guint e;
+
+	if (ns < STATS_SUB_BUCKETS)
+		return ns;
+	e = g_bit_storage(ns) - 1;
+	return MIN((e - 2) * STATS_SUB_BUCKETS + ((ns >> (e - 3)) & (STATS_SUB_BUCKETS - 1)),
+	           STATS_BUCKETS - 1);
+}
+
+/* The smallest value that lands in a bucket */
+static guint64
+stats_bucket_value(guint bucket)
+{
+	if (bucket < STATS_SUB_BUCKETS)
+		return bucket;
+	return (guint64)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) <<
+		(bucket / STATS_SUB_BUCKETS - 1);
+}
+
+/* Records a stage that started at start, returning the time it ended at
+ * for the next stage to start from */
+static guint64
+stats_lap(StatsStage stage, guint64 start)
+{
+	StatsHistogram *histogram = &stats_stages[stage];
+	guint64 now, ns;
+
+	if (!stats_enabled || start == 0)
+		return 0;
+
+	now = stats_now();
+	ns = now - start;
+	g_mutex_lock(&stats_lock);
+	histogram->count++;
+	histogram->sum += ns;
+	histogram->max = MAX(histogram->max, ns);
+	histogram->buckets[stats_bucket(ns)]++;
+	g_mutex_unlock(&stats_lock);
+	return now;
+}
+
+static void
+stats_account_free(gpointer data)
+{
+	StatsAccount *counters = data;
+	g_free(counters->name);
+	g_free(counters);
+}
+
+static StatsAccount *
+stats_account(PurpleAccount *account)
+{
+	StatsAccount *counters = g_hash_table_lookup(stats_accounts, account);
+
+	if (counters == NULL) {
+		counters = g_new0(StatsAccount, 1);
+		counters->name = g_strdup_printf("%s (%s)", purple_account_get_username(account),
+		                                 purple_account_get_protocol_id(account));
+		g_hash_table_insert(stats_accounts, account, counters);
+	}
+	return counters;
+}
+
+/* In ns, from the buckets, so within an eighth. Called with stats_lock held. */
+static guint64
+stats_percentile(const StatsHistogram *histogram, double p)
+{
+	guint64 rank = (guint64)(histogram->count * p), seen = 0;
+	guint i;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank)
+			return MIN(stats_bucket_value(i + 1) - 1, histogram->max);
+	}
+	return histogram->max;
+}
+
+static void
+stats_reset(void)
+{
+	g_mutex_lock(&stats_lock);
+	memset(stats_stages, 0, sizeof(stats_stages));
+	g_mutex_unlock(&stats_lock);
+	if (stats_accounts != NULL)
+		g_hash_table_remove_all(stats_accounts);
+}
+
+static void
+stats_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	stats_enabled = GPOINTER_TO_INT(val);
+	stats_reset();
+}
+
+/* Appends s as a quoted JSON string. UTF-8 passes through as it is;
+ * g_strescape() would turn it into octal escapes, which JSON has none of. */
+static void
+stats_json_append_string(GString *out, const char *s)
+{
+	g_string_append_c(out, '"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			g_string_append_c(out, '\\');
+		if ((guchar)*s < 0x20)
+			g_string_append_printf(out, "\\u%04x", (guchar)*s);
+		else
+			g_string_append_c(out, *s);
+	}
+	g_string_append_c(out, '"');
+}
+
+/* Writes the statistics out as text, or as JSON for monitoring */
+static GString *
+stats_dump(gboolean json)
+{
+	GString *out = g_string_new(NULL);
+	GHashTableIter iter;
+	gpointer value;
+	const char *sep = "";
+	int stage;
+
+	g_string_append(out, json ? "{\"stages\":{" : _("Stage: count, mean, p50, p99, max (us)\n"));
+	g_mutex_lock(&stats_lock);
+	for (stage = 0; stage < STAGES; stage++) {
+		const StatsHistogram *histogram = &stats_stages[stage];
+		double mean = histogram->count ? histogram->sum / (double)histogram->count : 0;
+
+		if (json)
+			g_string_append_printf(out,
+				"%s\"%s\":{\"count\":%" G_GUINT64_FORMAT ",\"mean_ns\":%.0f,"
+				"\"p50_ns\":%" G_GUINT64_FORMAT ",\"p99_ns\":%" G_GUINT64_FORMAT ","
+				"\"max_ns\":%" G_GUINT64_FORMAT "}",
+				sep, stats_stage_names[stage], histogram->count, mean,
+				stats_percentile(histogram, 0.5), stats_percentile(histogram, 0.99),
+				histogram->max);
+		else
+			g_string_append_printf(out,
+				"%s: %" G_GUINT64_FORMAT ", %.1f, %.1f, %.1f, %.1f\n",
+				stats_stage_names[stage], histogram->count, mean / 1000,
+				stats_percentile(histogram, 0.5) / 1000.0,
+				stats_percentile(histogram, 0.99) / 1000.0, histogram->max / 1000.0);
+		sep = ",";
+	}
+	g_mutex_unlock(&stats_lock);
+
+	g_string_append(out, json ? "},\"accounts\":{" : _("\nAccount: messages, bytes, images\n"));
+	sep = "";
+	if (stats_accounts != NULL) {
+		g_hash_table_iter_init(&iter, stats_accounts);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			const StatsAccount *counters = value;
+
+			if (json) {
+				g_string_append(out, sep);
+				stats_json_append_string(out, counters->name);
+				g_string_append_printf(out,
+					":{\"messages\":%" G_GUINT64_FORMAT ",\"bytes\":%" G_GUINT64_FORMAT
+					",\"images\":%" G_GUINT64_FORMAT "}",
+					counters->messages, counters->bytes, counters->images);
+			} else {
+				g_string_append_printf(out,
+					"%s: %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT "\n",
+					counters->name, counters->messages, counters->bytes, counters->images);
+			}
+			sep = ",";
+		}
+	}
+	if (json)
+		g_string_append(out, "}}\n");
+
+	return out;
+}
+
+static void
+stats_action(PurplePluginAction *action)
+{
+	GString *out;
+	char *escaped;
+
+	if (!stats_enabled) {
+		purple_notify_info(action->plugin, _("Logging Statistics"), _("Logging statistics are off"),
+		                   _("Turn on \"Time each stage of logging\" in the plugin's settings."));
+		return;
+	}
+
+	out = stats_dump(FALSE);
+	purple_debug_info("colornicks", "Logging statistics:\n%s", out->str);
+	escaped = g_markup_escape_text(out->str, -1);
+	g_string_free(out, TRUE);
+	out = g_string_new("<pre>");
+	g_string_append(out, escaped);
+	g_string_append(out, "</pre>");
+	purple_notify_formatted(action->plugin, _("Logging Statistics"), _("Logging statistics"),
+	                        NULL, out->str, NULL, NULL);
+	g_string_free(out, TRUE);
+	g_free(escaped);
+}
+
+static void
+stats_export_action(PurplePluginAction *action)
+{
+	char *path = g_build_filename(purple_user_dir(), "colornicks", "stats.json", NULL);
+	char *dir = g_path_get_dirname(path);
+	GString *out = stats_dump(TRUE);
+	GError *error = NULL;
+
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	if (g_file_set_contents(path, out->str, out->len, &error)) {
+		purple_notify_info(action->plugin, _("Logging Statistics"),
+		                   _("Logging statistics exported"), path);
+	} else {
+		purple_notify_error(action->plugin, _("Logging Statistics"),
+		                    _("Unable to export logging statistics"), error->message);
+		g_error_free(error);
+	}
+	g_string_free(out, TRUE);
+	g_free(dir);
+	g_free(path);
+}
+
+/* Journal mode: each batch is appended to a journal, which is synced to
+ * disk once for all the logs in the batch before they are written to. If
+ * we crash, the journal is replayed at load, rewriting every log it holds
+ * from the offset it picks the log up at, so no log is left torn. Records
+ * are [type][BE u32 log id][BE u32 length][BE u32 Adler-32 of payload]
+ * [payload]. 'O' opens a log, with the offset and the path as payload, 'D'
+ * holds data for it and 'C' marks it closed and synced. Once the journal
+ * passes JOURNAL_CHECKPOINT the journaled logs are synced and it starts
+ * over. Compressed logs have no byte offsets to replay at, so they are
+ * not journaled. */
+#define JOURNAL_CHECKPOINT (4 * 1024 * 1024)
+#define JOURNAL_RECORD_HEADER 13
+
+static GMutex journal_lock;           /* protects all below, taken after io_lock */
+static FILE *journal_file = NULL;
+static gsize journal_size = 0;
+static gboolean journal_dirty = FALSE;  /* written since the last sync */
+static guint journal_next_id = 1;
+static GHashTable *journal_logs = NULL; /* id -> ColorNicksLogData, holding a reference */
+
+static int
+sync_fd(int fd)
+{
+#if defined(_WIN32)
+	return _commit(fd);
+#elif defined(__linux__)
+	return fdatasync(fd);
+#else
+	return fsync(fd);
+#endif
+}
+
+static gboolean
+sync_path(const char *path)
+{
+	int fd = g_open(path, O_WRONLY, 0);
+	gboolean ok;
+
+	if (fd < 0)
+		return FALSE;
+	ok = sync_fd(fd) == 0;
+	close(fd);
+	return ok;
+}
+
+static char *
+journal_path(void)
+{
+	return g_build_filename(purple_user_dir(), "colornicks", "journal", NULL);
+}
+
+static guint32
+journal_checksum(const guint8 *data, gsize len)
+{
+	guint32 a = 1, b = 0;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+static void
+journal_write_record(char type, guint id, const char *payload, gsize len)
+{
+	guint8 header[JOURNAL_RECORD_HEADER];
+	guint32 be;
+
+	header[0] = type;
+	be = GUINT32_TO_BE(id);
+	memcpy(header + 1, &be, 4);
+	be = GUINT32_TO_BE(len);
+	memcpy(header + 5, &be, 4);
+	be = GUINT32_TO_BE(journal_checksum((const guint8 *)payload, len));
+	memcpy(header + 9, &be, 4);
+
+	if (fwrite(header, sizeof(header), 1, journal_file) != 1 ||
+	    (len > 0 && fwrite(payload, len, 1, journal_file) != 1))
+		report_error("Error writing journal: %s\n", g_strerror(errno));
+	journal_size += sizeof(header) + len;
+	journal_dirty = TRUE;
+}
+
+static void
+journal_open_record(ColorNicksLogData *cdata, guint64 offset)
+{
+	GString *payload = g_string_sized_new(8 + strlen(cdata->path));
+	guint64 be = GUINT64_TO_BE(offset);
+
+	g_string_append_len(payload, (const char *)&be, 8);
+	g_string_append(payload, cdata->path);
+	journal_write_record('O', cdata->journal_id, payload->str, payload->len);
+	g_string_free(payload, TRUE);
+}
+
+/* Journals data about to be staged for a log. Called with io_lock held. */
+static void
+journal_append(ColorNicksLogData *cdata, const char *data, gsize len)
+{
+	g_mutex_lock(&journal_lock);
+	if (journal_file != NULL && !cdata->compressed) {
+		if (cdata->journal_id == 0) {
+			GStatBuf st;
+
+			/* The journal picks up after what was staged before it */
+			cdata->journal_id = journal_next_id++;
+			g_atomic_int_inc(&cdata->ref);
+			g_hash_table_insert(journal_logs, GUINT_TO_POINTER(cdata->journal_id), cdata);
+			journal_open_record(cdata, (g_stat(cdata->path, &st) == 0 ? st.st_size : 0) +
+			                           cdata->staged->len);
+		}
+		journal_write_record('D', cdata->journal_id, data, len);
+	}
+	g_mutex_unlock(&journal_lock);
+}
+
+static void
+journal_sync(void)
+{
+	g_mutex_lock(&journal_lock);
+	if (journal_file != NULL && journal_dirty) {
+		if (fflush(journal_file) != 0 || sync_fd(fileno(journal_file)) != 0)
+			report_error("Error syncing journal: %s\n", g_strerror(errno));
+		journal_dirty = FALSE;
+	}
+	g_mutex_unlock(&journal_lock);
+}
+
+/* Called once a journaled log has been closed, so replay leaves it alone */
+static void
+journal_log_closed(ColorNicksLogData *cdata)
+{
+	g_mutex_lock(&journal_lock);
+	if (cdata->journal_id != 0 && journal_file != NULL) {
+		sync_path(cdata->path);
+		journal_write_record('C', cdata->journal_id, NULL, 0);
+		g_hash_table_remove(journal_logs, GUINT_TO_POINTER(cdata->journal_id));
+		cdata->journal_id = 0;
+	}
+	g_mutex_unlock(&journal_lock);
+}
+
+/* Starts the journal over once it has grown too big. The journaled logs
+ * must all be written out and are synced first; if any of them is busy,
+ * it is tried again after the next batch. */
+static void
+journal_checkpoint(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GPtrArray *locked;
+	gboolean ready = TRUE;
+	guint i;
+
+	g_mutex_lock(&journal_lock);
+	if (journal_file == NULL || journal_size < JOURNAL_CHECKPOINT) {
+		g_mutex_unlock(&journal_lock);
+		return;
+	}
+
+	/* io_lock is taken before journal_lock elsewhere, so only try it */
+	locked = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, journal_logs);
+	while (ready && g_hash_table_iter_next(&iter, NULL, &value)) {
+		ColorNicksLogData *cdata = value;
+
+		if (!g_mutex_trylock(&cdata->io_lock)) {
+			ready = FALSE;
+			break;
+		}
+		g_ptr_array_add(locked, cdata);
+		ready = cdata->staged->len == 0 && sync_path(cdata->path);
+	}
+
+	if (ready) {
+		char *path = journal_path();
+
+		fclose(journal_file);
+		journal_file = g_fopen(path, "wb");
+		journal_size = 0;
+		if (journal_file == NULL) {
+			report_error("Unable to reopen journal %s: %s\n",
+			             path, g_strerror(errno));
+			for (i = 0; i < locked->len; i++)
+				((ColorNicksLogData *)g_ptr_array_index(locked, i))->journal_id = 0;
+			g_hash_table_remove_all(journal_logs);
+		} else {
+			for (i = 0; i < locked->len; i++) {
+				ColorNicksLogData *cdata = g_ptr_array_index(locked, i);
+				GStatBuf st;
+				journal_open_record(cdata, g_stat(cdata->path, &st) == 0 ? st.st_size : 0);
+			}
+			journal_dirty = TRUE;
+		}
+		g_free(path);
+	}
+
+	for (i = 0; i < locked->len; i++)
+		g_mutex_unlock(&((ColorNicksLogData *)g_ptr_array_index(locked, i))->io_lock);
+	g_ptr_array_free(locked, TRUE);
+	g_mutex_unlock(&journal_lock);
+
+	journal_sync();
+}
+
+static void
+journal_start(void)
+{
+	char *path = journal_path();
+	char *dir = g_path_get_dirname(path);
+
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	g_mutex_lock(&journal_lock);
+	if (journal_file == NULL) {
+		journal_file = g_fopen(path, "wb");
+		if (journal_file == NULL)
+			purple_debug_error("colornicks", "Unable to create journal %s: %s\n",
+			                   path, g_strerror(errno));
+		journal_size = 0;
+		journal_logs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+		                                     (GDestroyNotify)cn_log_data_unref);
+	}
+	g_mutex_unlock(&journal_lock);
+
+	g_free(dir);
+	g_free(path);
+}
+
+/* Puts back what the journal holds for a log that was not closed */
+static void
+journal_replay_log(const char *path, guint64 offset, const GString *data)
+{
+	int fd = g_open(path, O_WRONLY, 0);
+	GStatBuf st;
+	gsize done = 0;
+
+	if (fd < 0 || fstat(fd, &st) != 0 || (guint64)st.st_size < offset) {
+		purple_debug_error("colornicks", "Unable to replay journal into %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	if (ftruncate(fd, (off_t)offset) != 0 || lseek(fd, (off_t)offset, SEEK_SET) < 0)
+		done = data->len + 1;
+	while (done < data->len) {
+		gssize n = write(fd, data->str + done, data->len - done);
+		if (n <= 0) {
+			done = data->len + 1;
+			break;
+		}
+		done += n;
+	}
+
+	if (done != data->len || sync_fd(fd) != 0)
+		purple_debug_error("colornicks", "Error replaying journal into %s: %s\n",
+		                   path, g_strerror(errno));
+	else
+		purple_debug_info("colornicks", "Replayed %" G_GSIZE_FORMAT " bytes into %s\n",
+		                  data->len, path);
+	close(fd);
+}
+
+typedef struct {
+	char *path;
+	guint64 offset;
+	GString *data;
+	gboolean closed;
+} JournalReplay;
+
+static void
+journal_replay_free(gpointer data)
+{
+	JournalReplay *replay = data;
+
+	g_free(replay->path);
+	g_string_free(replay->data, TRUE);
+	g_free(replay);
+}
+
+/* Replays a journal left behind by a crash. A torn record at the end is
+ * where the crash happened and everything from it on is dropped. */
+static void
+journal_replay(void)
+{
+	char *path = journal_path();
+	GHashTable *logs;
+	GHashTableIter iter;
+	gpointer value;
+	gchar *contents;
+	gsize len, pos = 0;
+
+	if (!g_file_get_contents(path, &contents, &len, NULL)) {
+		g_free(path);
+		return;
+	}
+
+	logs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, journal_replay_free);
+	while (pos + JOURNAL_RECORD_HEADER <= len) {
+		const guint8 *header = (const guint8 *)contents + pos;
+		const char *payload = contents + pos + JOURNAL_RECORD_HEADER;
+		guint32 id, plen, sum;
+		JournalReplay *replay;
+
+		memcpy(&id, header + 1, 4);
+		memcpy(&plen, header + 5, 4);
+		memcpy(&sum, header + 9, 4);
+		id = GUINT32_FROM_BE(id);
+		plen = GUINT32_FROM_BE(plen);
+		if (plen > len - pos - JOURNAL_RECORD_HEADER ||
+		    GUINT32_FROM_BE(sum) != journal_checksum((const guint8 *)payload, plen))
+			break;
+
+		replay = g_hash_table_lookup(logs, GUINT_TO_POINTER(id));
+		if (header[0] == 'O' && plen > 8) {
+			guint64 offset;
+
+			memcpy(&offset, payload, 8);
+			replay = g_new0(JournalReplay, 1);
+			replay->path = g_strndup(payload + 8, plen - 8);
+			replay->offset = GUINT64_FROM_BE(offset);
+			replay->data = g_string_new(NULL);
+			g_hash_table_replace(logs, GUINT_TO_POINTER(id), replay);
+		} else if (header[0] == 'D' && replay != NULL) {
+			g_string_append_len(replay->data, payload, plen);
+		} else if (header[0] == 'C' && replay != NULL) {
+			replay->closed = TRUE;
+		}
+
+		pos += JOURNAL_RECORD_HEADER + plen;
+	}
+
+	g_hash_table_iter_init(&iter, logs);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		JournalReplay *replay = value;
+		if (!replay->closed && replay->data->len > 0)
+			journal_replay_log(replay->path, replay->offset, replay->data);
+	}
+
+	g_hash_table_destroy(logs);
+	g_free(contents);
+	g_unlink(path);
+	g_free(path);
+}
+
+/* Moves what is pending for this log to its staged buffers, journaling it
+ * on the way when the journal is on. Called from both threads. */
+static void
+writer_stage(ColorNicksLogData *cdata)
+{
+	GString *buf;
+	GByteArray *index;
+	gboolean was_dirty;
+
+	g_mutex_lock(&cdata->io_lock);
+
+	g_mutex_lock(&writer_lock);
+	buf = cdata->pending;
+	cdata->pending = g_string_sized_new(buf->len);
+	index = cdata->pending_index;
+	cdata->pending_index = g_byte_array_new();
+	writer_pending_bytes -= buf->len;
+	was_dirty = cdata->dirty;
+	if (was_dirty) {
+		g_queue_remove(&writer_dirty, cdata);
+		cdata->dirty = FALSE;
+	}
+	g_mutex_unlock(&writer_lock);
+
+	if (buf->len > 0)
+		journal_append(cdata, buf->str, buf->len);
+
+	if (cdata->staged->len == 0) {
+		GString *tmp = cdata->staged;
+		cdata->staged = buf;
+		buf = tmp;
+	} else {
+		g_string_append_len(cdata->staged, buf->str, buf->len);
+	}
+	g_byte_array_append(cdata->staged_index, index->data, index->len);
+
+	g_mutex_unlock(&cdata->io_lock);
+	g_string_free(buf, TRUE);
+	g_byte_array_free(index, TRUE);
+
+	/* Drop the reference held by writer_dirty */
+	if (was_dirty)
+		cn_log_data_unref(cdata);
+}
+
+/* Writes what is staged for this log to its file. io_lock is held across
+ * the write so batches stay ordered. Compressed logs hold data back for a
+ * full block unless seal is set, which writes a short block so that no
+ * more than a flush interval of messages is only in memory. */
+static void
+writer_materialize(ColorNicksLogData *cdata, gboolean seal)
+{
+	GString *buf;
+	GByteArray *index;
+
+	g_mutex_lock(&cdata->io_lock);
+	buf = cdata->staged;
+	index = cdata->staged_index;
+
+	if (cdata->compressed && cdata->file != NULL) {
+		g_string_append_len(cdata->block, buf->str, buf->len);
+		if (cdata->block->len >= CZ_BLOCK_SIZE ||
+		    (seal && cdata->block->len > 0)) {
+			if (!cz_write_block(cdata->file, cdata->block->str, cdata->block->len))
+				report_error("Error writing log: %s\n", g_strerror(errno));
+			g_string_truncate(cdata->block, 0);
+		}
+	} else if (buf->len > 0 && cdata->file != NULL) {
+		if (fwrite(buf->str, buf->len, 1, cdata->file) != 1 ||
+		    fflush(cdata->file) != 0)
+			report_error("Error writing log: %s\n", g_strerror(errno));
+	}
+
+	/* The index goes out after the messages it points at */
+	if (index->len > 0 && cdata->index_path != NULL) {
+		if (cdata->index_file == NULL)
+			cdata->index_file = g_fopen(cdata->index_path, "ab");
+		if (cdata->index_file == NULL ||
+		    fwrite(index->data, index->len, 1, cdata->index_file) != 1 ||
+		    fflush(cdata->index_file) != 0)
+			report_error("Error writing %s: %s\n",
+			             cdata->index_path, g_strerror(errno));
+	}
+
+	g_string_truncate(buf, 0);
+	g_byte_array_set_size(index, 0);
+	g_mutex_unlock(&cdata->io_lock);
+}
+
+/* Writes out everything pending for this log. Called from both threads. */
+static void
+writer_drain(ColorNicksLogData *cdata, gboolean seal)
+{
+	writer_stage(cdata);
+	journal_sync();
+	writer_materialize(cdata, seal);
+}
+
+/* Drains the log being written to path, if any. */
+static gboolean
+writer_drain_path(const char *path)
+{
+	ColorNicksLogData *cdata;
+
+	if (writer_logs == NULL ||
+	    (cdata = g_hash_table_lookup(writer_logs, path)) == NULL)
+		return FALSE;
+
+	writer_drain(cdata, FALSE);
+	return TRUE;
+}
+
+/* Reads a compressed log like cz_read(), adding what the writer holds back
+ * for the next block when the log is being written. Main thread only. */
+static GString *
+cz_log_read(const char *path, guint64 start, guint64 end, guint64 *base, guint64 *len)
+{
+	ColorNicksLogData *cdata = NULL;
+	GString *out;
+	guint64 total;
+
+	if (writer_logs != NULL && (cdata = g_hash_table_lookup(writer_logs, path)) != NULL)
+		writer_drain(cdata, FALSE);
+
+	out = cz_read(path, start, end, base, &total);
+	if (out != NULL && cdata != NULL && cdata->compressed && end > total) {
+		g_mutex_lock(&cdata->io_lock);
+		g_string_append_len(out, cdata->block->str, cdata->block->len);
+		total += cdata->block->len;
+		g_mutex_unlock(&cdata->io_lock);
+	}
+
+	if (len)
+		*len = total;
+	return out;
+}
+
+/* Writes out every log with something pending, sealing compressed blocks.
+ * This is what runs when the flush interval elapses. */
+static void
+writer_flush_all(void)
+{
+	GPtrArray *staged = g_ptr_array_new();
+	guint64 start = stats_clock();
+	guint i;
+
+	for (;;) {
+		ColorNicksLogData *cdata;
+
+		g_mutex_lock(&writer_lock);
+		cdata = g_queue_peek_head(&writer_dirty);
+		if (cdata != NULL)
+			g_atomic_int_inc(&cdata->ref);
+		g_mutex_unlock(&writer_lock);
+
+		if (cdata == NULL)
+			break;
+
+		writer_stage(cdata);
+		g_ptr_array_add(staged, cdata);
+	}
+
+	/* One journal sync covers the whole batch */
+	journal_sync();
+
+	for (i = 0; i < staged->len; i++) {
+		ColorNicksLogData *cdata = g_ptr_array_index(staged, i);
+		writer_materialize(cdata, TRUE);
+		cn_log_data_unref(cdata);
+	}
+	/* Only batches that wrote something are timed */
+	if (staged->len > 0)
+		stats_lap(STAGE_FLUSH, start);
+	g_ptr_array_free(staged, TRUE);
+
+	journal_checkpoint();
+}
+
+/* Writes everything out, syncs the journaled logs and drops the journal */
+static void
+journal_stop(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	writer_flush_all();
+
+	g_mutex_lock(&journal_lock);
+	if (journal_logs != NULL) {
+		g_hash_table_iter_init(&iter, journal_logs);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			ColorNicksLogData *cdata = value;
+			sync_path(cdata->path);
+			cdata->journal_id = 0;
+		}
+		g_hash_table_destroy(journal_logs);
+		journal_logs = NULL;
+	}
+	if (journal_file != NULL) {
+		char *path = journal_path();
+		fclose(journal_file);
+		journal_file = NULL;
+		g_unlink(path);
+		g_free(path);
+	}
+	g_mutex_unlock(&journal_lock);
+}
+
+static void
+journal_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	if (GPOINTER_TO_INT(val))
+		journal_start();
+	else
+		journal_stop();
+}
+
+static gpointer
+writer_thread_func(gpointer unused)
+{
+	g_mutex_lock(&writer_lock);
+	while (writer_running) {
+		gint64 deadline;
+
+		if (g_queue_is_empty(&writer_dirty)) {
+			g_cond_wait(&writer_cond, &writer_lock);
+			continue;
+		}
+
+		/* Give the batch until the end of the durability window to fill up */
+		deadline = g_get_monotonic_time() + flush_interval * G_TIME_SPAN_MILLISECOND;
+		while (writer_running && writer_pending_bytes < (gsize)flush_threshold)
+			if (!g_cond_wait_until(&writer_cond, &writer_lock, deadline))
+				break;
+
+		g_mutex_unlock(&writer_lock);
+		writer_flush_all();
+		search_index_flush();
+		g_mutex_lock(&writer_lock);
+	}
+	g_mutex_unlock(&writer_lock);
+
+	writer_flush_all();
+	search_index_flush();
+	return NULL;
+}
+
+static void
+log_index_entry_pack(guint8 *rec, guint64 offset, gint64 when)
+{
+	guint64 be_offset = GUINT64_TO_BE(offset);
+	gint64 be_time = GINT64_TO_BE(when);
+
+	memcpy(rec, &be_offset, 8);
+	memcpy(rec + 8, &be_time, 8);
+}
+
+/* Queues str for writing. The message in it starts msg_start bytes in
+ * (after the header, for the first one) and is indexed at time when.
+ * Returns the offset of the message in the log. */
+static guint64
+writer_append(ColorNicksLogData *cdata, const char *str, gsize len,
+              gsize msg_start, time_t when)
+{
+	gboolean sync;
+	guint8 rec[LOG_INDEX_RECORD_SIZE];
+	guint64 offset;
+
+	g_mutex_lock(&writer_lock);
+	offset = cdata->offset + msg_start;
+	if (cdata->index_path != NULL) {
+		log_index_entry_pack(rec, offset, when);
+		g_byte_array_append(cdata->pending_index, rec, sizeof(rec));
+	}
+	g_string_append_len(cdata->pending, str, len);
+	cdata->offset += len;
+	writer_pending_bytes += len;
+	if (!cdata->dirty) {
+		g_atomic_int_inc(&cdata->ref);
+		g_queue_push_tail(&writer_dirty, cdata);
+		cdata->dirty = TRUE;
+		g_cond_signal(&writer_cond);
+	} else if (writer_pending_bytes >= (gsize)flush_threshold) {
+		g_cond_signal(&writer_cond);
+	}
+	sync = !writer_running || flush_interval <= 0;
+	g_mutex_unlock(&writer_lock);
+
+	/* Written synchronously, so each message is sealed at once */
+	if (sync)
+		writer_drain(cdata, TRUE);
+
+	return offset;
+}
+
+/* Open log files, most recently written first. Logs that fall off the end
+ * are closed and reopened for appending when they are next written, so
+ * hundreds of idle logs don't each hold a descriptor and a stdio buffer.
+ * Main thread only. */
+static GQueue file_pool = G_QUEUE_INIT;
+static guint file_pool_hits = 0;
+static guint file_pool_misses = 0;
+static guint file_pool_evictions = 0;
+
+static void
+file_pool_evict(ColorNicksLogData *cdata)
+{
+	/* Nothing can be queued for it afterwards until it is reopened, and a
+	 * partial block must not wait in memory for that */
+	writer_drain(cdata, TRUE);
+
+	g_mutex_lock(&cdata->io_lock);
+	fclose(cdata->file);
+	cdata->file = NULL;
+	if (cdata->index_file != NULL) {
+		fclose(cdata->index_file);
+		cdata->index_file = NULL;
+	}
+	g_mutex_unlock(&cdata->io_lock);
+
+	if (cdata->log_data != NULL)
+		cdata->log_data->file = NULL;
+	g_queue_delete_link(&file_pool, cdata->pool_link);
+	cdata->pool_link = NULL;
+	file_pool_evictions++;
+}
+
+static void
+file_pool_trim(void)
+{
+	while (file_pool.length > (guint)MAX(max_open_logs, 1))
+		file_pool_evict(g_queue_peek_tail(&file_pool));
+}
+
+/* Makes sure the file of a log is open, reopening it if the pool closed
+ * it, and marks it as the most recently used. */
+static gboolean
+file_pool_acquire(ColorNicksLogData *cdata)
+{
+	if (cdata->pool_link != NULL) {
+		file_pool_hits++;
+		g_queue_unlink(&file_pool, cdata->pool_link);
+		g_queue_push_head_link(&file_pool, cdata->pool_link);
+		return TRUE;
+	}
+
+	if (cdata->file == NULL) {
+		/* Compressed blocks must not have their newlines translated */
+		FILE *file = g_fopen(cdata->path, cdata->compressed ? "ab" : "a");
+
+		if (file == NULL) {
+			purple_debug_error("colornicks", "Unable to reopen %s: %s\n",
+			                   cdata->path, g_strerror(errno));
+			return FALSE;
+		}
+		file_pool_misses++;
+
+		g_mutex_lock(&cdata->io_lock);
+		cdata->file = file;
+		g_mutex_unlock(&cdata->io_lock);
+		if (cdata->log_data != NULL)
+			cdata->log_data->file = file;
+	}
+
+	g_queue_push_head(&file_pool, cdata);
+	cdata->pool_link = file_pool.head;
+	file_pool_trim();
+	return TRUE;
+}
+
+static void
+file_pool_remove(ColorNicksLogData *cdata)
+{
+	if (cdata->pool_link == NULL)
+		return;
+	g_queue_delete_link(&file_pool, cdata->pool_link);
+	cdata->pool_link = NULL;
+}
+
+static void
+max_open_logs_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	max_open_logs = GPOINTER_TO_INT(val);
+	file_pool_trim();
+}
+
+static void
+file_pool_stats_action(PurplePluginAction *action)
+{
+	char *msg = g_strdup_printf(_("Open logs: %u of at most %d\n"
+	                              "Hits: %u\nMisses (reopened): %u\nEvictions: %u"),
+	                            file_pool.length, max_open_logs,
+	                            file_pool_hits, file_pool_misses, file_pool_evictions);
+
+	purple_notify_info(action->plugin, _("Open Log Files"), _("Open log file statistics"), msg);
+	g_free(msg);
+}
+
+static void
+writer_start(void)
+{
+	flush_interval = purple_prefs_get_int("/plugins/gtk/colornicks_logger/flush_interval");
+	flush_threshold = purple_prefs_get_int("/plugins/gtk/colornicks_logger/flush_threshold");
+	max_open_logs = purple_prefs_get_int("/plugins/gtk/colornicks_logger/max_open_logs");
+
+	writer_logs = g_hash_table_new(g_str_hash, g_str_equal);
+	writer_running = TRUE;
+	writer_thread = g_thread_new("colornicks-writer", writer_thread_func, NULL);
+}
+
+static void
+writer_stop(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_mutex_lock(&writer_lock);
+	writer_running = FALSE;
+	g_cond_signal(&writer_cond);
+	g_mutex_unlock(&writer_lock);
+
+	/* The thread drains all logs before exiting */
+	g_thread_join(writer_thread);
+	writer_thread = NULL;
+
+	/* Compressed logs left open may hold back a partial block from a read */
+	g_hash_table_iter_init(&iter, writer_logs);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		ColorNicksLogData *cdata = value;
+		if (!cdata->compressed || cdata->block->len == 0 || !file_pool_acquire(cdata))
+			continue;
+		writer_drain(cdata, TRUE);
+	}
+
+	g_hash_table_destroy(writer_logs);
+	writer_logs = NULL;
+
+	while (!g_queue_is_empty(&file_pool))
+		file_pool_remove(g_queue_peek_head(&file_pool));
+}
+
+static void
+flush_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	g_mutex_lock(&writer_lock);
+	if (g_str_has_suffix(name, "/flush_interval"))
+		flush_interval = GPOINTER_TO_INT(val);
+	else
+		flush_threshold = GPOINTER_TO_INT(val);
+	g_cond_signal(&writer_cond);
+	g_mutex_unlock(&writer_lock);
+}
+
+/* Nick colors scaled for the current theme, kept on the conversation's
+ * webview so they go away with it. */
+typedef struct {
+	GArray *source;      /* gtkconv->nick_colors the palette was built from */
+	char **palette;      /* "#rrggbb", one for each entry in source */
+	guint len;
+	gulong style_handler;
+	GtkWidget *webview;
+} NickColorCache;
+
+static void
+nick_color_cache_clear(NickColorCache *cache)
+{
+	g_strfreev(cache->palette);
+	cache->palette = NULL;
+	cache->source = NULL;
+	cache->len = 0;
+}
+
+static void
+nick_color_cache_free(gpointer data)
+{
+	NickColorCache *cache = data;
+	if (g_signal_handler_is_connected(cache->webview, cache->style_handler))
+		g_signal_handler_disconnect(cache->webview, cache->style_handler);
+	nick_color_cache_clear(cache);
+	g_slice_free(NickColorCache, cache);
+}
+
+/* GTK+ 3 renamed "style-set" and dropped its previous-style argument */
+#if GTK_CHECK_VERSION(3,0,0)
+#define NICK_COLOR_STYLE_SIGNAL "style-updated"
+
+static void
+nick_color_style_cb(GtkWidget *webview, NickColorCache *cache)
+{
+	nick_color_cache_clear(cache);
+}
+#else
+#define NICK_COLOR_STYLE_SIGNAL "style-set"
+
+static void
+nick_color_style_cb(GtkWidget *webview, GtkStyle *previous, NickColorCache *cache)
+{
+	nick_color_cache_clear(cache);
+}
+#endif
+
+static void
+nick_color_cache_build(NickColorCache *cache, PidginConversation *gtkconv)
+{
+	GtkStyle *style = gtk_widget_get_style(gtkconv->webview);
+	float base = 1 - (LUMINANCE(style->base[GTK_STATE_NORMAL]) / LUMINANCE(style->white));
+	float white = LUMINANCE(style->white);
+	guint i;
+
+	nick_color_cache_clear(cache);
+	cache->source = gtkconv->nick_colors;
+	cache->len = gtkconv->nick_colors->len;
+	cache->palette = g_new0(char *, cache->len + 1);
+
+	for (i = 0; i < cache->len; i++) {
+		GdkColor col = g_array_index(gtkconv->nick_colors, GdkColor, i);
+		float scale = base * (white / MAX(MAX(col.red, col.blue), col.green));
+
+		/* The colors are chosen to look fine on white; we should never have to darken */
+		if (scale > 1) {
+			col.red   *= scale;
+			col.green *= scale;
+			col.blue  *= scale;
+		}
+
+		cache->palette[i] = g_strdup_printf("#%02x%02x%02x",
+		                                    (col.red >> 8), (col.green >> 8), (col.blue >> 8));
+	}
+}
+
+/* Returns a string owned by the conversation; do not free it. */
+static const char *
+get_nick_color(PidginConversation *gtkconv, const char *name)
+{
+	NickColorCache *cache;
+
+	if (gtkconv == NULL)
+		return NULL;
+	g_return_val_if_fail(name != NULL && gtkconv->nick_colors != NULL, NULL);
+
+	cache = g_object_get_data(G_OBJECT(gtkconv->webview), "colornicks-nick-colors");
+	if (cache == NULL) {
+		cache = g_slice_new0(NickColorCache);
+		cache->webview = gtkconv->webview;
+		cache->style_handler = g_signal_connect(G_OBJECT(gtkconv->webview),
+		                                        NICK_COLOR_STYLE_SIGNAL,
+		                                        G_CALLBACK(nick_color_style_cb), cache);
+		g_object_set_data_full(G_OBJECT(gtkconv->webview), "colornicks-nick-colors",
+		                       cache, nick_color_cache_free);
+	}
+
+	/* A new conversation theme replaces the nick color array */
+	if (cache->palette == NULL || cache->source != gtkconv->nick_colors ||
+	    cache->len != gtkconv->nick_colors->len)
+		nick_color_cache_build(cache, gtkconv);
+
+	if (cache->len == 0)
+		return NULL;
+
+	return cache->palette[g_str_hash(name) % cache->len];
+}
+
+/* Optional append-only store for inline images, one per log directory, used
+ * instead of a separate file per image. Records are laid out as
+ * [name length][data length][name][data], with lengths as big-endian
+ * guint32s. Appends are done on image_pack_pool's thread; the index and the
+ * end offset belong to the main thread. Images still waiting to be written
+ * are read from their queued jobs. */
+#define IMAGE_PACK_NAME "colornicks-images.pack"
+#define IMAGE_PACK_RECORD_HEADER (2 * sizeof(guint32))
+
+typedef struct {
+	long offset;           /* of the image data */
+	gsize size;
+} ImagePackEntry;
+
+typedef struct {
+	char *path;
+	GHashTable *entries;   /* image filename -> ImagePackEntry */
+	long end;              /* where the next record goes */
+	GMutex lock;
+	GHashTable *queued;    /* image filename -> ImagePackJob, protected by lock */
+	long committed;        /* protected by lock */
+	FILE *file;            /* pack thread only */
+} ImagePack;
+
+typedef struct {
+	ImagePack *pack;
+	long offset;           /* of the record */
+	char *name;
+	gpointer data;
+	gsize size;
+} ImagePackJob;
+
+static gboolean use_image_pack = FALSE;
+static GHashTable *image_packs = NULL;      /* log dir -> ImagePack */
+static GThreadPool *image_pack_pool = NULL;
+
+static void
+image_pack_free(gpointer data)
+{
+	ImagePack *pack = data;
+
+	if (pack->file)
+		fclose(pack->file);
+	g_hash_table_destroy(pack->entries);
+	g_hash_table_destroy(pack->queued);
+	g_mutex_clear(&pack->lock);
+	g_free(pack->path);
+	g_slice_free(ImagePack, pack);
+}
+
+/* Builds the index from the records in an existing pack. A truncated record
+ * at the end (from a crash) is ignored and will be overwritten. */
+static void
+image_pack_load(ImagePack *pack)
+{
+	GStatBuf st;
+	FILE *file;
+	long pos = 0;
+
+	if (g_stat(pack->path, &st) != 0 || (file = g_fopen(pack->path, "rb")) == NULL)
+		return;
+
+	for (;;) {
+		guint32 lens[2];
+		gsize name_len, data_len;
+		ImagePackEntry *entry;
+		char *name;
+
+		if (fread(lens, sizeof(lens), 1, file) != 1)
+			break;
+
+		name_len = GUINT32_FROM_BE(lens[0]);
+		data_len = GUINT32_FROM_BE(lens[1]);
+		if (name_len == 0 || name_len > 255 ||
+		    pos + IMAGE_PACK_RECORD_HEADER + name_len + data_len > (gsize)st.st_size)
+			break;
+
+		name = g_malloc(name_len + 1);
+		if (fread(name, name_len, 1, file) != 1) {
+			g_free(name);
+			break;
+		}
+		name[name_len] = '\0';
+
+		entry = g_slice_new(ImagePackEntry);
+		entry->offset = pos + IMAGE_PACK_RECORD_HEADER + name_len;
+		entry->size = data_len;
+		g_hash_table_replace(pack->entries, name, entry);
+
+		pos = entry->offset + data_len;
+		if (fseek(file, pos, SEEK_SET) != 0)
+			break;
+	}
+	fclose(file);
+
+	pack->end = pack->committed = pos;
+}
+
+static void
+image_pack_entry_free(gpointer data)
+{
+	g_slice_free(ImagePackEntry, data);
+}
+
+/* Returns the pack for a log directory. Unless create is set, NULL is
+ * returned for directories that do not have one. */
+static ImagePack *
+image_pack_get(const char *dir, gboolean create)
+{
+	ImagePack *pack = g_hash_table_lookup(image_packs, dir);
+	char *path;
+
+	if (pack != NULL)
+		return pack;
+
+	path = g_build_filename(dir, IMAGE_PACK_NAME, NULL);
+	if (!create && !g_file_test(path, G_FILE_TEST_EXISTS)) {
+		g_free(path);
+		return NULL;
+	}
+
+	pack = g_slice_new0(ImagePack);
+	pack->path = path;
+	pack->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                      g_free, image_pack_entry_free);
+	pack->queued = g_hash_table_new(g_str_hash, g_str_equal);
+	g_mutex_init(&pack->lock);
+	image_pack_load(pack);
+
+	g_hash_table_insert(image_packs, g_strdup(dir), pack);
+	return pack;
+}
+
+static void
+image_pack_write_job(gpointer data, gpointer user_data)
+{
+	ImagePackJob *job = data;
+	ImagePack *pack = job->pack;
+	gsize name_len = strlen(job->name);
+	guint32 lens[2];
+	gboolean ok = FALSE;
+
+	lens[0] = GUINT32_TO_BE(name_len);
+	lens[1] = GUINT32_TO_BE(job->size);
+
+	if (pack->file == NULL) {
+		pack->file = g_fopen(pack->path, "r+b");
+		if (pack->file == NULL && errno == ENOENT)
+			pack->file = g_fopen(pack->path, "w+b");
+	}
+
+	if (pack->file == NULL) {
+		report_error("Unable to open %s: %s\n", pack->path, g_strerror(errno));
+	} else if (fseek(pack->file, job->offset, SEEK_SET) != 0 ||
+	           fwrite(lens, sizeof(lens), 1, pack->file) != 1 ||
+	           fwrite(job->name, name_len, 1, pack->file) != 1 ||
+	           fwrite(job->data, job->size, 1, pack->file) != 1 ||
+	           fflush(pack->file) != 0) {
+		report_error("Error writing %s: %s\n", pack->path, g_strerror(errno));
+	} else {
+		ok = TRUE;
+	}
+
+	/* Don't sit on a descriptor for every log directory */
+	if (pack->file != NULL && g_thread_pool_unprocessed(image_pack_pool) == 0) {
+		fclose(pack->file);
+		pack->file = NULL;
+	}
+
+	g_mutex_lock(&pack->lock);
+	g_hash_table_remove(pack->queued, job->name);
+	if (ok)
+		pack->committed = job->offset + IMAGE_PACK_RECORD_HEADER + name_len + job->size;
+	g_mutex_unlock(&pack->lock);
+
+	g_free(job->name);
+	g_free(job->data);
+	g_free(job);
+}
+
+/* Queues an image for the pack unless it is already there. */
+static void
+image_pack_add(ImagePack *pack, const char *name, gconstpointer data, gsize size)
+{
+	ImagePackJob *job;
+	ImagePackEntry *entry;
+	gsize name_len;
+
+	if (g_hash_table_contains(pack->entries, name))
+		return;
+
+	name_len = strlen(name);
+
+	job = g_new(ImagePackJob, 1);
+	job->pack = pack;
+	job->offset = pack->end;
+	job->name = g_strdup(name);
+	job->data = g_malloc(size);
+	memcpy(job->data, data, size);
+	job->size = size;
+
+	entry = g_slice_new(ImagePackEntry);
+	entry->offset = pack->end + IMAGE_PACK_RECORD_HEADER + name_len;
+	entry->size = size;
+	g_hash_table_insert(pack->entries, g_strdup(name), entry);
+	pack->end = entry->offset + size;
+
+	g_mutex_lock(&pack->lock);
+	g_hash_table_insert(pack->queued, job->name, job);
+	g_mutex_unlock(&pack->lock);
+	g_thread_pool_push(image_pack_pool, job, NULL);
+}
+
+/* Returns a newly allocated copy of an image in the pack, or NULL. */
+static gpointer
+image_pack_read(ImagePack *pack, const char *name, gsize *size)
+{
+	ImagePackEntry *entry = g_hash_table_lookup(pack->entries, name);
+	ImagePackJob *job;
+	gboolean written;
+	gpointer data;
+	FILE *file;
+
+	if (entry == NULL)
+		return NULL;
+
+	/* Copy it out of its job if it is still queued for writing, rather
+	 * than waiting on the pack thread */
+	g_mutex_lock(&pack->lock);
+	job = g_hash_table_lookup(pack->queued, name);
+	if (job != NULL) {
+		data = g_malloc(job->size);
+		memcpy(data, job->data, job->size);
+		*size = job->size;
+		g_mutex_unlock(&pack->lock);
+		return data;
+	}
+	written = pack->committed >= entry->offset + (long)entry->size;
+	g_mutex_unlock(&pack->lock);
+
+	/* Otherwise its write failed */
+	if (!written || (file = g_fopen(pack->path, "rb")) == NULL)
+		return NULL;
+
+	data = g_malloc(entry->size);
+	if (fseek(file, entry->offset, SEEK_SET) != 0 ||
+	    fread(data, entry->size, 1, file) != 1) {
+		g_free(data);
+		data = NULL;
+	}
+	fclose(file);
+
+	*size = entry->size;
+	return data;
+}
+
+/* Rewrites <IMG SRC> references to packed images into data: URIs so the log
+ * viewer can show them. Takes ownership of html. */
+static char *
+image_pack_resolve_tags(const char *dir, char *html)
+{
+	ImagePack *pack = image_pack_get(dir, FALSE);
+	const char *search = html;
+	const char *tmp = html;
+	const char *start;
+	const char *end;
+	GData *attributes;
+	GString *newhtml = NULL;
+
+	if (pack == NULL || g_hash_table_size(pack->entries) == 0)
+		return html;
+
+	while (purple_markup_find_tag("img", search, &start, &end, &attributes)) {
+		const char *src = g_datalist_get_data(&attributes, "src");
+		const char *ext;
+		gpointer data;
+		gsize size;
+		char *b64;
+
+		search = end + 1;
+		if (src == NULL || (data = image_pack_read(pack, src, &size)) == NULL) {
+			g_datalist_clear(&attributes);
+			continue;
+		}
+
+		if (newhtml == NULL)
+			newhtml = g_string_sized_new(strlen(html));
+
+		/* copy any text before the img tag */
+		g_string_append_len(newhtml, tmp, start - tmp);
+
+		ext = strrchr(src, '.');
+		ext = (ext == NULL) ? "png" : ext + 1;
+		if (g_ascii_strcasecmp(ext, "jpg") == 0)
+			ext = "jpeg";
+
+		b64 = g_base64_encode(data, size);
+		g_string_append_printf(newhtml, "<IMG SRC=\"data:image/%s;base64,%s\">", ext, b64);
+		g_free(b64);
+		g_free(data);
+
+		g_datalist_clear(&attributes);
+		tmp = end + 1;
+	}
+
+	if (newhtml == NULL)
+		return html;
+
+	g_string_append(newhtml, tmp);
+	g_free(html);
+	return g_string_free(newhtml, FALSE);
+}
+
+static void
+read_last_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	read_last_messages = GPOINTER_TO_INT(val);
+}
+
+static void
+search_index_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	use_search_index = GPOINTER_TO_INT(val);
+}
+
+static void
+image_pack_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	use_image_pack = GPOINTER_TO_INT(val);
+}
+
+/* NOTE: This can return msg (which you may or may not want to g_free())
+ * NOTE: or a newly allocated string which you MUST g_free(). */
+static char *
+convert_image_tags(const PurpleLog *log, const char *msg)
+{
+	const char *tmp;
+	const char *start;
+	const char *end;
+	GData *attributes;
+	GString *newmsg = NULL;
+
+	tmp = msg;
+
+	while (purple_markup_find_tag("img", tmp, &start, &end, &attributes)) {
+		int imgid = 0;
+		char *idstr = NULL;
+
+		if (newmsg == NULL)
+			newmsg = g_string_new("");
+
+		/* copy any text before the img tag */
+		if (tmp < start)
+			g_string_append_len(newmsg, tmp, start - tmp);
+
+		if ((idstr = g_datalist_get_data(&attributes, "id")) != NULL)
+			imgid = atoi(idstr);
+
+		if (imgid != 0)
+		{
+			FILE *image_file;
+			char *dir;
+			PurpleStoredImage *image;
+			gconstpointer image_data;
+			char *new_filename = NULL;
+			char *path = NULL;
+			size_t image_byte_count;
+
+			image = purple_imgstore_find_by_id(imgid);
+			if (image == NULL)
+			{
+				/* This should never happen. */
+				/* This *does* happen for failed Direct-IMs -DAA */
+				g_string_free(newmsg, TRUE);
+				g_return_val_if_reached((char *)msg);
+			}
+
+			image_data       = purple_imgstore_get_data(image);
+			image_byte_count = purple_imgstore_get_size(image);
+			dir              = purple_log_get_log_dir(log->type, log->name, log->account);
+			new_filename     = purple_util_get_image_filename(image_data, image_byte_count);
+
+			path = g_build_filename(dir, new_filename, NULL);
+
+			if (use_image_pack)
+			{
+				/* Duplicates are caught by the pack's index without touching the disk */
+				image_pack_add(image_pack_get(dir, TRUE), new_filename,
+				               image_data, image_byte_count);
+			}
+			/* Only save unique files. */
+			else if (!g_file_test(path, G_FILE_TEST_EXISTS))
+			{
+				if ((image_file = g_fopen(path, "wb")) != NULL)
+				{
+					if (!fwrite(image_data, image_byte_count, 1, image_file))
+					{
+						purple_debug_error("log", "Error writing %s: %s\n",
+						                   path, g_strerror(errno));
+						fclose(image_file);
+
+						/* Attempt to not leave half-written files around. */
+						if (g_unlink(path)) {
+							purple_debug_error("log", "Error deleting partial "
+									"file %s: %s\n", path, g_strerror(errno));
+						}
+					}
+					else
+					{
+						purple_debug_info("log", "Wrote image file: %s\n", path);
+						fclose(image_file);
+					}
+				}
+				else
+				{
+					purple_debug_error("log", "Unable to create file %s: %s\n",
+					                   path, g_strerror(errno));
+				}
+			}
+
+			if (stats_enabled)
+				stats_account(log->account)->images++;
+
+			/* Write the new image tag */
+			g_string_append_printf(newmsg, "<IMG SRC=\"%s\">", new_filename);
+			g_free(new_filename);
+			g_free(path);
+			g_free(dir);
+		}
+
+		/* Continue from the end of the tag */
+		tmp = end + 1;
+	}
+
+	if (newmsg == NULL)
+	{
+		/* No images were found to change. */
+		return (char *)msg;
+	}
+
+	/* Append any remaining message data */
+	g_string_append(newmsg, tmp);
+
+	return g_string_free(newmsg, FALSE);
+}
+
+/* What a message needs before it can be logged */
+typedef enum {
+	MESSAGE_PLAIN,   /* no markup or entities, logged as it is */
+	MESSAGE_MARKUP,  /* needs purple_markup_html_to_xhtml() */
+	MESSAGE_IMAGES   /* may also have <img> tags to store */
+} MessageClass;
+
+/* A single pass over the message, looking only at '<' and '&'. strpbrk()
+ * and strchr() are vectorized by any libc worth using, so plain text,
+ * which is most of what gets logged, is dealt with at memchr() speed. */
+static MessageClass
+classify_message(const char *msg)
+{
+	const char *p = strpbrk(msg, "<&");
+
+	if (p == NULL)
+		return MESSAGE_PLAIN;
+
+	/* Anything that looks like the start of an img tag is handed to
+	 * convert_image_tags(), which does the exact matching */
+	for (p = strchr(p, '<'); p != NULL; p = strchr(p + 1, '<'))
+		if (g_ascii_strncasecmp(p + 1, "img", 3) == 0)
+			return MESSAGE_IMAGES;
+
+	return MESSAGE_MARKUP;
+}
+
+/* Message lines are rendered from templates, compiled once at load from
+ * their printf formats into literal segments and slots. Each %s in a
+ * format is filled by the slot named by the matching letter in slots:
+ * 'c'olor, 'd'ate, 'f'rom or 'm'essage. */
+typedef enum {
+	LINE_SYSTEM_LOG,
+	LINE_SYSTEM,
+	LINE_RAW,
+	LINE_ERROR,
+	LINE_WHISPER_SEND,
+	LINE_WHISPER_RECV,
+	LINE_AUTO_REPLY_SEND,
+	LINE_AUTO_REPLY_RECV,
+	LINE_RECV_ME,
+	LINE_RECV,
+	LINE_SEND_ME,
+	LINE_SEND,
+	LINE_UNHANDLED,
+	LINE_KINDS,
+	LINE_NONE = LINE_KINDS
+} LineKind;
+
+typedef enum {
+	SLOT_COLOR,
+	SLOT_DATE,
+	SLOT_FROM,
+	SLOT_MESSAGE,
+	SLOT_NONE
+} LineSlot;
+
+static const struct {
+	const char *format;
+	const char *slots;
+	const char *color;     /* when there is no nick color */
+	gboolean translated;
+} line_formats[LINE_KINDS] = {
+	{ "---- %s @ %s ----<br/>\n", "md", NULL, FALSE },
+	{ "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", "dm", NULL, FALSE },
+	{ "<font size=\"2\">(%s)</font> %s<br/>\n", "dm", NULL, FALSE },
+	{ "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", "dm", NULL, FALSE },
+	{ "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s &lt;whisper&gt;:</b></font> %s<br/>\n", "dfm", NULL, FALSE },
+	{ "<font color=\"%s\"><font size=\"2\">(%s)</font><b> %s &lt;whisper&gt;:</b></font> %s<br/>\n", "cdfm", "#6C2585", FALSE },
+	{ N_("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), "dfm", NULL, TRUE },
+	{ N_("<font color=\"%s\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), "cdfm", "#A82F2F", TRUE },
+	{ "<font color=\"%s\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n", "cdfm", "#062585", FALSE },
+	{ "<font color=\"%s\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n", "cdfm", "#A82F2F", FALSE },
+	{ "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n", "dfm", NULL, FALSE },
+	{ "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n", "dfm", NULL, FALSE },
+	{ "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n", "dfm", NULL, FALSE }
+};
+
+typedef struct {
+	const char *text;      /* points into the format, NULL for a slot */
+	gsize len;
+	LineSlot slot;
+} LineSegment;
+
+static GArray *line_templates[LINE_KINDS];  /* LineSegment, NULL to use printf */
+static const char *line_printf_formats[LINE_KINDS];  /* translations we can't parse */
+static GString *line_buffer = NULL;         /* reused by every write */
+
+static LineSlot
+line_slot(char c)
+{
+	switch (c) {
+	case 'c':
+		return SLOT_COLOR;
+	case 'd':
+		return SLOT_DATE;
+	case 'f':
+		return SLOT_FROM;
+	default:
+		return SLOT_MESSAGE;
+	}
+}
+
+/* Parses a format of literal text, %%, and %s or positional %N$s for each
+ * of its slots (as translators may reorder them). Returns NULL for
+ * anything else. */
+static GArray *
+line_template_parse(const char *format, const char *slots)
+{
+	GArray *segments = g_array_new(FALSE, FALSE, sizeof(LineSegment));
+	gsize n_slots = strlen(slots), next = 0;
+	const char *p;
+
+	while ((p = strchr(format, '%')) != NULL) {
+		LineSegment segment;
+		gsize arg;
+
+		if (p > format) {
+			segment.text = format;
+			segment.len = p - format;
+			segment.slot = SLOT_NONE;
+			g_array_append_val(segments, segment);
+		}
+
+		if (p[1] == '%') {
+			segment.text = p + 1;
+			segment.len = 1;
+			segment.slot = SLOT_NONE;
+			g_array_append_val(segments, segment);
+			format = p + 2;
+			continue;
+		}
+
+		if (p[1] == 's') {
+			arg = next++;
+			format = p + 2;
+		} else if (g_ascii_isdigit(p[1])) {
+			char *end;
+			guint64 n = g_ascii_strtoull(p + 1, &end, 10);
+
+			if (end[0] != '$' || end[1] != 's' || n == 0) {
+				g_array_free(segments, TRUE);
+				return NULL;
+			}
+			arg = n - 1;
+			format = end + 2;
+		} else {
+			g_array_free(segments, TRUE);
+			return NULL;
+		}
+
+		if (arg >= n_slots) {
+			g_array_free(segments, TRUE);
+			return NULL;
+		}
+		segment.text = NULL;
+		segment.len = 0;
+		segment.slot = line_slot(slots[arg]);
+		g_array_append_val(segments, segment);
+	}
+
+	if (*format) {
+		LineSegment segment;
+		segment.text = format;
+		segment.len = strlen(format);
+		segment.slot = SLOT_NONE;
+		g_array_append_val(segments, segment);
+	}
+
+	return segments;
+}
+
+static void
+line_templates_compile(void)
+{
+	int kind;
+
+	for (kind = 0; kind < LINE_KINDS; kind++) {
+		const char *format = line_formats[kind].translated ?
+			_(line_formats[kind].format) : line_formats[kind].format;
+
+		/* Let printf make what it can of a translation we can't parse;
+		 * such lines are not matched for recoloring */
+		line_templates[kind] = line_template_parse(format, line_formats[kind].slots);
+		line_printf_formats[kind] = line_templates[kind] == NULL ? format : NULL;
+	}
+
+	line_buffer = g_string_sized_new(1024);
+}
+
+static void
+line_templates_free(void)
+{
+	int kind;
+
+	for (kind = 0; kind < LINE_KINDS; kind++) {
+		if (line_templates[kind] != NULL)
+			g_array_free(line_templates[kind], TRUE);
+		line_templates[kind] = NULL;
+	}
+	g_string_free(line_buffer, TRUE);
+	line_buffer = NULL;
+}
+
+/* Picks the line for a message the way the write path always has. The
+ * message may be changed by purple_message_meify(). */
+static LineKind
+line_kind(PurpleLog *log, PurpleMessageFlags type, char *msg)
+{
+	if (log->type == PURPLE_LOG_SYSTEM)
+		return LINE_SYSTEM_LOG;
+	if (type & PURPLE_MESSAGE_SYSTEM)
+		return LINE_SYSTEM;
+	if (type & PURPLE_MESSAGE_RAW)
+		return LINE_RAW;
+	if (type & PURPLE_MESSAGE_ERROR)
+		return LINE_ERROR;
+	if (type & PURPLE_MESSAGE_WHISPER)
+		return (type & PURPLE_MESSAGE_SEND) ? LINE_WHISPER_SEND : LINE_WHISPER_RECV;
+	if (type & PURPLE_MESSAGE_AUTO_RESP) {
+		if (type & PURPLE_MESSAGE_SEND)
+			return LINE_AUTO_REPLY_SEND;
+		if (type & PURPLE_MESSAGE_RECV)
+			return LINE_AUTO_REPLY_RECV;
+		return LINE_NONE;
+	}
+	if (type & PURPLE_MESSAGE_RECV)
+		return purple_message_meify(msg, -1) ? LINE_RECV_ME : LINE_RECV;
+	if (type & PURPLE_MESSAGE_SEND)
+		return purple_message_meify(msg, -1) ? LINE_SEND_ME : LINE_SEND;
+
+	purple_debug_error("log", "Unhandled message type.\n");
+	return LINE_UNHANDLED;
+}
+
+static void
+line_render(GString *out, LineKind kind, const char *color, const char *date,
+            const char *from, const char *msg)
+{
+	const char *values[SLOT_NONE];
+	GArray *segments;
+	guint i;
+
+	if (kind == LINE_NONE)
+		return;
+
+	values[SLOT_COLOR] = color ? color : line_formats[kind].color;
+	values[SLOT_DATE] = date;
+	values[SLOT_FROM] = from;
+	values[SLOT_MESSAGE] = msg;
+
+	segments = line_templates[kind];
+	if (segments == NULL) {
+		const char *slots = line_formats[kind].slots;
+		const char *args[SLOT_NONE] = { NULL, NULL, NULL, NULL };
+
+		/* Arguments go in the order the untranslated format takes them */
+		for (i = 0; slots[i]; i++)
+			args[i] = values[line_slot(slots[i])];
+		g_string_append_printf(out, line_printf_formats[kind],
+		                       args[0], args[1], args[2], args[3]);
+		return;
+	}
+
+	for (i = 0; i < segments->len; i++) {
+		const LineSegment *segment = &g_array_index(segments, LineSegment, i);
+		if (segment->text != NULL)
+			g_string_append_len(out, segment->text, segment->len);
+		else
+			g_string_append(out, values[segment->slot]);
+	}
+}
+
+/* Bumped when the time zone or the time locale change, which drops every
+ * cached timestamp */
+static guint timestamp_epoch = 1;
+
+static void
+timestamp_check_zone(void)
+{
+	static char *tz = NULL;
+	static char *locale = NULL;
+	static time_t zone_mtime = 0;
+	static ino_t zone_ino = 0;
+	const char *now_tz = g_getenv("TZ");
+	const char *now_locale = setlocale(LC_TIME, NULL);
+	time_t mtime = 0;
+	ino_t ino = 0;
+#ifndef _WIN32
+	GStatBuf st;
+
+	/* Changing the system zone replaces or relinks /etc/localtime */
+	if (g_stat("/etc/localtime", &st) == 0) {
+		mtime = st.st_mtime;
+		ino = st.st_ino;
+	}
+#endif
+
+	if (g_strcmp0(now_tz, tz) == 0 && g_strcmp0(now_locale, locale) == 0 &&
+	    mtime == zone_mtime && ino == zone_ino)
+		return;
+
+	g_free(tz);
+	tz = g_strdup(now_tz);
+	g_free(locale);
+	locale = g_strdup(now_locale);
+	zone_mtime = mtime;
+	zone_ino = ino;
+	tzset();
+	timestamp_epoch++;
+}
+
+/* Returns the timestamp for a message at when, which stays owned by the
+ * log. Messages often come in bursts within the same second, so the last
+ * one formatted is kept and only redone, signal and all, once the second
+ * or the show-date decision change. */
+static const char *log_get_timestamp(PurpleLog *log, ColorNicksLogData *cdata, time_t when)
+{
+	gboolean show_date;
+	char *date;
+	struct tm tm;
+
+	show_date = (log->type == PURPLE_LOG_SYSTEM) || (time(NULL) > when + 20*60);
+
+	if (cdata->stamp != NULL && cdata->stamp_when == when &&
+	    cdata->stamp_show_date == show_date && cdata->stamp_epoch == timestamp_epoch)
+		return cdata->stamp;
+
+	timestamp_check_zone();
+
+	date = purple_signal_emit_return_1(purple_log_get_handle(),
+	                          "log-timestamp",
+	                          log, when, show_date);
+	if (date == NULL) {
+		tm = *(localtime(&when));
+		if (show_date)
+			date = g_strdup(purple_date_format_long(&tm));
+		else
+			date = g_strdup(purple_time_format(&tm));
+	}
+
+	g_free(cdata->stamp);
+	cdata->stamp = date;
+	cdata->stamp_when = when;
+	cdata->stamp_show_date = show_date;
+	cdata->stamp_epoch = timestamp_epoch;
+	return date;
+}
+
+/* Optional trace of what is logged, for replaying real traffic later. The
+ * file starts with TRACE_MAGIC, followed by records laid out as
+ * [type][time][length][fields], with the time in microseconds since the
+ * trace was started as a big-endian guint64 and the length of the fields
+ * as a big-endian guint32. Fields are NUL-terminated strings. 'W' records
+ * a write, with the log's type, name, account and protocol followed by
+ * the message's flags, sender, time and text; 'C' records the log being
+ * closed, with the fields identifying the log. The replay benchmark in
+ * bench/ writes it again. */
+#define TRACE_MAGIC "CNTRACE\1"
+#define TRACE_RECORD_HEADER (1 + 8 + 4)
+
+static FILE *trace_file = NULL;
+static gint64 trace_start;
+static gboolean trace_replaying = FALSE;  /* replayed writes are not traced */
+
+static char *
+trace_path(void)
+{
+	return g_build_filename(purple_user_dir(), "colornicks", "trace", NULL);
+}
+
+static void
+trace_add_log_fields(GString *fields, PurpleLog *log)
+{
+	g_string_append_printf(fields, "%d", log->type);
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, log->name);
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, purple_account_get_username(log->account));
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, purple_account_get_protocol_id(log->account));
+	g_string_append_c(fields, '\0');
+}
+
+static void
+trace_write_record(char type, const GString *fields)
+{
+	guint8 header[TRACE_RECORD_HEADER];
+	guint64 when = GUINT64_TO_BE(g_get_monotonic_time() - trace_start);
+	guint32 len = GUINT32_TO_BE(fields->len);
+
+	header[0] = type;
+	memcpy(header + 1, &when, 8);
+	memcpy(header + 9, &len, 4);
+	if (fwrite(header, sizeof(header), 1, trace_file) != 1 ||
+	    fwrite(fields->str, fields->len, 1, trace_file) != 1)
+		purple_debug_error("colornicks", "Unable to write to the trace: %s\n",
+		                   g_strerror(errno));
+}
+
+static void
+trace_write(PurpleLog *log, PurpleMessageFlags type, const char *from,
+            time_t time, const char *message)
+{
+	GString *fields;
+
+	if (trace_file == NULL || trace_replaying)
+		return;
+
+	fields = g_string_sized_new(256);
+	trace_add_log_fields(fields, log);
+	g_string_append_printf(fields, "%d", type);
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, from ? from : "");
+	g_string_append_c(fields, '\0');
+	g_string_append_printf(fields, "%" G_GINT64_FORMAT, (gint64)time);
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, message);
+	g_string_append_c(fields, '\0');
+	trace_write_record('W', fields);
+	g_string_free(fields, TRUE);
+}
+
+static void
+trace_close(PurpleLog *log)
+{
+	GString *fields;
+
+	if (trace_file == NULL || trace_replaying)
+		return;
+
+	fields = g_string_sized_new(64);
+	trace_add_log_fields(fields, log);
+	trace_write_record('C', fields);
+	g_string_free(fields, TRUE);
+}
+
+/* Starts a new trace, replacing the last one */
+static void
+trace_start_recording(void)
+{
+	char *path = trace_path();
+	char *dir = g_path_get_dirname(path);
+
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	if ((trace_file = g_fopen(path, "wb")) == NULL) {
+		purple_debug_error("colornicks", "Unable to create %s: %s\n",
+		                   path, g_strerror(errno));
+	} else {
+		fwrite(TRACE_MAGIC, strlen(TRACE_MAGIC), 1, trace_file);
+		trace_start = g_get_monotonic_time();
+	}
+	g_free(dir);
+	g_free(path);
+}
+
+static void
+trace_stop_recording(void)
+{
+	if (trace_file != NULL)
+		fclose(trace_file);
+	trace_file = NULL;
+}
+
+static void
+trace_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	trace_stop_recording();
+	if (GPOINTER_TO_INT(val))
+		trace_start_recording();
+}
+
+/* Whether a message at when should start a new segment of the log */
+static gboolean
+segment_due(ColorNicksLogData *cdata, time_t when)
+{
+	/* A segment starting in the same second would get the same file name */
+	if (when <= cdata->segment_start)
+		return FALSE;
+
+	if (segment_max_kb > 0 && cdata->offset >= (guint64)segment_max_kb * 1024)
+		return TRUE;
+	if (segment_max_lines > 0 && cdata->lines >= (guint)segment_max_lines)
+		return TRUE;
+	if (segment_daily) {
+		struct tm start = *localtime(&cdata->segment_start);
+		struct tm now = *localtime(&when);
+		return start.tm_yday != now.tm_yday || start.tm_year != now.tm_year;
+	}
+	return FALSE;
+}
+
+/* Whether a file already exists for a segment of log starting at when,
+ * named the way purple_log_common_writer() names it. Appending to it
+ * would put a second header in the middle of another log. */
+static gboolean
+segment_name_taken(PurpleLog *log, time_t when, const char *ext)
+{
+	char *dir = purple_log_get_log_dir(log->type, log->name, log->account);
+	struct tm *tm;
+	char *tz, *filename, *path;
+	gboolean taken;
+
+	if (dir == NULL)
+		return FALSE;
+
+	tm = localtime(&when);
+	tz = g_strdup(purple_escape_filename(purple_utf8_strftime("%Z", tm)));
+	filename = g_strdup_printf("%s%s%s", purple_utf8_strftime("%Y-%m-%d.%H%M%S%z", tm), tz, ext);
+	path = g_build_filename(dir, filename, NULL);
+	taken = g_file_test(path, G_FILE_TEST_EXISTS);
+
+	g_free(path);
+	g_free(filename);
+	g_free(tz);
+	g_free(dir);
+	return taken;
+}
+
+static void
+segment_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	if (g_str_has_suffix(name, "/segment_size"))
+		segment_max_kb = GPOINTER_TO_INT(val);
+	else if (g_str_has_suffix(name, "/segment_lines"))
+		segment_max_lines = GPOINTER_TO_INT(val);
+	else
+		segment_daily = GPOINTER_TO_INT(val);
+}
+
+static gsize colornicks_logger_write_common(PurpleLog *log, PurpleMessageFlags type,
+							  const char *from, time_t time, const char *message,
+							  gboolean compressed)
+{
+	char *msg_fixed;
+	char *image_corrected_msg;
+	const char *date;
+	char *header;
+	char *escaped_from;
+	const char *nick_color;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	ColorNicksLogData *cdata;
+	GString *line = line_buffer;
+	gsize written;
+	gsize msg_start;
+	guint64 offset;
+	time_t start = log->time;
+	guint64 write_start = stats_clock(), t = write_start;
+
+	trace_write(log, type, from, time, message);
+	g_string_truncate(line, 0);
+
+	/* Long-lived logs go on in a new segment, a file of their own that is
+	 * listed as a separate log */
+	if (data && data->extra && segment_due(data->extra, time)) {
+		colornicks_logger_close(data);
+		log->logger_data = data = NULL;
+
+		/* An offline or delayed message can carry the time of a log that
+		 * is already there */
+		start = time;
+		while (segment_name_taken(log, start, compressed ? CZ_EXTENSION : ".htm"))
+			start++;
+	}
+
+	if (!data) {
+		/* The protocol is only needed for the header */
+		PurplePlugin *plugin = purple_find_prpl(purple_account_get_protocol_id(log->account));
+		const char *prpl =
+			PURPLE_PLUGIN_PROTOCOL_INFO(plugin)->list_icon(log->account, NULL);
+		const char *date;
+		time_t log_time = log->time;
+
+		/* The file is named after the time its segment starts */
+		log->time = start;
+		purple_log_common_writer(log, compressed ? CZ_EXTENSION : ".htm");
+		log->time = log_time;
+
+		data = log->logger_data;
+
+		/* if we can't write to the file, give up before we hurt ourselves */
+		if (!data->file)
+			return 0;
+
+#ifdef _WIN32
+		/* Compressed blocks must not have their newlines translated */
+		if (compressed)
+			_setmode(_fileno(data->file), _O_BINARY);
+#endif
+		data->extra = cn_log_data_new(data->file, data->path, compressed);
+		((ColorNicksLogData *)data->extra)->log_data = data;
+		((ColorNicksLogData *)data->extra)->segment_start = start;
+		log_catalog_update(data->path);
+
+		date = purple_date_format_full(localtime(&start));
+
+		g_string_append(line, "<html><head>");
+		g_string_append(line, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
+		g_string_append(line, "<title>");
+		if (log->type == PURPLE_LOG_SYSTEM)
+			header = g_strdup_printf("System log for account %s (%s) connected at %s",
+					purple_account_get_username(log->account), prpl, date);
+		else
+			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
+					log->name, date, purple_account_get_username(log->account), prpl);
+
+		g_string_append(line, header);
+		g_string_append(line, "</title></head><body>");
+		g_string_append_printf(line, "<h3>%s</h3>\n", header);
+		g_free(header);
+	}
+
+	/* if we can't write to the file, give up before we hurt ourselves */
+	cdata = data->extra;
+	if (cdata == NULL || !file_pool_acquire(cdata))
+		return 0;
+	msg_start = line->len;
+	if (msg_start > 0)
+		t = stats_lap(STAGE_OPEN, t);
+
+	escaped_from = g_markup_escape_text(from, -1);
+	nick_color = get_nick_color(log->conv ? PIDGIN_CONVERSATION(log->conv) : NULL,
+	                            escaped_from);
+	t = stats_lap(STAGE_COLOR, t);
+
+	switch (classify_message(message)) {
+	case MESSAGE_PLAIN:
+		/* purple_markup_html_to_xhtml() would copy it unchanged, a byte at
+		 * a time. It still has to be a copy, for purple_message_meify(). */
+		msg_fixed = g_strdup(message);
+		break;
+	case MESSAGE_MARKUP:
+		purple_markup_html_to_xhtml(message, &msg_fixed, NULL);
+		break;
+	default:
+		image_corrected_msg = convert_image_tags(log, message);
+		t = stats_lap(STAGE_IMAGES, t);
+		purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
+
+		/* Yes, this breaks encapsulation.  But it's a static function and
+		 * this saves a needless strdup(). */
+		if (image_corrected_msg != message)
+			g_free(image_corrected_msg);
+		break;
+	}
+
+	t = stats_lap(STAGE_XHTML, t);
+
+	date = log_get_timestamp(log, cdata, time);
+	t = stats_lap(STAGE_TIMESTAMP, t);
+
+	line_render(line, line_kind(log, type, msg_fixed), nick_color, date,
+	            escaped_from, msg_fixed);
+	g_free(msg_fixed);
+	g_free(escaped_from);
+	t = stats_lap(STAGE_RENDER, t);
+
+	written = line->len;
+	offset = writer_append(cdata, line->str, line->len, msg_start, time);
+	cdata->lines++;
+	t = stats_lap(STAGE_QUEUE, t);
+	if (use_search_index) {
+		search_index_add(data->path, offset, message);
+		stats_lap(STAGE_SEARCH, t);
+	}
+
+	if (stats_enabled) {
+		StatsAccount *counters = stats_account(log->account);
+		counters->messages++;
+		counters->bytes += written;
+		stats_lap(STAGE_WRITE, write_start);
+	}
+
+	return written;
+}
+
+static gsize colornicks_logger_write(PurpleLog *log, PurpleMessageFlags type,
+							  const char *from, time_t time, const char *message)
+{
+	return colornicks_logger_write_common(log, type, from, time, message, FALSE);
+}
+
+static gsize colornicks_gz_logger_write(PurpleLog *log, PurpleMessageFlags type,
+							  const char *from, time_t time, const char *message)
+{
+	return colornicks_logger_write_common(log, type, from, time, message, TRUE);
+}
+
+/* Catalog of the logs in each log directory with their sizes, so listing
+ * and sizing don't walk and stat the directory every time. Catalogs are
+ * saved under the user dir, keyed by a hash of the log directory and the
+ * extension of the logs, as a line with the directory's mtime followed by
+ * "size<TAB>mtime<TAB>filename" lines, with mtimes in nanoseconds.
+ * When the directory's mtime changes the file names are re-read, and only
+ * names not seen before are stat()ed. Our own logs are cataloged as they
+ * are created and sized again as they are closed. Logs rewritten by
+ * something else are caught by log_total_size(), which stat()s every
+ * file again at most once every LOG_CATALOG_RECHECK seconds. */
+#define LOG_CATALOG_RECHECK 60
+
+typedef struct {
+	char *key;             /* dir followed by ext */
+	char *dir;
+	const char *ext;
+	char *path;
+	gint64 dir_mtime;
+	gint64 checked;        /* g_get_monotonic_time() of the last full stat() */
+	GHashTable *files;     /* filename -> LogCatalogFile */
+} LogCatalog;
+
+typedef struct {
+	gint64 size;
+	gint64 mtime;
+} LogCatalogFile;
+
+static GHashTable *log_catalogs = NULL;  /* log dir and extension -> LogCatalog */
+
+static void
+log_catalog_free(gpointer data)
+{
+	LogCatalog *catalog = data;
+
+	g_hash_table_destroy(catalog->files);
+	g_free(catalog->key);
+	g_free(catalog->dir);
+	g_free(catalog->path);
+	g_slice_free(LogCatalog, catalog);
+}
+
+/* Returns the mtime of a stat()ed file in nanoseconds, where the platform
+ * has them */
+static gint64
+stat_mtime_ns(const GStatBuf *st)
+{
+#if defined(__APPLE__)
+	return (gint64)st->st_mtimespec.tv_sec * G_GINT64_CONSTANT(1000000000) +
+	       st->st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	return (gint64)st->st_mtime * G_GINT64_CONSTANT(1000000000);
+#else
+	return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+	       st->st_mtim.tv_nsec;
+#endif
+}
+
+static void
+log_catalog_set(LogCatalog *catalog, const char *filename, gint64 size, gint64 mtime)
+{
+	LogCatalogFile *file = g_new(LogCatalogFile, 1);
+	file->size = size;
+	file->mtime = mtime;
+	g_hash_table_replace(catalog->files, g_strdup(filename), file);
+}
+
+static void
+log_catalog_save(LogCatalog *catalog)
+{
+	GString *out = g_string_new(NULL);
+	GHashTableIter iter;
+	gpointer key, value;
+	GError *error = NULL;
+
+	g_string_append_printf(out, "%" G_GINT64_FORMAT "\n", catalog->dir_mtime);
+	g_hash_table_iter_init(&iter, catalog->files);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		LogCatalogFile *file = value;
+		g_string_append_printf(out, "%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%s\n",
+		                       file->size, file->mtime, (const char *)key);
+	}
+
+	if (!g_file_set_contents(catalog->path, out->str, out->len, &error)) {
+		purple_debug_warning("colornicks", "Unable to save %s: %s\n",
+		                     catalog->path, error->message);
+		g_error_free(error);
+	}
+	g_string_free(out, TRUE);
+}
+
+static void
+log_catalog_load(LogCatalog *catalog)
+{
+	gchar *contents;
+	gchar **lines;
+	int i;
+
+	if (!g_file_get_contents(catalog->path, &contents, NULL, NULL))
+		return;
+
+	lines = g_strsplit(contents, "\n", -1);
+	catalog->dir_mtime = lines[0] ? g_ascii_strtoll(lines[0], NULL, 10) : 0;
+	for (i = 1; lines[0] && lines[i]; i++) {
+		char *tab = strchr(lines[i], '\t');
+		char *filename, *mtime_tab;
+		gint64 mtime = 0;
+
+		if (tab == NULL)
+			continue;
+		*tab = '\0';
+		filename = tab + 1;
+
+		/* Catalogs written before mtimes were kept get them on the next refresh */
+		if ((mtime_tab = strchr(filename, '\t')) != NULL) {
+			*mtime_tab = '\0';
+			mtime = g_ascii_strtoll(filename, NULL, 10);
+			filename = mtime_tab + 1;
+		}
+		log_catalog_set(catalog, filename, g_ascii_strtoll(lines[i], NULL, 10), mtime);
+	}
+
+	g_strfreev(lines);
+	g_free(contents);
+}
+
+/* Re-reads the names in the directory, stat()ing new ones, or every file
+ * if recheck is set, and saves the catalog if anything changed */
+static void
+log_catalog_refresh(LogCatalog *catalog, gint64 dir_mtime, gboolean recheck)
+{
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+	GHashTableIter iter;
+	gpointer key, value;
+	const char *filename;
+	gboolean changed = dir_mtime != catalog->dir_mtime;
+	GDir *dir;
+
+	if ((dir = g_dir_open(catalog->dir, 0, NULL)) == NULL) {
+		g_hash_table_destroy(seen);
+		return;
+	}
+
+	while ((filename = g_dir_read_name(dir)) != NULL) {
+		char *path;
+		gint64 size = 0, mtime = 0;
+		GStatBuf st;
+
+		/* Same test purple_log_common_lister() uses */
+		if (!purple_str_has_suffix(filename, catalog->ext) ||
+		    strlen(filename) < 17 + strlen(catalog->ext))
+			continue;
+
+		value = NULL;
+		if (g_hash_table_lookup_extended(catalog->files, filename, &key, &value) && !recheck) {
+			g_hash_table_add(seen, key);
+			continue;
+		}
+
+		path = g_build_filename(catalog->dir, filename, NULL);
+		if (g_stat(path, &st) == 0) {
+			size = st.st_size;
+			mtime = stat_mtime_ns(&st);
+		}
+		g_free(path);
+
+		if (value == NULL ||
+		    ((LogCatalogFile *)value)->size != size ||
+		    ((LogCatalogFile *)value)->mtime != mtime) {
+			log_catalog_set(catalog, filename, size, mtime);
+			g_hash_table_lookup_extended(catalog->files, filename, &key, NULL);
+			changed = TRUE;
+		}
+		g_hash_table_add(seen, key);
+	}
+	g_dir_close(dir);
+
+	g_hash_table_iter_init(&iter, catalog->files);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (!g_hash_table_contains(seen, key)) {
+			g_hash_table_iter_remove(&iter);
+			changed = TRUE;
+		}
+	}
+	g_hash_table_destroy(seen);
+
+	catalog->dir_mtime = dir_mtime;
+	if (changed)
+		log_catalog_save(catalog);
+}
+
+/* Returns the catalog of the logs with extension ext in a log directory,
+ * brought up to date with its file names. With recheck set the files are
+ * also stat()ed again if that was last done LOG_CATALOG_RECHECK ago. */
+static LogCatalog *
+log_catalog_get(const char *dir, const char *ext, gboolean recheck)
+{
+	char *key = g_strconcat(dir, ext, NULL);
+	LogCatalog *catalog = g_hash_table_lookup(log_catalogs, key);
+	gint64 now = g_get_monotonic_time();
+	GStatBuf st;
+
+	if (catalog == NULL) {
+		char *base = g_build_filename(purple_user_dir(), "colornicks", NULL);
+		char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, dir, -1);
+
+		purple_build_dir(base, S_IRUSR | S_IWUSR | S_IXUSR);
+
+		catalog = g_slice_new0(LogCatalog);
+		catalog->key = key;
+		catalog->dir = g_strdup(dir);
+		catalog->ext = ext;
+		catalog->path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s%s.catalog", base, hash, ext);
+		catalog->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		log_catalog_load(catalog);
+		/* Nothing has been stat()ed since the catalog was saved */
+		catalog->checked = now - LOG_CATALOG_RECHECK * G_USEC_PER_SEC;
+		g_hash_table_insert(log_catalogs, catalog->key, catalog);
+
+		g_free(hash);
+		g_free(base);
+	} else {
+		g_free(key);
+	}
+
+	/* Timestamps are coarser than they look on many filesystems, so a file
+	 * added in the same tick as the last refresh would leave the mtime as
+	 * it was. A directory changed within the last second is re-read until
+	 * it has been quiet for a second. */
+	recheck = recheck && now - catalog->checked >= LOG_CATALOG_RECHECK * G_USEC_PER_SEC;
+	if (g_stat(dir, &st) != 0)
+		g_hash_table_remove_all(catalog->files);
+	else if (recheck || stat_mtime_ns(&st) != catalog->dir_mtime ||
+	         st.st_mtime >= time(NULL) - 1)
+		log_catalog_refresh(catalog, stat_mtime_ns(&st), recheck);
+	if (recheck)
+		catalog->checked = now;
+
+	return catalog;
+}
+
+/* Returns the loaded catalog a log file belongs in, or NULL */
+static LogCatalog *
+log_catalog_for_path(const char *path)
+{
+	const char *ext;
+	char *dir, *key;
+	LogCatalog *catalog;
+
+	if (log_catalogs == NULL)
+		return NULL;
+	if (purple_str_has_suffix(path, CZ_EXTENSION))
+		ext = CZ_EXTENSION;
+	else if (purple_str_has_suffix(path, ".htm"))
+		ext = ".htm";
+	else
+		return NULL;
+
+	dir = g_path_get_dirname(path);
+	key = g_strconcat(dir, ext, NULL);
+	catalog = g_hash_table_lookup(log_catalogs, key);
+	g_free(key);
+	g_free(dir);
+	return catalog;
+}
+
+/* Records the size of a log we just created or closed, if its directory
+ * is cataloged */
+static void
+log_catalog_update(const char *path)
+{
+	LogCatalog *catalog = log_catalog_for_path(path);
+	GStatBuf st;
+
+	if (catalog != NULL && g_stat(path, &st) == 0) {
+		char *filename = g_path_get_basename(path);
+		log_catalog_set(catalog, filename, st.st_size, stat_mtime_ns(&st));
+		log_catalog_save(catalog);
+		g_free(filename);
+	}
+}
+
+/* Drops a deleted log from its catalog */
+static void
+log_catalog_remove(const char *path)
+{
+	LogCatalog *catalog = log_catalog_for_path(path);
+	char *filename;
+
+	if (catalog == NULL)
+		return;
+
+	filename = g_path_get_basename(path);
+	if (g_hash_table_remove(catalog->files, filename))
+		log_catalog_save(catalog);
+	g_free(filename);
+}
+
+/* Creates a log for a file, as purple_log_common_lister() does */
+static PurpleLog *
+log_catalog_new_log(PurpleLogType type, const char *name, PurpleAccount *account,
+                    PurpleLogLogger *logger, const char *dir, const char *filename)
+{
+	PurpleLog *log;
+	PurpleLogCommonLoggerData *data;
+	struct tm tm;
+#if defined (HAVE_TM_GMTOFF) && defined (HAVE_STRUCT_TM_TM_ZONE)
+	long tz_off;
+	const char *rest, *end;
+	time_t stamp = purple_str_to_time(purple_unescape_filename(filename), FALSE, &tm, &tz_off, &rest);
+
+	/* As zero is a valid offset, PURPLE_NO_TZ_OFF means no offset was
+	 * provided. See util.h. Yes, it's kinda ugly. */
+	if (tz_off != PURPLE_NO_TZ_OFF)
+		tm.tm_gmtoff = tz_off - tm.tm_gmtoff;
+
+	if (stamp == 0 || rest == NULL || (end = strchr(rest, '.')) == NULL || strchr(rest, ' ') != NULL)
+	{
+		log = purple_log_new(type, name, account, NULL, stamp, NULL);
+	}
+	else
+	{
+		char *tmp = g_strndup(rest, end - rest);
+		tm.tm_zone = tmp;
+		log = purple_log_new(type, name, account, NULL, stamp, &tm);
+		g_free(tmp);
+	}
+#else
+	time_t stamp = purple_str_to_time(filename, FALSE, &tm, NULL, NULL);
+
+	log = purple_log_new(type, name, account, NULL, stamp, (stamp != 0) ?  &tm : NULL);
+#endif
+
+	log->logger = logger;
+	log->logger_data = data = g_slice_new0(PurpleLogCommonLoggerData);
+	data->path = g_build_filename(dir, filename, NULL);
+
+	return log;
+}
+
+static GList *
+log_catalog_list(PurpleLogType type, const char *name, PurpleAccount *account,
+                 PurpleLogLogger *logger, const char *ext)
+{
+	char *dir = purple_log_get_log_dir(type, name, account);
+	LogCatalog *catalog;
+	GHashTableIter iter;
+	gpointer key;
+	GList *list = NULL;
+
+	if (dir == NULL)
+		return NULL;
+
+	catalog = log_catalog_get(dir, ext, FALSE);
+	g_hash_table_iter_init(&iter, catalog->files);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		list = g_list_prepend(list, log_catalog_new_log(type, name, account, logger, dir, key));
+
+	g_free(dir);
+	return list;
+}
+
+/* Deletes a log along with its sidecar index, which would otherwise be
+ * picked up by a new log of the same name, and its catalog entry. The
+ * sidecar of a compressed log also holds its block offsets. */
+static gboolean
+colornicks_logger_delete(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	char *path, *index_path;
+
+	if (data == NULL || data->path == NULL)
+		return FALSE;
+
+	path = g_strdup(data->path);
+	if (!purple_log_common_deleter(log)) {
+		g_free(path);
+		return FALSE;
+	}
+
+	index_path = g_strconcat(path, LOG_INDEX_SUFFIX, NULL);
+	if (g_unlink(index_path) != 0 && errno != ENOENT)
+		purple_debug_warning("colornicks", "Unable to delete %s: %s\n",
+		                     index_path, g_strerror(errno));
+	log_catalog_remove(path);
+	search_index_forget(path);
+
+	g_free(index_path);
+	g_free(path);
+	return TRUE;
+}
+
+/* Finishes the file of a log and frees data */
+static void colornicks_logger_close(PurpleLogCommonLoggerData *data)
+{
+	ColorNicksLogData *cdata = data->extra;
+	gboolean compressed = FALSE;
+	if (cdata) {
+		static const char footer[] = "</body></html>\n";
+
+		/* The pool may have closed it; the footer still has to go in */
+		file_pool_acquire(cdata);
+		file_pool_remove(cdata);
+		cdata->log_data = NULL;
+
+		compressed = cdata->compressed;
+		if (compressed) {
+			/* The footer goes into the last block */
+			g_mutex_lock(&writer_lock);
+			g_string_append(cdata->pending, footer);
+			cdata->offset += sizeof(footer) - 1;
+			writer_pending_bytes += sizeof(footer) - 1;
+			g_mutex_unlock(&writer_lock);
+		}
+
+		/* Write out whatever the writer thread has not got to yet */
+		writer_drain(cdata, TRUE);
+
+		g_mutex_lock(&cdata->io_lock);
+		cdata->file = NULL;
+		g_mutex_unlock(&cdata->io_lock);
+		if (writer_logs != NULL)
+			g_hash_table_remove(writer_logs, cdata->path);
+	}
+	if (data->file) {
+		if (!compressed)
+			fprintf(data->file, "</body></html>\n");
+		fclose(data->file);
+		log_catalog_update(data->path);
+	}
+	if (cdata) {
+		journal_log_closed(cdata);
+		cn_log_data_unref(cdata);
+	}
+	g_free(data->path);
+
+	g_slice_free(PurpleLogCommonLoggerData, data);
+}
+
+static void colornicks_logger_finalize(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	trace_close(log);
+	if (data)
+		colornicks_logger_close(data);
+}
+
+static GList *colornicks_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+{
+	return log_catalog_list(type, sn, account, colornicks_logger, ".htm");
+}
+
+static GList *colornicks_logger_list_syslog(PurpleAccount *account)
+{
+	return log_catalog_list(PURPLE_LOG_SYSTEM, ".system", account, colornicks_logger, ".htm");
+}
+
+static GList *colornicks_gz_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+{
+	return log_catalog_list(type, sn, account, colornicks_gz_logger, CZ_EXTENSION);
+}
+
+static GList *colornicks_gz_logger_list_syslog(PurpleAccount *account)
+{
+	return log_catalog_list(PURPLE_LOG_SYSTEM, ".system", account, colornicks_gz_logger, CZ_EXTENSION);
+}
+
+/* Reads a log through a memory map, giving out the body (everything after
+ * the header line) without copying it. Compressed logs are inflated into
+ * memory instead. Other plugins reach it over IPC as "reader-open",
+ * "reader-next" and "reader-close". */
+typedef struct {
+	GMappedFile *map;
+	GString *inflated;
+	const char *body;
+	gsize len;
+	gsize pos;
+} ColorNicksLogReader;
+
+static ColorNicksLogReader *
+colornicks_log_reader_open(PurpleLog *log)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	ColorNicksLogReader *reader;
+	GError *error = NULL;
+	GMappedFile *map = NULL;
+	GString *inflated = NULL;
+	const char *contents;
+	const char *minus_header;
+	gsize len;
+
+	if (!data || !data->path)
+		return NULL;
+
+	if (purple_str_has_suffix(data->path, CZ_EXTENSION)) {
+		guint64 base;
+
+		inflated = cz_log_read(data->path, 0, G_MAXUINT64, &base, NULL);
+		if (inflated == NULL)
+			return NULL;
+		contents = inflated->str;
+		len = inflated->len;
+	} else {
+		/* Make sure a log that is still being written is complete on disk */
+		writer_drain_path(data->path);
+
+		map = g_mapped_file_new(data->path, FALSE, &error);
+		if (map == NULL) {
+			purple_debug_error("colornicks", "Unable to map %s: %s\n",
+			                   data->path, error->message);
+			g_error_free(error);
+			return NULL;
+		}
+
+		contents = g_mapped_file_get_contents(map);
+		len = g_mapped_file_get_length(map);
+		if (contents == NULL)
+			contents = "";
+	}
+
+	minus_header = memchr(contents, '\n', len);
+	if (minus_header) {
+		minus_header++;
+		len -= minus_header - contents;
+		contents = minus_header;
+	}
+
+	reader = g_slice_new0(ColorNicksLogReader);
+	reader->map = map;
+	reader->inflated = inflated;
+	reader->body = contents;
+	reader->len = len;
+	return reader;
+}
+
+/* Returns the next chunk of roughly max bytes, ending at a line break so no
+ * message is split, or NULL at the end. The chunk points into the map and
+ * is not NUL-terminated. */
+static const char *
+colornicks_log_reader_next(ColorNicksLogReader *reader, gsize max, gsize *len)
+{
+	const char *chunk = reader->body + reader->pos;
+	gsize left = reader->len - reader->pos;
+	gsize n;
+
+	if (left == 0)
+		return NULL;
+
+	if (max == 0 || left <= max) {
+		n = left;
+	} else {
+		const char *nl = g_strrstr_len(chunk, max, "\n");
+		if (nl == NULL)
+			nl = memchr(chunk + max, '\n', left - max);
+		n = nl ? (gsize)(nl + 1 - chunk) : left;
+	}
+
+	reader->pos += n;
+	*len = n;
+	return chunk;
+}
+
+static void
+colornicks_log_reader_close(ColorNicksLogReader *reader)
+{
+	if (reader == NULL)
+		return;
+	if (reader->map)
+		g_mapped_file_unref(reader->map);
+	if (reader->inflated)
+		g_string_free(reader->inflated, TRUE);
+	g_slice_free(ColorNicksLogReader, reader);
+}
+
+static const char *
+ipc_reader_next(ColorNicksLogReader *reader, gsize *len)
+{
+	return colornicks_log_reader_next(reader, 64 * 1024, len);
+}
+
+/* Finds the time of day in a logged line, e.g. "(12:34:56)" or
+ * "(10/17/2026 1:02:03 PM)", and puts it on the day of base. When the
+ * result would go back more than half a day from previous, the log has
+ * crossed midnight. Returns previous when nothing is found. */
+static time_t
+log_index_parse_time(const char *line, gsize len, time_t base, time_t previous)
+{
+	const char *end = line + MIN(len, 256);
+	const char *p;
+
+	for (p = line; p + 8 <= end; p++) {
+		int h, m, sec;
+		struct tm tm;
+		time_t when;
+
+		if (!(g_ascii_isdigit(p[0]) && p[1] == ':') &&
+		    !(g_ascii_isdigit(p[0]) && g_ascii_isdigit(p[1]) && p[2] == ':'))
+			continue;
+		if (sscanf(p, "%2d:%2d:%2d", &h, &m, &sec) != 3)
+			continue;
+
+		p = memchr(p, ')', end - p);
+		if (p != NULL && p >= line + 3) {
+			if (g_ascii_strncasecmp(p - 2, "PM", 2) == 0 && h < 12)
+				h += 12;
+			else if (g_ascii_strncasecmp(p - 2, "AM", 2) == 0 && h == 12)
+				h = 0;
+		}
+
+		tm = *localtime(&base);
+		tm.tm_hour = h;
+		tm.tm_min = m;
+		tm.tm_sec = sec;
+		tm.tm_isdst = -1;
+		when = mktime(&tm);
+		while (when + 12 * 60 * 60 < previous)
+			when += 24 * 60 * 60;
+		return when;
+	}
+
+	return previous;
+}
+
+/* Adds an entry for every message line starting at or after from.
+ * contents holds the log from offset base on, which is on a line boundary.
+ * Messages are the lines the write path produces, which start with a font
+ * tag or, in system logs, with "---- ". */
+static void
+log_index_scan(GArray *entries, const char *contents, gsize len, guint64 base,
+               guint64 from, time_t log_time)
+{
+	time_t last = log_time;
+	gsize pos = from > base ? from - base : 0;
+
+	if (entries->len > 0)
+		last = g_array_index(entries, LogIndexEntry, entries->len - 1).time;
+
+	/* Start on a line boundary */
+	if (pos > 0 && contents[pos - 1] != '\n') {
+		const char *nl = memchr(contents + pos, '\n', len - pos);
+		pos = nl ? (gsize)(nl + 1 - contents) : len;
+	}
+
+	while (pos < len) {
+		const char *line = contents + pos;
+		const char *nl = memchr(line, '\n', len - pos);
+		gsize line_len = nl ? (gsize)(nl - line) : len - pos;
+
+		/* The map is not NUL-terminated, so no g_str_has_prefix() */
+		if (base + pos > 0 && line_len >= 5 &&
+		    (strncmp(line, "<font", 5) == 0 || strncmp(line, "---- ", 5) == 0)) {
+			LogIndexEntry entry;
+			entry.offset = base + pos;
+			entry.time = last = log_index_parse_time(line, line_len, log_time, last);
+			g_array_append_val(entries, entry);
+		}
+
+		pos += line_len + 1;
+	}
+}
+
+/* Reads the sidecar index of a log len bytes long. Returns no entries when
+ * it is missing or stale. */
+static GArray *
+log_index_read(const char *path, guint64 len)
+{
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(LogIndexEntry));
+	char *index_path = g_strconcat(path, LOG_INDEX_SUFFIX, NULL);
+	gchar *raw = NULL;
+	gsize raw_len = 0, i;
+
+	if (g_file_get_contents(index_path, &raw, &raw_len, NULL)) {
+		for (i = 0; i + LOG_INDEX_RECORD_SIZE <= raw_len; i += LOG_INDEX_RECORD_SIZE) {
+			LogIndexEntry entry;
+			guint64 offset;
+			gint64 when;
+
+			memcpy(&offset, raw + i, 8);
+			memcpy(&when, raw + i + 8, 8);
+			entry.offset = GUINT64_FROM_BE(offset);
+			entry.time = GINT64_FROM_BE(when);
+
+			/* Anything out of order or past the end means the log changed under us */
+			if (entry.offset >= len ||
+			    (entries->len > 0 &&
+			     entry.offset <= g_array_index(entries, LogIndexEntry, entries->len - 1).offset)) {
+				g_array_set_size(entries, 0);
+				break;
+			}
+			g_array_append_val(entries, entry);
+		}
+		g_free(raw);
+	}
+
+	g_free(index_path);
+	return entries;
+}
+
+/* Brings entries up to date with the log, which is held from offset base
+ * on in contents, starting after the last entry. The result is saved
+ * unless the log is still being written, since then the writer owns the
+ * sidecar. */
+static void
+log_index_update(const char *path, GArray *entries, const char *contents, gsize len,
+                 guint64 base, time_t log_time, gboolean writing)
+{
+	guint loaded = entries->len;
+	guint64 from = 0;
+	gsize i;
+
+	if (loaded > 0)
+		from = g_array_index(entries, LogIndexEntry, loaded - 1).offset + 1;
+	log_index_scan(entries, contents, len, base, from, log_time);
+
+	if (!writing && (loaded == 0 || entries->len > loaded)) {
+		char *index_path = g_strconcat(path, LOG_INDEX_SUFFIX, NULL);
+		GByteArray *out = g_byte_array_sized_new(entries->len * LOG_INDEX_RECORD_SIZE);
+		GError *error = NULL;
+
+		for (i = 0; i < entries->len; i++) {
+			LogIndexEntry *entry = &g_array_index(entries, LogIndexEntry, i);
+			guint8 rec[LOG_INDEX_RECORD_SIZE];
+			log_index_entry_pack(rec, entry->offset, entry->time);
+			g_byte_array_append(out, rec, sizeof(rec));
+		}
+
+		if (!g_file_set_contents(index_path, (const char *)out->data, out->len, &error)) {
+			purple_debug_warning("colornicks", "Unable to save %s: %s\n",
+			                     index_path, error->message);
+			g_error_free(error);
+		}
+		g_byte_array_free(out, TRUE);
+		g_free(index_path);
+	}
+}
+
+/* Loads the index for a log mapped at contents, rebuilding it from the log
+ * when the sidecar is missing, stale or behind the log. */
+static GArray *
+log_index_load(const char *path, const char *contents, gsize len,
+               time_t log_time, gboolean writing)
+{
+	GArray *entries = log_index_read(path, len);
+
+	log_index_update(path, entries, contents, len, 0, log_time, writing);
+	return entries;
+}
+
+/* Finds the byte range [*start, *end) of a log len bytes long holding the
+ * last last_n messages if last_n is not 0, otherwise the messages from
+ * from to to inclusive. */
+static void
+log_index_window(GArray *entries, guint last_n, time_t from, time_t to,
+                 guint64 len, guint64 *start, guint64 *end)
+{
+	guint first, last;
+
+	if (last_n > 0) {
+		first = entries->len > last_n ? entries->len - last_n : 0;
+		last = entries->len;
+	} else {
+		guint lo = 0, hi = entries->len;
+
+		/* Entries are in time order, so binary search both ends */
+		while (lo < hi) {
+			guint mid = lo + (hi - lo) / 2;
+			if (g_array_index(entries, LogIndexEntry, mid).time < from)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		first = lo;
+
+		hi = entries->len;
+		while (lo < hi) {
+			guint mid = lo + (hi - lo) / 2;
+			if (g_array_index(entries, LogIndexEntry, mid).time <= to)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		last = lo;
+	}
+
+	if (first >= last) {
+		*start = *end = 0;
+	} else {
+		*start = g_array_index(entries, LogIndexEntry, first).offset;
+		*end = last < entries->len ? g_array_index(entries, LogIndexEntry, last).offset : len;
+	}
+}
+
+/* Windowed read of a compressed log: only the blocks after the last indexed
+ * message and the blocks holding the window are inflated. */
+static char *
+cz_read_window(PurpleLog *log, guint last_n, time_t from, time_t to, guint *total)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	GArray *entries = log_index_read(data->path, G_MAXUINT64);
+	gboolean writing = writer_logs != NULL && g_hash_table_contains(writer_logs, data->path);
+	guint64 base, len, start, end;
+	GString *contents;
+	char *read;
+
+	start = 0;
+	if (entries->len > 0)
+		start = g_array_index(entries, LogIndexEntry, entries->len - 1).offset + 1;
+	contents = cz_log_read(data->path, start, G_MAXUINT64, &base, &len);
+	if (contents != NULL && start > len) {
+		/* The log changed under the index */
+		g_array_set_size(entries, 0);
+		g_string_free(contents, TRUE);
+		contents = cz_log_read(data->path, 0, G_MAXUINT64, &base, &len);
+	}
+	if (contents == NULL) {
+		g_array_free(entries, TRUE);
+		return NULL;
+	}
+
+	log_index_update(data->path, entries, contents->str, contents->len, base,
+	                 log->time, writing);
+	g_string_free(contents, TRUE);
+	if (total)
+		*total = entries->len;
+
+	log_index_window(entries, last_n, from, to, len, &start, &end);
+	g_array_free(entries, TRUE);
+	if (start >= end)
+		return g_strdup("");
+
+	contents = cz_log_read(data->path, start, end, &base, NULL);
+	if (contents == NULL)
+		return NULL;
+	if (start < base || end - base > contents->len)
+		read = g_strdup("");
+	else
+		read = g_strndup(contents->str + (start - base), end - start);
+	g_string_free(contents, TRUE);
+	return read;
+}
+
+/* Windowed read of a plain log through a memory map */
+static char *
+map_read_window(PurpleLog *log, guint last_n, time_t from, time_t to, guint *total)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	GMappedFile *map;
+	GArray *entries;
+	const char *contents;
+	guint64 len, start, end;
+	gboolean writing;
+	char *read;
+
+	writing = writer_drain_path(data->path);
+
+	map = g_mapped_file_new(data->path, FALSE, NULL);
+	if (map == NULL)
+		return NULL;
+	contents = g_mapped_file_get_contents(map);
+	len = g_mapped_file_get_length(map);
+	if (contents == NULL) {
+		g_mapped_file_unref(map);
+		return g_strdup("");
+	}
+
+	entries = log_index_load(data->path, contents, len, log->time, writing);
+	if (total)
+		*total = entries->len;
+
+	log_index_window(entries, last_n, from, to, len, &start, &end);
+	read = g_strndup(contents + start, end - start);
+	g_array_free(entries, TRUE);
+	g_mapped_file_unref(map);
+
+	return read;
+}
+
+/* Reads part of a log: the last last_n messages if last_n is not 0,
+ * otherwise the messages from from to to inclusive. Returns NULL if the
+ * log cannot be read. */
+static char *
+colornicks_logger_read_window(PurpleLog *log, guint last_n, time_t from, time_t to,
+                              guint *total)
+{
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	char *read;
+	char *dir;
+
+	if (!data || !data->path)
+		return NULL;
+
+	if (purple_str_has_suffix(data->path, CZ_EXTENSION))
+		read = cz_read_window(log, last_n, from, to, total);
+	else
+		read = map_read_window(log, last_n, from, to, total);
+	if (read == NULL)
+		return NULL;
+
+	dir = g_path_get_dirname(data->path);
+	read = image_pack_resolve_tags(dir, read);
+	g_free(dir);
+
+	return read;
+}
+
+static char *
+ipc_read_last(PurpleLog *log, int last_n)
+{
+	return colornicks_logger_read_window(log, MAX(last_n, 1), 0, 0, NULL);
+}
+
+static char *
+ipc_read_range(PurpleLog *log, const time_t *range)
+{
+	return colornicks_logger_read_window(log, 0, range[0], range[1], NULL);
+}
+
+static char *colornicks_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+{
+	char *read;
+	char *dir;
+	ColorNicksLogReader *reader;
+	PurpleLogCommonLoggerData *data = log->logger_data;
+	*flags = PURPLE_LOG_READ_NO_NEWLINE;
+	if (!data || !data->path)
+		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
+
+	/* Huge logs open instantly when only their tail is shown */
+	if (read_last_messages > 0) {
+		guint total = 0;
+
+		read = colornicks_logger_read_window(log, read_last_messages, 0, 0, &total);
+		if (read != NULL && total > (guint)read_last_messages) {
+			char *notice = g_strdup_printf(_("<i>Showing the last %d of %u messages.</i><br/>\n"),
+			                               read_last_messages, total);
+			char *windowed = g_strconcat(notice, read, NULL);
+			g_free(notice);
+			g_free(read);
+			return windowed;
+		}
+		if (read != NULL)
+			return read;
+	}
+
+	reader = colornicks_log_reader_open(log);
+	if (reader == NULL)
+		return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+
+	/* The one copy libpurple needs, since it frees what we return */
+	read = g_strndup(reader->body, reader->len);
+	colornicks_log_reader_close(reader);
+
+	dir = g_path_get_dirname(data->path);
+	read = image_pack_resolve_tags(dir, read);
+	g_free(dir);
+
+	return read;
+}
+
+static int
+log_total_size(PurpleLogType type, const char *name, PurpleAccount *account, const char *ext)
+{
+	char *dir = purple_log_get_log_dir(type, name, account);
+	LogCatalog *catalog;
+	GHashTableIter iter;
+	gpointer key, value;
+	gint64 size = 0;
+
+	if (dir == NULL)
+		return 0;
+
+	catalog = log_catalog_get(dir, ext, TRUE);
+	g_hash_table_iter_init(&iter, catalog->files);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		size += ((LogCatalogFile *)value)->size;
+
+	/* Logs still being written have grown since they were cataloged. The
+	 * offsets of compressed ones are not sizes on disk, so those catch up
+	 * when they are closed. */
+	if (writer_logs != NULL) {
+		g_hash_table_iter_init(&iter, writer_logs);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			ColorNicksLogData *cdata = value;
+			char *log_dir, *filename;
+			LogCatalogFile *cataloged;
+			gboolean here;
+
+			if (cdata->compressed || !purple_str_has_suffix(key, ext))
+				continue;
+
+			/* Not a prefix test, which would take in bobby's logs for bob */
+			log_dir = g_path_get_dirname(key);
+			here = strcmp(log_dir, dir) == 0;
+			g_free(log_dir);
+			if (!here)
+				continue;
+
+			filename = g_path_get_basename(key);
+			cataloged = g_hash_table_lookup(catalog->files, filename);
+			g_free(filename);
+			if (cataloged != NULL) {
+				g_mutex_lock(&writer_lock);
+				size += (gint64)cdata->offset - cataloged->size;
+				g_mutex_unlock(&writer_lock);
+			}
+		}
+	}
+
+	g_free(dir);
+	return (int)size;
+}
+
+static int colornicks_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	return log_total_size(type, name, account, ".htm");
+}
+
+static int colornicks_gz_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	return log_total_size(type, name, account, CZ_EXTENSION);
+}
+
+
+/* Full-text search over all logs. The index lives in
+ * <user dir>/colornicks/search: "files" lists log paths one per line, the
+ * line number being the file's id, and "postings" is a series of
+ * [term length][term][posting] records. A posting is the file id in the
+ * top 24 bits and the offset of the message in the log in the low 40, as
+ * a big-endian 64-bit integer. Terms are case-folded runs of letters and
+ * digits from the message text. New postings are queued here and written
+ * out by the writer thread; the in-memory term table is only loaded for
+ * the first search. Deleted logs leave an empty line in "files", so their
+ * ids are not reused, and their postings are dropped whenever they are
+ * read. */
+#define SEARCH_OFFSET_BITS 40
+#define SEARCH_TERM_MAX 64
+#define SEARCH_POSTING(id, offset) (((guint64)(id) << SEARCH_OFFSET_BITS) | (offset))
+#define SEARCH_POSTING_FILE(p) ((guint)((p) >> SEARCH_OFFSET_BITS))
+#define SEARCH_POSTING_OFFSET(p) ((p) & ((G_GUINT64_CONSTANT(1) << SEARCH_OFFSET_BITS) - 1))
+
+typedef struct {
+	GArray *postings;       /* guint64 */
+	gboolean sorted;
+} SearchTerm;
+
+static GMutex search_lock;             /* protects everything below */
+static GMutex search_io_lock;          /* orders writes to the index files */
+static GPtrArray *search_files = NULL; /* id -> path, NULL for deleted logs */
+static GHashTable *search_file_ids = NULL;  /* path -> id + 1 */
+static GHashTable *search_terms = NULL;     /* term -> SearchTerm, NULL until loaded */
+static GString *search_pending_files = NULL;
+static GByteArray *search_pending = NULL;
+static GByteArray *search_rebuild_live = NULL;  /* postings added during a rebuild */
+
+static char *
+search_index_path(const char *name)
+{
+	return g_build_filename(purple_user_dir(), "colornicks", "search", name, NULL);
+}
+
+static void
+search_term_free(gpointer data)
+{
+	SearchTerm *term = data;
+	g_array_free(term->postings, TRUE);
+	g_slice_free(SearchTerm, term);
+}
+
+static void
+search_terms_add(GHashTable *terms, const char *word, gsize len, guint64 posting)
+{
+	SearchTerm *term;
+	char *key = g_strndup(word, len);
+
+	term = g_hash_table_lookup(terms, key);
+	if (term == NULL) {
+		term = g_slice_new(SearchTerm);
+		term->postings = g_array_new(FALSE, FALSE, sizeof(guint64));
+		term->sorted = TRUE;
+		g_hash_table_insert(terms, key, term);
+	} else {
+		g_free(key);
+	}
+
+	if (term->postings->len > 0 &&
+	    g_array_index(term->postings, guint64, term->postings->len - 1) > posting)
+		term->sorted = FALSE;
+	g_array_append_val(term->postings, posting);
+}
+
+static void
+search_record_append(GByteArray *out, const char *word, gsize len, guint64 posting)
+{
+	guint8 term_len = len;
+	guint64 be = GUINT64_TO_BE(posting);
+
+	g_byte_array_append(out, &term_len, 1);
+	g_byte_array_append(out, (const guint8 *)word, len);
+	g_byte_array_append(out, (const guint8 *)&be, sizeof(be));
+}
+
+/* Calls func once for each distinct term in an HTML message */
+static void
+search_tokenize(const char *html,
+                void (*func)(const char *word, gsize len, gpointer data),
+                gpointer data)
+{
+	char *text = purple_markup_strip_html(html);
+	char *folded = g_utf8_casefold(text, -1);
+	GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	const char *p = folded;
+	const char *word = NULL;
+
+	for (;;) {
+		gunichar c = g_utf8_get_char(p);
+
+		if (c != 0 && g_unichar_isalnum(c)) {
+			if (word == NULL)
+				word = p;
+		} else if (word != NULL) {
+			gsize len = MIN(p - word, SEARCH_TERM_MAX);
+
+			/* Don't cut a character in half */
+			while (len > 0 && len < (gsize)(p - word) && (word[len] & 0xC0) == 0x80)
+				len--;
+
+			if (len > 1) {
+				char *key = g_strndup(word, len);
+				if (!g_hash_table_contains(seen, key)) {
+					func(key, len, data);
+					g_hash_table_add(seen, key);
+				} else {
+					g_free(key);
+				}
+			}
+			word = NULL;
+		}
+
+		if (c == 0)
+			break;
+		p = g_utf8_next_char(p);
+	}
+
+	g_hash_table_destroy(seen);
+	g_free(folded);
+	g_free(text);
+}
+
+/* Returns the id of a log file, assigning one if needed. Call with search_lock held. */
+static guint
+search_file_id(const char *path)
+{
+	guint id = GPOINTER_TO_UINT(g_hash_table_lookup(search_file_ids, path));
+
+	if (id == 0) {
+		char *copy = g_strdup(path);
+		g_ptr_array_add(search_files, copy);
+		id = search_files->len;
+		g_hash_table_insert(search_file_ids, copy, GUINT_TO_POINTER(id));
+		g_string_append_printf(search_pending_files, "%s\n", path);
+	}
+
+	return id - 1;
+}
+
+typedef struct {
+	guint64 posting;
+} SearchAddContext;
+
+static void
+search_index_add_term(const char *word, gsize len, gpointer data)
+{
+	SearchAddContext *ctx = data;
+
+	search_record_append(search_pending, word, len, ctx->posting);
+	if (search_rebuild_live != NULL)
+		search_record_append(search_rebuild_live, word, len, ctx->posting);
+	if (search_terms != NULL)
+		search_terms_add(search_terms, word, len, ctx->posting);
+}
+
+static void
+search_index_add(const char *path, guint64 offset, const char *message)
+{
+	SearchAddContext ctx;
+
+	if (search_files == NULL || offset >= (G_GUINT64_CONSTANT(1) << SEARCH_OFFSET_BITS))
+		return;
+
+	g_mutex_lock(&search_lock);
+	ctx.posting = SEARCH_POSTING(search_file_id(path), offset);
+	search_tokenize(message, search_index_add_term, &ctx);
+	g_mutex_unlock(&search_lock);
+}
+
+static gboolean
+search_append_file(const char *name, const guint8 *data, gsize len)
+{
+	char *path = search_index_path(name);
+	FILE *file = g_fopen(path, "ab");
+	gboolean ok = file != NULL && fwrite(data, len, 1, file) == 1;
+
+	if (file != NULL && fclose(file) != 0)
+		ok = FALSE;
+	if (!ok)
+		report_error("Error writing %s: %s\n", path, g_strerror(errno));
+
+	g_free(path);
+	return ok;
+}
+
+/* Writes out queued file names and postings. Called on the writer thread. */
+static void
+search_index_flush(void)
+{
+	GString *files;
+	GByteArray *postings;
+
+	if (search_files == NULL)
+		return;
+
+	g_mutex_lock(&search_io_lock);
+
+	g_mutex_lock(&search_lock);
+	files = search_pending_files;
+	search_pending_files = g_string_new(NULL);
+	postings = search_pending;
+	search_pending = g_byte_array_new();
+	g_mutex_unlock(&search_lock);
+
+	/* File names first, so postings never refer to an unknown id */
+	if (files->len > 0)
+		search_append_file("files", (const guint8 *)files->str, files->len);
+	if (postings->len > 0)
+		search_append_file("postings", postings->data, postings->len);
+
+	g_mutex_unlock(&search_io_lock);
+
+	g_string_free(files, TRUE);
+	g_byte_array_free(postings, TRUE);
+}
+
+/* Whether a posting is in a log that has been deleted. Call with search_lock held. */
+static gboolean
+search_posting_dead(guint64 posting)
+{
+	guint id = SEARCH_POSTING_FILE(posting);
+	return id < search_files->len && g_ptr_array_index(search_files, id) == NULL;
+}
+
+/* Parses postings records into terms, stopping at a truncated record.
+ * Returns the number of postings of deleted logs that were skipped. Call
+ * with search_lock held. */
+static gsize
+search_terms_parse(GHashTable *terms, const guint8 *data, gsize len)
+{
+	gsize pos = 0, dead = 0;
+
+	while (pos < len) {
+		gsize term_len = data[pos];
+		guint64 posting;
+
+		if (term_len == 0 || pos + 1 + term_len + sizeof(posting) > len)
+			break;
+
+		memcpy(&posting, data + pos + 1 + term_len, sizeof(posting));
+		posting = GUINT64_FROM_BE(posting);
+		if (search_posting_dead(posting))
+			dead++;
+		else
+			search_terms_add(terms, (const char *)data + pos + 1, term_len, posting);
+		pos += 1 + term_len + sizeof(posting);
+	}
+
+	return dead;
+}
+
+/* Drops records of deleted logs from postings data, and anything after a
+ * truncated record. Call with search_lock held. */
+static void
+search_records_purge(GByteArray *records)
+{
+	gsize pos = 0, out = 0;
+
+	while (pos < records->len) {
+		gsize term_len = records->data[pos];
+		gsize record_len = 1 + term_len + sizeof(guint64);
+		guint64 posting;
+
+		if (term_len == 0 || pos + record_len > records->len)
+			break;
+
+		memcpy(&posting, records->data + pos + 1 + term_len, sizeof(posting));
+		if (!search_posting_dead(GUINT64_FROM_BE(posting))) {
+			memmove(records->data + out, records->data + pos, record_len);
+			out += record_len;
+		}
+		pos += record_len;
+	}
+
+	g_byte_array_set_size(records, out);
+}
+
+/* Drops postings of deleted logs from a term table. Call with search_lock held. */
+static void
+search_terms_purge(GHashTable *terms)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, terms);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		GArray *postings = ((SearchTerm *)value)->postings;
+		guint i, out = 0;
+
+		for (i = 0; i < postings->len; i++) {
+			guint64 posting = g_array_index(postings, guint64, i);
+			if (!search_posting_dead(posting))
+				g_array_index(postings, guint64, out++) = posting;
+		}
+		if (out == 0)
+			g_hash_table_iter_remove(&iter);
+		else
+			g_array_set_size(postings, out);
+	}
+}
+
+/* Loads the file table at plugin load; the much bigger term table waits
+ * for search_index_load_terms(). */
+static void
+search_index_init(void)
+{
+	char *dir = search_index_path(NULL);
+	char *path = search_index_path("files");
+	gchar *contents;
+
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+	search_files = g_ptr_array_new_with_free_func(g_free);
+	search_file_ids = g_hash_table_new(g_str_hash, g_str_equal);
+	search_pending_files = g_string_new(NULL);
+	search_pending = g_byte_array_new();
+
+	if (g_file_get_contents(path, &contents, NULL, NULL)) {
+		gchar **lines = g_strsplit(contents, "\n", -1);
+		int i;
+
+		/* Every name ends in a newline, so the last string is never one */
+		for (i = 0; lines[i] && lines[i + 1]; i++) {
+			if (*lines[i] == '\0') {
+				g_free(lines[i]);
+				g_ptr_array_add(search_files, NULL);
+				continue;
+			}
+			g_ptr_array_add(search_files, lines[i]);
+			g_hash_table_insert(search_file_ids, lines[i], GUINT_TO_POINTER(search_files->len));
+		}
+		/* The strings now belong to search_files */
+		for (; lines[i]; i++)
+			g_free(lines[i]);
+		g_free(lines);
+		g_free(contents);
+	}
+
+	g_free(path);
+	g_free(dir);
+}
+
+static void
+search_index_load_terms(void)
+{
+	char *path;
+	GMappedFile *map;
+
+	if (search_terms != NULL)
+		return;
+
+	/* Get everything queued so far onto the disk first */
+	search_index_flush();
+
+	path = search_index_path("postings");
+	g_mutex_lock(&search_io_lock);
+	g_mutex_lock(&search_lock);
+	search_terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, search_term_free);
+	if ((map = g_mapped_file_new(path, FALSE, NULL)) != NULL) {
+		const guint8 *contents = (const guint8 *)g_mapped_file_get_contents(map);
+		gsize len = g_mapped_file_get_length(map);
+
+		/* The file is being read whole anyway, so this is when postings of
+		 * deleted logs leave it */
+		if (contents != NULL && search_terms_parse(search_terms, contents, len) > 0) {
+			GByteArray *records = g_byte_array_sized_new(len);
+
+			g_byte_array_append(records, contents, len);
+			search_records_purge(records);
+			if (!g_file_set_contents(path, (const char *)records->data, records->len, NULL))
+				purple_debug_warning("colornicks", "Unable to compact %s\n", path);
+			g_byte_array_free(records, TRUE);
+		}
+		g_mapped_file_unref(map);
+	}
+	g_mutex_unlock(&search_lock);
+	g_mutex_unlock(&search_io_lock);
+	g_free(path);
+}
+
+/* Forgets a deleted log, dropping its postings from the loaded terms */
+static void
+search_index_forget(const char *path)
+{
+	char *files_path;
+	GString *files;
+	GError *error = NULL;
+	guint id, i;
+
+	if (search_files == NULL)
+		return;
+
+	g_mutex_lock(&search_io_lock);
+	g_mutex_lock(&search_lock);
+	id = GPOINTER_TO_UINT(g_hash_table_lookup(search_file_ids, path));
+	if (id == 0) {
+		g_mutex_unlock(&search_lock);
+		g_mutex_unlock(&search_io_lock);
+		return;
+	}
+
+	g_hash_table_remove(search_file_ids, path);
+	g_free(g_ptr_array_index(search_files, id - 1));
+	g_ptr_array_index(search_files, id - 1) = NULL;
+	if (search_terms != NULL)
+		search_terms_purge(search_terms);
+
+	/* The whole list is written out, including names still queued */
+	files = g_string_new(NULL);
+	for (i = 0; i < search_files->len; i++) {
+		const char *file = g_ptr_array_index(search_files, i);
+		g_string_append_printf(files, "%s\n", file != NULL ? file : "");
+	}
+	g_string_truncate(search_pending_files, 0);
+	g_mutex_unlock(&search_lock);
+
+	files_path = search_index_path("files");
+	if (!g_file_set_contents(files_path, files->str, files->len, &error)) {
+		purple_debug_error("colornicks", "Unable to save %s: %s\n",
+		                   files_path, error->message);
+		g_error_free(error);
+	}
+	g_mutex_unlock(&search_io_lock);
+
+	g_free(files_path);
+	g_string_free(files, TRUE);
+}
+
+static void
+search_index_free(void)
+{
+	search_index_flush();
+
+	if (search_terms != NULL)
+		g_hash_table_destroy(search_terms);
+	search_terms = NULL;
+	g_hash_table_destroy(search_file_ids);
+	search_file_ids = NULL;
+	g_ptr_array_free(search_files, TRUE);
+	search_files = NULL;
+	g_string_free(search_pending_files, TRUE);
+	search_pending_files = NULL;
+	g_byte_array_free(search_pending, TRUE);
+	search_pending = NULL;
+}
+
+static gint
+search_posting_cmp(gconstpointer a, gconstpointer b)
+{
+	guint64 pa = *(const guint64 *)a, pb = *(const guint64 *)b;
+	return (pa > pb) - (pa < pb);
+}
+
+static void
+search_query_term(const char *word, gsize len, gpointer data)
+{
+	GPtrArray *lists = data;
+	SearchTerm *term = g_hash_table_lookup(search_terms, word);
+
+	if (term != NULL && !term->sorted) {
+		g_array_sort(term->postings, search_posting_cmp);
+		term->sorted = TRUE;
+	}
+	g_ptr_array_add(lists, term);
+}
+
+/* Returns the postings of messages that contain every term in query,
+ * newest first, at most max of them. */
+static GArray *
+search_index_query(const char *query, guint max)
+{
+	GArray *hits = g_array_new(FALSE, FALSE, sizeof(guint64));
+	GPtrArray *lists = g_ptr_array_new();
+	guint *pos;
+	guint i, n;
+
+	search_index_load_terms();
+
+	g_mutex_lock(&search_lock);
+	search_tokenize(query, search_query_term, lists);
+
+	n = lists->len;
+	for (i = 0; i < n; i++)
+		if (g_ptr_array_index(lists, i) == NULL)
+			n = 0;
+
+	/* Walk all sorted lists backwards, collecting postings they share */
+	pos = g_new(guint, MAX(n, 1));
+	for (i = 0; i < n; i++)
+		pos[i] = ((SearchTerm *)g_ptr_array_index(lists, i))->postings->len;
+
+#define TAIL(i) g_array_index(((SearchTerm *)g_ptr_array_index(lists, i))->postings, guint64, pos[i] - 1)
+	while (n > 0 && hits->len < max) {
+		guint64 top = G_MAXUINT64;
+		gboolean all = TRUE, done = FALSE;
+
+		/* No shared posting can be above the smallest tail */
+		for (i = 0; i < n && !done; i++) {
+			if (pos[i] == 0)
+				done = TRUE;
+			else if (TAIL(i) < top)
+				top = TAIL(i);
+		}
+
+		for (i = 0; i < n && !done; i++) {
+			while (pos[i] > 0 && TAIL(i) > top)
+				pos[i]--;
+			if (pos[i] == 0)
+				done = TRUE;
+			else if (TAIL(i) != top)
+				all = FALSE;
+		}
+		if (done)
+			break;
+
+		if (all) {
+			g_array_append_val(hits, top);
+			for (i = 0; i < n; i++)
+				while (pos[i] > 0 && TAIL(i) == top)
+					pos[i]--;
+		}
+	}
+#undef TAIL
+
+	g_mutex_unlock(&search_lock);
+	g_free(pos);
+	g_ptr_array_free(lists, TRUE);
+	return hits;
+}
+
+/* Reads the logged line a posting points at */
+static char *
+search_hit_line(const char *path, guint64 offset)
+{
+	char buf[1024];
+	char *nl;
+	FILE *file;
+	size_t n;
+
+	if (purple_str_has_suffix(path, CZ_EXTENSION)) {
+		guint64 base;
+		GString *block = cz_log_read(path, offset, offset + 1, &base, NULL);
+		char *line = NULL;
+
+		if (block != NULL && offset >= base && offset - base < block->len) {
+			const char *start = block->str + (offset - base);
+			gsize left = block->len - (offset - base);
+
+			nl = memchr(start, '\n', left);
+			line = g_strndup(start, nl ? (gsize)(nl - start) : MIN(left, sizeof(buf) - 1));
+		}
+		if (block != NULL)
+			g_string_free(block, TRUE);
+		return line;
+	}
+
+	writer_drain_path(path);
+	if ((file = g_fopen(path, "rb")) == NULL)
+		return NULL;
+	if (fseek(file, (long)offset, SEEK_SET) != 0) {
+		fclose(file);
+		return NULL;
+	}
+	n = fread(buf, 1, sizeof(buf) - 1, file);
+	fclose(file);
+
+	buf[n] = '\0';
+	if ((nl = strchr(buf, '\n')) != NULL)
+		*nl = '\0';
+	return g_strdup(buf);
+}
+
+static void
+search_logs_cb(PurplePlugin *plugin, const char *query)
+{
+	gint64 start = g_get_monotonic_time();
+	GArray *hits;
+	GString *out;
+	guint i;
+
+	if (query == NULL || *query == '\0')
+		return;
+
+	hits = search_index_query(query, 200);
+	out = g_string_new(NULL);
+	g_string_append_printf(out, _("%u matches in %.1f ms.<br/><br/>"), hits->len,
+	                       (g_get_monotonic_time() - start) / 1000.0);
+
+	for (i = 0; i < hits->len; i++) {
+		guint64 posting = g_array_index(hits, guint64, i);
+		const char *path;
+		char *line, *name;
+
+		g_mutex_lock(&search_lock);
+		path = SEARCH_POSTING_FILE(posting) < search_files->len ?
+			g_ptr_array_index(search_files, SEARCH_POSTING_FILE(posting)) : NULL;
+		g_mutex_unlock(&search_lock);
+		if (path == NULL)
+			continue;
+
+		line = search_hit_line(path, SEARCH_POSTING_OFFSET(posting));
+		if (line == NULL)
+			continue;
+
+		name = g_markup_escape_text(path, -1);
+		g_string_append_printf(out, "<b>%s</b><br/>%s<br/>", name, line);
+		g_free(name);
+		g_free(line);
+	}
+
+	purple_notify_formatted(plugin, _("Search Logs"), _("Search results"),
+	                        query, out->str, NULL, NULL);
+	g_string_free(out, TRUE);
+	g_array_free(hits, TRUE);
+}
+
+static void
+search_logs_action(PurplePluginAction *action)
+{
+	if (!use_search_index)
+		purple_notify_info(action->plugin, _("Search Logs"), _("Indexing is off"),
+		                   _("New messages are not being indexed. Turn on \"Index messages "
+		                     "for searching\" in the plugin preferences and rebuild the "
+		                     "index to search all logs."));
+	purple_request_input(action->plugin, _("Search Logs"), _("Search all logs"),
+	                     _("Messages containing all of these words are shown, newest first."),
+	                     NULL, FALSE, FALSE, NULL,
+	                     _("_Search"), G_CALLBACK(search_logs_cb),
+	                     _("_Cancel"), NULL,
+	                     NULL, NULL, NULL, action->plugin);
+}
+
+/* Rebuilding scans every .htm and .htmz under the logs directory on its own thread,
+ * into new postings that replace the old ones when it is done. */
+typedef struct {
+	PurplePlugin *plugin;
+	GThread *thread;
+	volatile gboolean cancel;
+	GHashTable *terms;
+	GByteArray *postings;
+	guint files;
+	gsize bytes;
+} SearchRebuild;
+
+static SearchRebuild *search_rebuild = NULL;
+
+/* Waits for the rebuild thread and frees what it left behind */
+static void
+search_rebuild_free(SearchRebuild *rebuild)
+{
+	g_thread_join(rebuild->thread);
+	g_source_remove_by_user_data(rebuild);
+	if (rebuild->terms != NULL)
+		g_hash_table_destroy(rebuild->terms);
+	g_byte_array_free(rebuild->postings, TRUE);
+	g_free(rebuild);
+}
+
+static void
+search_rebuild_add_term(const char *word, gsize len, gpointer data)
+{
+	gpointer *ctx = data;
+	SearchRebuild *rebuild = ctx[0];
+	guint64 posting = *(guint64 *)ctx[1];
+
+	search_terms_add(rebuild->terms, word, len, posting);
+	search_record_append(rebuild->postings, word, len, posting);
+}
+
+static void
+search_rebuild_file(SearchRebuild *rebuild, const char *path)
+{
+	GMappedFile *map = NULL;
+	GString *inflated = NULL;
+	const char *contents;
+	gsize len, pos = 0;
+	guint id;
+
+	if (purple_str_has_suffix(path, CZ_EXTENSION)) {
+		guint64 base, total;
+
+		/* Whatever is still held back for the next block is indexed live */
+		if ((inflated = cz_read(path, 0, G_MAXUINT64, &base, &total)) == NULL)
+			return;
+		contents = inflated->str;
+		len = inflated->len;
+	} else {
+		if ((map = g_mapped_file_new(path, FALSE, NULL)) == NULL)
+			return;
+		contents = g_mapped_file_get_contents(map);
+		len = g_mapped_file_get_length(map);
+	}
+
+	g_mutex_lock(&search_lock);
+	id = search_file_id(path);
+	g_mutex_unlock(&search_lock);
+
+	while (contents != NULL && pos < len) {
+		const char *line = contents + pos;
+		const char *nl = memchr(line, '\n', len - pos);
+		gsize line_len = nl ? (gsize)(nl - line) : len - pos;
+
+		if (pos > 0 && line_len >= 5 &&
+		    (strncmp(line, "<font", 5) == 0 || strncmp(line, "---- ", 5) == 0)) {
+			char *html = g_strndup(line, line_len);
+			guint64 posting = SEARCH_POSTING(id, pos);
+			gpointer ctx[2];
+
+			ctx[0] = rebuild;
+			ctx[1] = &posting;
+			search_tokenize(html, search_rebuild_add_term, ctx);
+			g_free(html);
+		}
+
+		pos += line_len + 1;
+	}
+
+	rebuild->files++;
+	rebuild->bytes += len;
+	if (map != NULL)
+		g_mapped_file_unref(map);
+	if (inflated != NULL)
+		g_string_free(inflated, TRUE);
+}
+
+static void
+search_rebuild_dir(SearchRebuild *rebuild, const char *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+
+	if (dir == NULL)
+		return;
+
+	while (!rebuild->cancel && (name = g_dir_read_name(dir)) != NULL) {
+		char *child = g_build_filename(path, name, NULL);
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR))
+			search_rebuild_dir(rebuild, child);
+		else if (purple_str_has_suffix(name, ".htm") || purple_str_has_suffix(name, CZ_EXTENSION))
+			search_rebuild_file(rebuild, child);
+		g_free(child);
+	}
+	g_dir_close(dir);
+}
 
-static char *
-get_nick_color(PidginConversation *gtkconv, const char *name)
+static gboolean
+search_rebuild_done(gpointer data)
 {
-	static GdkColor col;
-	GtkStyle *style;
-	float scale;
+	SearchRebuild *rebuild = data;
+	char *path = search_index_path("postings");
+	char *msg;
+	GError *error = NULL;
 
-	g_return_val_if_fail(name != NULL && gtkconv != NULL && gtkconv->nick_colors != NULL, NULL);
+	/* Everything logged since the rebuild started goes on top */
+	search_index_flush();
+	g_mutex_lock(&search_io_lock);
+	g_mutex_lock(&search_lock);
+	search_terms_parse(rebuild->terms, search_rebuild_live->data, search_rebuild_live->len);
+	g_byte_array_append(rebuild->postings, search_rebuild_live->data, search_rebuild_live->len);
 
-	style = gtk_widget_get_style(gtkconv->webview);
-	col = g_array_index(gtkconv->nick_colors, GdkColor, g_str_hash(name) % gtkconv->nick_colors->len);
-	scale = ((1-(LUMINANCE(style->base[GTK_STATE_NORMAL]) / LUMINANCE(style->white))) *
-		       (LUMINANCE(style->white)/MAX(MAX(col.red, col.blue), col.green)));
+	/* Logs deleted while the rebuild ran */
+	search_terms_purge(rebuild->terms);
+	search_records_purge(rebuild->postings);
+	g_byte_array_free(search_rebuild_live, TRUE);
+	search_rebuild_live = NULL;
 
-	/* The colors are chosen to look fine on white; we should never have to darken */
-	if (scale > 1) {
-		col.red   *= scale;
-		col.green *= scale;
-		col.blue  *= scale;
+	if (g_file_set_contents(path, (const char *)rebuild->postings->data,
+	                        rebuild->postings->len, &error)) {
+		if (search_terms != NULL)
+			g_hash_table_destroy(search_terms);
+		search_terms = rebuild->terms;
+		rebuild->terms = NULL;
+		msg = g_strdup_printf(_("Indexed %u logs (%" G_GSIZE_FORMAT " bytes)."),
+		                      rebuild->files, rebuild->bytes);
+	} else {
+		msg = g_strdup(error->message);
+		g_error_free(error);
 	}
+	g_mutex_unlock(&search_lock);
+	g_mutex_unlock(&search_io_lock);
 
-	return g_strdup_printf("#%02x%02x%02x", (col.red >> 8), (col.green >> 8), (col.blue >> 8));
+	purple_notify_info(rebuild->plugin, _("Search Logs"), _("Search index rebuilt"), msg);
+
+	g_free(msg);
+	g_free(path);
+	search_rebuild = NULL;
+	search_rebuild_free(rebuild);
+	return FALSE;
 }
 
-/* NOTE: This can return msg (which you may or may not want to g_free())
- * NOTE: or a newly allocated string which you MUST g_free(). */
-static char *
-convert_image_tags(const PurpleLog *log, const char *msg)
+static gpointer
+search_rebuild_thread(gpointer data)
 {
-	const char *tmp;
-	const char *start;
-	const char *end;
-	GData *attributes;
-	GString *newmsg = NULL;
+	SearchRebuild *rebuild = data;
+	char *logs = g_build_filename(purple_user_dir(), "logs", NULL);
 
-	tmp = msg;
+	search_rebuild_dir(rebuild, logs);
+	g_free(logs);
 
-	while (purple_markup_find_tag("img", tmp, &start, &end, &attributes)) {
-		int imgid = 0;
-		char *idstr = NULL;
+	if (!rebuild->cancel)
+		g_idle_add(search_rebuild_done, rebuild);
+	return NULL;
+}
 
-		if (newmsg == NULL)
-			newmsg = g_string_new("");
+static void
+search_rebuild_action(PurplePluginAction *action)
+{
+	SearchRebuild *rebuild;
 
-		/* copy any text before the img tag */
-		if (tmp < start)
-			g_string_append_len(newmsg, tmp, start - tmp);
+	if (search_rebuild != NULL)
+		return;
 
-		if ((idstr = g_datalist_get_data(&attributes, "id")) != NULL)
-			imgid = atoi(idstr);
+	search_rebuild = rebuild = g_new0(SearchRebuild, 1);
+	rebuild->plugin = action->plugin;
+	rebuild->terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, search_term_free);
+	rebuild->postings = g_byte_array_new();
 
-		if (imgid != 0)
-		{
-			FILE *image_file;
-			char *dir;
-			PurpleStoredImage *image;
-			gconstpointer image_data;
-			char *new_filename = NULL;
-			char *path = NULL;
-			size_t image_byte_count;
+	g_mutex_lock(&search_lock);
+	search_rebuild_live = g_byte_array_new();
+	g_mutex_unlock(&search_lock);
 
-			image = purple_imgstore_find_by_id(imgid);
-			if (image == NULL)
-			{
-				/* This should never happen. */
-				/* This *does* happen for failed Direct-IMs -DAA */
-				g_string_free(newmsg, TRUE);
-				g_return_val_if_reached((char *)msg);
-			}
+	rebuild->thread = g_thread_new("colornicks-reindex", search_rebuild_thread, rebuild);
+}
 
-			image_data       = purple_imgstore_get_data(image);
-			image_byte_count = purple_imgstore_get_size(image);
-			dir              = purple_log_get_log_dir(log->type, log->name, log->account);
-			new_filename     = purple_util_get_image_filename(image_data, image_byte_count);
+/* Recoloring adds nick colors to logs written by the stock HTML logger.
+ * Received messages there have the fixed color the colornicks templates
+ * fall back to, so each line is matched against the template, and if it
+ * fits, rendered again with the nick's color. The palette is taken from an
+ * open conversation, so it matches the current theme. Files are recolored
+ * in parallel on a thread pool, a line at a time into a temporary file
+ * that replaces the log when done. Finished files are recorded in a
+ * checkpoint, so an interrupted run picks up where it stopped.
+ *
+ * This is a plugin action rather than a separate batch tool, since the
+ * palette comes from the running conversation theme and the templates
+ * from the plugin. GThreadPool stands in for a work-stealing pool: files
+ * are the unit of work, and handing them out largest first keeps the
+ * workers evenly loaded. Replaced files are passed to
+ * log_catalog_update() once the run finishes. */
+typedef struct {
+	PurplePlugin *plugin;
+	GThread *thread;
+	GThreadPool *pool;
+	volatile gboolean cancel;
+	char **palette;
+	guint palette_len;
+	GHashTable *done;          /* paths finished by an earlier run */
+	GArray *queue;             /* RecolorFile, largest first */
+	GMutex lock;               /* protects checkpoint, rewritten and the counters */
+	FILE *checkpoint;
+	GPtrArray *rewritten;      /* paths of replaced files */
+	guint files;
+	guint lines;
+	guint64 bytes;
+	gint64 start;
+} RecolorJob;
 
-			path = g_build_filename(dir, new_filename, NULL);
+typedef struct {
+	char *path;
+	goffset size;
+} RecolorFile;
 
-			/* Only save unique files. */
-			if (!g_file_test(path, G_FILE_TEST_EXISTS))
-			{
-				if ((image_file = g_fopen(path, "wb")) != NULL)
-				{
-					if (!fwrite(image_data, image_byte_count, 1, image_file))
-					{
-						purple_debug_error("log", "Error writing %s: %s\n",
-						                   path, g_strerror(errno));
-						fclose(image_file);
+static RecolorJob *recolor_job = NULL;
 
-						/* Attempt to not leave half-written files around. */
-						if (g_unlink(path)) {
-							purple_debug_error("log", "Error deleting partial "
-									"file %s: %s\n", path, g_strerror(errno));
-						}
-					}
-					else
-					{
-						purple_debug_info("log", "Wrote image file: %s\n", path);
-						fclose(image_file);
-					}
-				}
-				else
-				{
-					purple_debug_error("log", "Unable to create file %s: %s\n",
-					                   path, g_strerror(errno));
-				}
-			}
+static char *
+recolor_checkpoint_path(void)
+{
+	return g_build_filename(purple_user_dir(), "colornicks", "recolor.done", NULL);
+}
 
-			/* Write the new image tag */
-			g_string_append_printf(newmsg, "<IMG SRC=\"%s\">", new_filename);
-			g_free(new_filename);
-			g_free(path);
-		}
+/* Finds len bytes of text in [p, end). Template literals point into their
+ * format and are not NUL-terminated where they end. */
+static const char *
+line_find_literal(const char *p, const char *end, const char *text, gsize len)
+{
+	if (len == 0)
+		return p;
 
-		/* Continue from the end of the tag */
-		tmp = end + 1;
+	for (; (gsize)(end - p) >= len; p++) {
+		if ((p = memchr(p, text[0], end - p - len + 1)) == NULL)
+			return NULL;
+		if (memcmp(p, text, len) == 0)
+			return p;
 	}
+	return NULL;
+}
 
-	if (newmsg == NULL)
-	{
-		/* No images were found to change. */
-		return (char *)msg;
-	}
+/* Matches a line against the template of a kind, filling values with
+ * what its slots hold. Slots are copied out of the line. */
+static gboolean
+line_match(LineKind kind, const char *line, gsize len, char **values)
+{
+	GArray *segments = line_templates[kind];
+	const char *p = line, *end = line + len;
+	guint i;
 
-	/* Append any remaining message data */
-	g_string_append(newmsg, tmp);
+	if (segments == NULL)
+		return FALSE;
 
-	return g_string_free(newmsg, FALSE);
-}
+	for (i = 0; i < segments->len; i++) {
+		const LineSegment *segment = &g_array_index(segments, LineSegment, i);
+		const LineSegment *next;
+		const char *stop;
 
-static char *log_get_timestamp(PurpleLog *log, time_t when)
-{
-	gboolean show_date;
-	char *date;
-	struct tm tm;
+		if (segment->text != NULL) {
+			if ((gsize)(end - p) < segment->len || memcmp(p, segment->text, segment->len) != 0)
+				return FALSE;
+			p += segment->len;
+			continue;
+		}
 
-	show_date = (log->type == PURPLE_LOG_SYSTEM) || (time(NULL) > when + 20*60);
+		/* A slot runs up to the next literal, or the end of the line for
+		 * the last literal */
+		next = i + 1 < segments->len ? &g_array_index(segments, LineSegment, i + 1) : NULL;
+		if (next == NULL)
+			stop = end;
+		else if (i + 2 == segments->len)
+			stop = end - next->len;
+		else
+			stop = line_find_literal(p, end, next->text, next->len);
+		if (stop == NULL || stop < p)
+			return FALSE;
 
-	date = purple_signal_emit_return_1(purple_log_get_handle(),
-	                          "log-timestamp",
-	                          log, when, show_date);
-	if (date != NULL)
-		return date;
+		g_free(values[segment->slot]);
+		values[segment->slot] = g_strndup(p, stop - p);
+		p = stop;
+	}
 
-	tm = *(localtime(&when));
-	if (show_date)
-		return g_strdup(purple_date_format_long(&tm));
-	else
-		return g_strdup(purple_time_format(&tm));
+	return p == end;
 }
 
-static gsize colornicks_logger_write(PurpleLog *log, PurpleMessageFlags type,
-							  const char *from, time_t time, const char *message)
+/* Recolors one line into out, returning whether it was changed */
+static gboolean
+recolor_line(RecolorJob *job, const char *line, gsize len, GString *out)
 {
-	char *msg_fixed;
-	char *image_corrected_msg;
-	char *date;
-	char *header;
-	char *escaped_from;
-	char *nick_color;
-	PurplePlugin *plugin = purple_find_prpl(purple_account_get_protocol_id(log->account));
-	PurpleLogCommonLoggerData *data = log->logger_data;
-	gsize written = 0;
+	/* An auto-reply also fits the plain template, with the tag taken for
+	 * part of the nick, so it is tried first */
+	static const LineKind kinds[] = { LINE_AUTO_REPLY_RECV, LINE_RECV };
+	gboolean changed = FALSE;
+	guint k;
 
-	if (!data) {
-		const char *prpl =
-			PURPLE_PLUGIN_PROTOCOL_INFO(plugin)->list_icon(log->account, NULL);
-		const char *date;
-		purple_log_common_writer(log, ".htm");
+	for (k = 0; k < G_N_ELEMENTS(kinds) && !changed; k++) {
+		char *values[SLOT_NONE] = { NULL, NULL, NULL, NULL };
+		int slot;
 
-		data = log->logger_data;
+		/* Only lines still in the fallback color, or they are colored already */
+		if (line_match(kinds[k], line, len, values) &&
+		    g_strcmp0(values[SLOT_COLOR], line_formats[kinds[k]].color) == 0) {
+			const char *color = job->palette[g_str_hash(values[SLOT_FROM]) % job->palette_len];
+			line_render(out, kinds[k], color, values[SLOT_DATE],
+			            values[SLOT_FROM], values[SLOT_MESSAGE]);
+			changed = TRUE;
+		}
 
-		/* if we can't write to the file, give up before we hurt ourselves */
-		if (!data->file)
-			return 0;
+		for (slot = 0; slot < SLOT_NONE; slot++)
+			g_free(values[slot]);
+	}
 
-		date = purple_date_format_full(localtime(&log->time));
+	if (!changed)
+		g_string_append_len(out, line, len);
+	return changed;
+}
 
-		written += fprintf(data->file, "<html><head>");
-		written += fprintf(data->file, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
-		written += fprintf(data->file, "<title>");
-		if (log->type == PURPLE_LOG_SYSTEM)
-			header = g_strdup_printf("System log for account %s (%s) connected at %s",
-					purple_account_get_username(log->account), prpl, date);
-		else
-			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
-					log->name, date, purple_account_get_username(log->account), prpl);
+/* Reads a line, with its newline, into line. Returns FALSE at the end. */
+static gboolean
+recolor_read_line(FILE *file, GString *line)
+{
+	char buf[4096];
 
-		written += fprintf(data->file, "%s", header);
-		written += fprintf(data->file, "</title></head><body>");
-		written += fprintf(data->file, "<h3>%s</h3>\n", header);
-		g_free(header);
+	g_string_truncate(line, 0);
+	while (fgets(buf, sizeof(buf), file) != NULL) {
+		g_string_append(line, buf);
+		if (line->len > 0 && line->str[line->len - 1] == '\n')
+			break;
 	}
+	return line->len > 0;
+}
 
-	/* if we can't write to the file, give up before we hurt ourselves */
-	if (!data->file)
-		return 0;
+static void
+recolor_file(gpointer data, gpointer user_data)
+{
+	char *path = data;
+	RecolorJob *job = user_data;
+	char *tmp_path = g_strconcat(path, ".recolor", NULL);
+	GString *line = g_string_sized_new(1024);
+	GString *out = g_string_sized_new(64 * 1024);
+	FILE *in, *tmp = NULL;
+	guint64 bytes = 0;
+	guint lines = 0;
+	gboolean ok = FALSE;
 
-	escaped_from = g_markup_escape_text(from, -1);
-	nick_color = get_nick_color(PIDGIN_CONVERSATION(log->conv), escaped_from);
+	if (job->cancel || (in = g_fopen(path, "rb")) == NULL)
+		goto out;
+	if ((tmp = g_fopen(tmp_path, "wb")) == NULL) {
+		fclose(in);
+		goto out;
+	}
 
-	image_corrected_msg = convert_image_tags(log, message);
-	purple_markup_html_to_xhtml(image_corrected_msg, &msg_fixed, NULL);
+	ok = TRUE;
+	while (ok && !job->cancel && recolor_read_line(in, line)) {
+		bytes += line->len;
+		if (recolor_line(job, line->str, line->len, out))
+			lines++;
+		if (out->len >= 64 * 1024) {
+			ok = fwrite(out->str, out->len, 1, tmp) == 1;
+			g_string_truncate(out, 0);
+		}
+	}
+	if (ok && out->len > 0)
+		ok = fwrite(out->str, out->len, 1, tmp) == 1;
+	ok = ok && !job->cancel && !ferror(in);
 
-	/* Yes, this breaks encapsulation.  But it's a static function and
-	 * this saves a needless strdup(). */
-	if (image_corrected_msg != message)
-		g_free(image_corrected_msg);
+	fclose(in);
+	if (fclose(tmp) != 0)
+		ok = FALSE;
 
-	date = log_get_timestamp(log, time);
+	/* Files with nothing to recolor are left alone */
+	if (ok && lines > 0 && g_rename(tmp_path, path) != 0) {
+		report_error("Unable to replace %s: %s\n", path, g_strerror(errno));
+		ok = FALSE;
+	}
 
-	if (log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----<br/>\n", msg_fixed, date);
-	} else {
-		if (type & PURPLE_MESSAGE_SYSTEM)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_ERROR)
-			written += fprintf(data->file, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
-		else if (type & PURPLE_MESSAGE_WHISPER) {
-			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, "<font color=\"#6C2585\"><font size=\"2\">(%s)</font><b> %s &lt;whisper&gt;:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"%s\"><font size=\"2\">(%s)</font><b> %s &lt;whisper&gt;:</b></font> %s<br/>\n",
-						(nick_color ? nick_color : "#6C2585"), date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_AUTO_RESP) {
-			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"),
-						date, escaped_from, msg_fixed);
-			else if (type & PURPLE_MESSAGE_RECV)
-				written += fprintf(data->file, _("<font color=\"%s\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"),
-						(nick_color ? nick_color : "#A82F2F"), date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_RECV) {
-			if (purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"%s\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
-						(nick_color ? nick_color : "#062585"), date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"%s\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
-						(nick_color ? nick_color : "#A82F2F"), date, escaped_from, msg_fixed);
-		} else if (type & PURPLE_MESSAGE_SEND) {
-			if (purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-			else
-				written += fprintf(data->file, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
-		} else {
-			purple_debug_error("log", "Unhandled message type.\n");
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
-						date, escaped_from, msg_fixed);
+out:
+	g_unlink(tmp_path);
+	if (ok) {
+		g_mutex_lock(&job->lock);
+		if (lines > 0)
+			g_ptr_array_add(job->rewritten, g_strdup(path));
+		job->files++;
+		job->lines += lines;
+		job->bytes += bytes;
+		if (job->checkpoint != NULL) {
+			fprintf(job->checkpoint, "%s\n", path);
+			fflush(job->checkpoint);
 		}
+		g_mutex_unlock(&job->lock);
 	}
-	g_free(date);
-	g_free(msg_fixed);
-	g_free(escaped_from);
-	g_free(nick_color);
-	fflush(data->file);
 
-	return written;
+	g_string_free(out, TRUE);
+	g_string_free(line, TRUE);
+	g_free(tmp_path);
+	g_free(path);
 }
 
-static void colornicks_logger_finalize(PurpleLog *log)
+static void
+recolor_dir(RecolorJob *job, const char *path)
 {
-	PurpleLogCommonLoggerData *data = log->logger_data;
-	if (data) {
-		if (data->file) {
-			fprintf(data->file, "</body></html>\n");
-			fclose(data->file);
-		}
-		g_free(data->path);
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
 
-		g_slice_free(PurpleLogCommonLoggerData, data);
+	if (dir == NULL)
+		return;
+
+	while (!job->cancel && (name = g_dir_read_name(dir)) != NULL) {
+		char *child = g_build_filename(path, name, NULL);
+		GStatBuf st;
+
+		if (g_file_test(child, G_FILE_TEST_IS_DIR)) {
+			recolor_dir(job, child);
+		} else if (purple_str_has_suffix(name, ".html") &&
+		           !g_hash_table_contains(job->done, child) && g_stat(child, &st) == 0) {
+			RecolorFile file;
+			file.path = child;
+			file.size = st.st_size;
+			g_array_append_val(job->queue, file);
+			child = NULL;
+		}
+		g_free(child);
 	}
+	g_dir_close(dir);
 }
 
-static GList *colornicks_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account)
+/* Large files go first, so one of them is not left running alone at the end */
+static gint
+recolor_file_compare(gconstpointer a, gconstpointer b)
 {
-	return purple_log_common_lister(type, sn, account, ".htm", colornicks_logger);
+	goffset x = ((const RecolorFile *)a)->size, y = ((const RecolorFile *)b)->size;
+	return x < y ? 1 : x > y ? -1 : 0;
 }
 
-static GList *colornicks_logger_list_syslog(PurpleAccount *account)
+static void
+recolor_job_free(RecolorJob *job)
 {
-	return purple_log_common_lister(PURPLE_LOG_SYSTEM, ".system", account, ".htm", colornicks_logger);
+	guint i;
+
+	g_thread_join(job->thread);
+	g_source_remove_by_user_data(job);
+	for (i = 0; i < job->queue->len; i++)
+		g_free(g_array_index(job->queue, RecolorFile, i).path);
+	g_array_free(job->queue, TRUE);
+	if (job->checkpoint != NULL)
+		fclose(job->checkpoint);
+	g_mutex_clear(&job->lock);
+	g_ptr_array_free(job->rewritten, TRUE);
+	g_hash_table_destroy(job->done);
+	g_strfreev(job->palette);
+	g_free(job);
 }
 
-static char *colornicks_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
+static gboolean
+recolor_done(gpointer data)
 {
-	char *read;
-	PurpleLogCommonLoggerData *data = log->logger_data;
-	*flags = PURPLE_LOG_READ_NO_NEWLINE;
-	if (!data || !data->path)
-		return g_strdup(_("<font color=\"red\"><b>Unable to find log path!</b></font>"));
-	if (g_file_get_contents(data->path, &read, NULL, NULL)) {
-		char *minus_header = strchr(read, '\n');
+	RecolorJob *job = data;
+	double seconds = (g_get_monotonic_time() - job->start) / (double)G_USEC_PER_SEC;
+	char *msg;
+	guint i;
 
-		if (!minus_header)
-			return read;
+	/* The catalogs belong to the main thread. A cancelled run leaves this
+	 * to the catalog refresh, as replacing a file changes its directory. */
+	for (i = 0; i < job->rewritten->len; i++)
+		log_catalog_update(g_ptr_array_index(job->rewritten, i));
 
-		minus_header = g_strdup(minus_header + 1);
-		g_free(read);
+	msg = g_strdup_printf(_("Recolored %u lines in %u logs (%.1f MB in %.1f s, %.1f MB/s)."),
+	                      job->lines, job->files, job->bytes / 1048576.0, seconds,
+	                      seconds > 0 ? job->bytes / 1048576.0 / seconds : 0.0);
+	purple_notify_info(job->plugin, _("Recolor Logs"), _("Recoloring finished"), msg);
+	g_free(msg);
 
-		return minus_header;
-	}
-	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
+	recolor_job = NULL;
+	recolor_job_free(job);
+	return FALSE;
 }
 
-static int colornicks_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+static gpointer
+recolor_thread(gpointer data)
 {
-	return purple_log_common_total_sizer(type, name, account, ".htm");
+	RecolorJob *job = data;
+	char *logs = g_build_filename(purple_user_dir(), "logs", NULL);
+	guint i;
+
+	recolor_dir(job, logs);
+	g_free(logs);
+
+	/* The pool hands files to whichever worker is free, in this order */
+	g_array_sort(job->queue, recolor_file_compare);
+	for (i = 0; i < job->queue->len && !job->cancel; i++) {
+		g_thread_pool_push(job->pool, g_array_index(job->queue, RecolorFile, i).path, NULL);
+		g_array_index(job->queue, RecolorFile, i).path = NULL;
+	}
+
+	/* Wait for the files still being worked on; once cancelled, the rest
+	 * are only freed */
+	g_thread_pool_free(job->pool, FALSE, TRUE);
+	job->pool = NULL;
+
+	if (!job->cancel) {
+		char *checkpoint = recolor_checkpoint_path();
+
+		/* Everything is done, so the next run starts over */
+		g_mutex_lock(&job->lock);
+		if (job->checkpoint != NULL)
+			fclose(job->checkpoint);
+		job->checkpoint = NULL;
+		g_mutex_unlock(&job->lock);
+		g_unlink(checkpoint);
+		g_free(checkpoint);
+
+		g_idle_add(recolor_done, job);
+	}
+	return NULL;
 }
 
+static void
+recolor_logs_action(PurplePluginAction *action)
+{
+	RecolorJob *job;
+	GList *convs;
+	char **palette = NULL;
+	char *checkpoint, *contents, *dir;
+
+	if (recolor_job != NULL)
+		return;
+
+	/* The stock logger appends to the files that would be replaced */
+	if (g_strcmp0(purple_prefs_get_string("/purple/logging/format"), "html") == 0) {
+		purple_notify_error(action->plugin, _("Recolor Logs"), _("Unable to recolor logs"),
+		                    _("Logs are still being written in HTML. Switch the log format "
+		                      "to colored nicks first."));
+		return;
+	}
+
+	for (convs = purple_get_conversations(); convs != NULL && palette == NULL; convs = convs->next) {
+		PidginConversation *gtkconv = PIDGIN_CONVERSATION(convs->data);
+		NickColorCache *cache;
+
+		if (gtkconv == NULL || get_nick_color(gtkconv, "") == NULL)
+			continue;
+		cache = g_object_get_data(G_OBJECT(gtkconv->webview), "colornicks-nick-colors");
+		palette = g_strdupv(cache->palette);
+	}
+	if (palette == NULL) {
+		purple_notify_error(action->plugin, _("Recolor Logs"), _("Unable to recolor logs"),
+		                    _("Nick colors come from the conversation theme. Open a "
+		                      "conversation and try again."));
+		return;
+	}
+
+	recolor_job = job = g_new0(RecolorJob, 1);
+	job->plugin = action->plugin;
+	job->palette = palette;
+	job->palette_len = g_strv_length(palette);
+	job->done = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	job->queue = g_array_new(FALSE, FALSE, sizeof(RecolorFile));
+	job->rewritten = g_ptr_array_new_with_free_func(g_free);
+	g_mutex_init(&job->lock);
+	job->start = g_get_monotonic_time();
+
+	/* Pick up after an interrupted run */
+	checkpoint = recolor_checkpoint_path();
+	if (g_file_get_contents(checkpoint, &contents, NULL, NULL)) {
+		char **paths = g_strsplit(contents, "\n", -1);
+		int i;
+
+		for (i = 0; paths[i] != NULL; i++)
+			if (*paths[i])
+				g_hash_table_add(job->done, g_strdup(paths[i]));
+		g_strfreev(paths);
+		g_free(contents);
+	}
+	dir = g_path_get_dirname(checkpoint);
+	purple_build_dir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	job->checkpoint = g_fopen(checkpoint, "a");
+	g_free(checkpoint);
+	g_free(dir);
+
+	job->pool = g_thread_pool_new(recolor_file, job, g_get_num_processors(), FALSE, NULL);
+	job->thread = g_thread_new("colornicks-recolor", recolor_thread, job);
+}
 
 static gboolean
 plugin_load(PurplePlugin *plugin)
 {
+	main_thread = g_thread_self();
 	colornicks_logger = purple_log_logger_new("colornicks", "Colored nicks", 11,
 									  NULL,
 									  colornicks_logger_write,
@@ -362,10 +4987,98 @@ plugin_load(PurplePlugin *plugin)
 									  colornicks_logger_total_size,
 									  colornicks_logger_list_syslog,
 									  NULL,
-									  purple_log_common_deleter,
+									  colornicks_logger_delete,
 									  purple_log_common_is_deletable);
 	purple_log_logger_add(colornicks_logger);
 
+	colornicks_gz_logger = purple_log_logger_new("colornicks-gz", "Colored nicks (compressed)", 11,
+									  NULL,
+									  colornicks_gz_logger_write,
+									  colornicks_logger_finalize,
+									  colornicks_gz_logger_list,
+									  colornicks_logger_read,
+									  purple_log_common_sizer,
+									  colornicks_gz_logger_total_size,
+									  colornicks_gz_logger_list_syslog,
+									  NULL,
+									  colornicks_logger_delete,
+									  purple_log_common_is_deletable);
+	purple_log_logger_add(colornicks_gz_logger);
+
+	line_templates_compile();
+	journal_replay();
+	if (purple_prefs_get_bool("/plugins/gtk/colornicks_logger/journal"))
+		journal_start();
+	use_search_index = purple_prefs_get_bool("/plugins/gtk/colornicks_logger/search_index");
+	search_index_init();
+	writer_start();
+
+	purple_plugin_ipc_register(plugin, "reader-open",
+	                           PURPLE_CALLBACK(colornicks_log_reader_open),
+	                           purple_marshal_POINTER__POINTER,
+	                           purple_value_new(PURPLE_TYPE_POINTER), 1,
+	                           purple_value_new(PURPLE_TYPE_POINTER));
+	purple_plugin_ipc_register(plugin, "reader-next",
+	                           PURPLE_CALLBACK(ipc_reader_next),
+	                           purple_marshal_POINTER__POINTER_POINTER,
+	                           purple_value_new(PURPLE_TYPE_POINTER), 2,
+	                           purple_value_new(PURPLE_TYPE_POINTER),
+	                           purple_value_new(PURPLE_TYPE_POINTER));
+	purple_plugin_ipc_register(plugin, "read-last",
+	                           PURPLE_CALLBACK(ipc_read_last),
+	                           purple_marshal_POINTER__POINTER_INT,
+	                           purple_value_new(PURPLE_TYPE_STRING), 2,
+	                           purple_value_new(PURPLE_TYPE_POINTER),
+	                           purple_value_new(PURPLE_TYPE_INT));
+	purple_plugin_ipc_register(plugin, "read-range",
+	                           PURPLE_CALLBACK(ipc_read_range),
+	                           purple_marshal_POINTER__POINTER_POINTER,
+	                           purple_value_new(PURPLE_TYPE_STRING), 2,
+	                           purple_value_new(PURPLE_TYPE_POINTER),
+	                           purple_value_new(PURPLE_TYPE_POINTER));
+	purple_plugin_ipc_register(plugin, "reader-close",
+	                           PURPLE_CALLBACK(colornicks_log_reader_close),
+	                           purple_marshal_VOID__POINTER,
+	                           NULL, 1,
+	                           purple_value_new(PURPLE_TYPE_POINTER));
+
+	use_image_pack = purple_prefs_get_bool("/plugins/gtk/colornicks_logger/image_pack");
+	read_last_messages = purple_prefs_get_int("/plugins/gtk/colornicks_logger/read_last");
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/read_last",
+	                              read_last_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/search_index",
+	                              search_index_pref_cb, NULL);
+	image_packs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, image_pack_free);
+	log_catalogs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, log_catalog_free);
+	image_pack_pool = g_thread_pool_new(image_pack_write_job, NULL, 1, FALSE, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/image_pack",
+	                              image_pack_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/flush_interval",
+	                              flush_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/flush_threshold",
+	                              flush_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/max_open_logs",
+	                              max_open_logs_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/journal",
+	                              journal_pref_cb, NULL);
+	segment_max_kb = purple_prefs_get_int("/plugins/gtk/colornicks_logger/segment_size");
+	segment_max_lines = purple_prefs_get_int("/plugins/gtk/colornicks_logger/segment_lines");
+	segment_daily = purple_prefs_get_bool("/plugins/gtk/colornicks_logger/segment_daily");
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/segment_size",
+	                              segment_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/segment_lines",
+	                              segment_pref_cb, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/segment_daily",
+	                              segment_pref_cb, NULL);
+	stats_accounts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, stats_account_free);
+	stats_enabled = purple_prefs_get_bool("/plugins/gtk/colornicks_logger/stats");
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/stats",
+	                              stats_pref_cb, NULL);
+	if (purple_prefs_get_bool("/plugins/gtk/colornicks_logger/trace"))
+		trace_start_recording();
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/colornicks_logger/trace",
+	                              trace_pref_cb, NULL);
+
 	if (g_strcmp0(purple_prefs_get_string("/purple/logging/format"), "html") == 0)
 		purple_prefs_set_string("/purple/logging/format", "colornicks");
 	return TRUE;
@@ -384,17 +5097,165 @@ plugin_unload(PurplePlugin *plugin)
 		   pidgin crashes. Close the logs for all conversations so that they
 		   can start new logs on an existing logger. */
 		purple_conversation_close_logs(conv);
+
+		/* Drop cached nick colors along with their style handlers */
+		if (PIDGIN_CONVERSATION(conv) != NULL)
+			g_object_set_data(G_OBJECT(PIDGIN_CONVERSATION(conv)->webview),
+			                  "colornicks-nick-colors", NULL);
 		convs = convs->next;
 	}
 
-	if (g_strcmp0(purple_prefs_get_string("/purple/logging/format"), "colornicks") == 0)
+	/* Logs not attached to a conversation (system logs) stay open, so make
+	   sure everything they have buffered reaches the disk. */
+	writer_stop();
+	journal_stop();
+	trace_stop_recording();
+	stats_enabled = FALSE;
+	g_hash_table_destroy(stats_accounts);
+	stats_accounts = NULL;
+	if (search_rebuild != NULL) {
+		/* Stop a rebuild before its results could reach an unloaded plugin */
+		search_rebuild->cancel = TRUE;
+		search_rebuild_free(search_rebuild);
+		search_rebuild = NULL;
+		g_byte_array_free(search_rebuild_live, TRUE);
+		search_rebuild_live = NULL;
+	}
+	if (recolor_job != NULL) {
+		/* Files being recolored are left as they were */
+		recolor_job->cancel = TRUE;
+		recolor_job_free(recolor_job);
+		recolor_job = NULL;
+	}
+	search_index_free();
+	line_templates_free();
+	purple_prefs_disconnect_by_handle(plugin);
+	purple_plugin_ipc_unregister_all(plugin);
+
+	/* Wait for queued images to be written */
+	g_thread_pool_free(image_pack_pool, FALSE, TRUE);
+	image_pack_pool = NULL;
+	g_hash_table_destroy(image_packs);
+	image_packs = NULL;
+	g_hash_table_destroy(log_catalogs);
+	log_catalogs = NULL;
+	error_flush();
+
+	if (g_strcmp0(purple_prefs_get_string("/purple/logging/format"), "colornicks") == 0 ||
+	    g_strcmp0(purple_prefs_get_string("/purple/logging/format"), "colornicks-gz") == 0)
 		purple_prefs_set_string("/purple/logging/format", "html");
 
+	purple_log_logger_remove(colornicks_gz_logger);
+	purple_log_logger_free(colornicks_gz_logger);
 	purple_log_logger_remove(colornicks_logger);
 	purple_log_logger_free(colornicks_logger);
 	return TRUE;
 }
 
+static PurplePluginPrefFrame *
+get_plugin_pref_frame(PurplePlugin *plugin)
+{
+	PurplePluginPrefFrame *frame;
+	PurplePluginPref *pref;
+
+	frame = purple_plugin_pref_frame_new();
+
+	pref = purple_plugin_pref_new_with_label(_("Writing"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/flush_interval",
+	                                                  _("Maximum delay before messages reach the disk (ms, 0 to write immediately)"));
+	purple_plugin_pref_set_bounds(pref, 0, 60000);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/flush_threshold",
+	                                                  _("Write out early once this many bytes are buffered"));
+	purple_plugin_pref_set_bounds(pref, 512, 1024 * 1024);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/journal",
+	                                                  _("Journal messages so a crash cannot lose or tear them"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/max_open_logs",
+	                                                  _("Maximum number of log files kept open"));
+	purple_plugin_pref_set_bounds(pref, 1, 4096);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/segment_size",
+	                                                  _("Start a new log file after this many KB (0 for no limit)"));
+	purple_plugin_pref_set_bounds(pref, 0, 1024 * 1024);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/segment_lines",
+	                                                  _("Start a new log file after this many messages (0 for no limit)"));
+	purple_plugin_pref_set_bounds(pref, 0, 10000000);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/segment_daily",
+	                                                  _("Start a new log file every day"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/image_pack",
+	                                                  _("Store inline images in one pack file per log folder"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/stats",
+	                                                  _("Time each stage of logging"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/trace",
+	                                                  _("Record a trace of logged messages for replaying"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_label(_("Reading"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/read_last",
+	                                                  _("Only show the last messages of a log (0 to show all)"));
+	purple_plugin_pref_set_bounds(pref, 0, 100000);
+	purple_plugin_pref_frame_add(frame, pref);
+
+	pref = purple_plugin_pref_new_with_name_and_label("/plugins/gtk/colornicks_logger/search_index",
+	                                                  _("Index messages for searching"));
+	purple_plugin_pref_frame_add(frame, pref);
+
+	return frame;
+}
+
+static GList *
+actions(PurplePlugin *plugin, gpointer context)
+{
+	GList *list = NULL;
+
+	list = g_list_append(list, purple_plugin_action_new(_("Search Logs..."),
+	                                                    search_logs_action));
+	list = g_list_append(list, purple_plugin_action_new(_("Rebuild Search Index"),
+	                                                    search_rebuild_action));
+	list = g_list_append(list, purple_plugin_action_new(_("Open Log File Statistics"),
+	                                                    file_pool_stats_action));
+	list = g_list_append(list, purple_plugin_action_new(_("Recolor Old Logs"),
+	                                                    recolor_logs_action));
+	list = g_list_append(list, purple_plugin_action_new(_("Logging Statistics"),
+	                                                    stats_action));
+	list = g_list_append(list, purple_plugin_action_new(_("Export Logging Statistics"),
+	                                                    stats_export_action));
+	return list;
+}
+
+static PurplePluginUiInfo prefs_info =
+{
+	get_plugin_pref_frame,
+	0, /* page_num (Reserved) */
+	NULL, /* frame (Reserved) */
+
+	/* padding */
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
 static PurplePluginInfo info =
 {
 	PURPLE_PLUGIN_MAGIC,
@@ -424,8 +5285,8 @@ static PurplePluginInfo info =
 
 	NULL,                                             /**< ui_info        */
 	NULL,                                             /**< extra_info     */
-	NULL,
-	NULL,
+	&prefs_info,                                      /**< prefs_info     */
+	actions,                                          /**< actions        */
 	/* Padding */
 	NULL,
 	NULL,
@@ -436,6 +5297,20 @@ static PurplePluginInfo info =
 static void
 init_plugin(PurplePlugin *plugin)
 {
+	purple_prefs_add_none("/plugins/gtk");
+	purple_prefs_add_none("/plugins/gtk/colornicks_logger");
+	purple_prefs_add_int("/plugins/gtk/colornicks_logger/flush_interval", 1000);
+	purple_prefs_add_int("/plugins/gtk/colornicks_logger/flush_threshold", 16 * 1024);
+	purple_prefs_add_int("/plugins/gtk/colornicks_logger/max_open_logs", 128);
+	purple_prefs_add_bool("/plugins/gtk/colornicks_logger/journal", FALSE);
+	purple_prefs_add_int("/plugins/gtk/colornicks_logger/segment_size", 0);
+	purple_prefs_add_int("/plugins/gtk/colornicks_logger/segment_lines", 0);
+	purple_prefs_add_bool("/plugins/gtk/colornicks_logger/segment_daily", FALSE);
+	purple_prefs_add_bool("/plugins/gtk/colornicks_logger/image_pack", FALSE);
+	purple_prefs_add_bool("/plugins/gtk/colornicks_logger/trace", FALSE);
+	purple_prefs_add_bool("/plugins/gtk/colornicks_logger/stats", FALSE);
+	purple_prefs_add_int("/plugins/gtk/colornicks_logger/read_last", 0);
+	purple_prefs_add_bool("/plugins/gtk/colornicks_logger/search_index", FALSE);
 }
 
 PURPLE_INIT_PLUGIN(colornicks_logger, init_plugin, info)
@@ -27,6 +27,8 @@
 #include "internal.h"
 #include "version.h"
 #include "account.h"
+#include "debug.h"
+#include "request.h"
 #include "savedstatuses.h"
 
 #include "gtkplugin.h"
@@ -38,10 +40,64 @@
 
 static MessagingMenuApp *mmapp = NULL;
 static UnityLauncherEntry *launcher = NULL;
-static guint n_sources = 0;
+static guint n_sources = 0;    /* conversations with unread messages */
+static guint n_messages = 0;   /* unread messages in all of them */
+static GHashTable *account_unread = NULL;  /* PurpleAccount -> unread messages */
+static GHashTable *id_convs = NULL;        /* messaging menu ID -> PurpleConversation */
+
+/* What we keep for each conversation, from when we first see it until it is
+ * deleted. What alert() touches for every message comes first, so it fits
+ * in a cache line; the states benchmark in bench/ reports where it lands. */
+typedef struct {
+	gint64 last_alert;       /* g_get_monotonic_time(), 0 if never alerted */
+
+	/* Alerts past the burst are gathered into one update, put off for
+	 * longer the faster messages come in */
+	gint64 burst_start;
+	double rate;             /* messages per second, a moving average */
+	guint burst;             /* alerts since burst_start */
+	guint gather_source;
+
+	gint count;              /* unread messages */
+
+	/* Whether the user can see the conversation, as of focus_epoch */
+	gboolean visible;
+	guint visible_epoch;
+
+	gulong entry_signal;
+	gulong webview_signal;
+	GString *id;             /* messaging menu ID, made when first needed */
+} ConvState;
+
+/* States are made as conversations are created, or attached at load, and
+ * found by pointer. purple_conversation_set_data() would keep them on the
+ * conversation, but its table is keyed by string, so every lookup would
+ * hash the key's name instead of a pointer. */
+static GHashTable *conv_states = NULL;     /* PurpleConversation -> ConvState */
+
+/* Bumped whenever a window gains or loses focus or switches tabs, which
+ * makes every conversation's visible bit stale */
+static guint focus_epoch = 1;
+static GHashTable *watched_windows = NULL;  /* GtkWidget window, watched for focus */
+static guint focus_cache_hits = 0;
+static guint focus_cache_misses = 0;
 static gint launcher_count;
 static gint messaging_menu_text;
 static gboolean alert_chat_nick = TRUE;
+static gint update_interval;   /* ms, 0 to update immediately */
+static gint alert_burst;       /* alerts shown at once before more are gathered, 0 for no limit */
+static guint alerts_gathered = 0;
+
+/* Updates to the messaging menu and launcher each go over D-Bus, so they
+ * are put off and made once for each changed conversation, and once for
+ * the launcher, every update_interval. */
+static GHashTable *dirty_convs = NULL;  /* conversations to update */
+static gboolean launcher_dirty = FALSE;
+static guint update_source = 0;
+static guint source_updates_queued = 0;
+static guint source_updates_made = 0;
+static guint launcher_updates_queued = 0;
+static guint launcher_updates_made = 0;
 
 enum {
 	LAUNCHER_COUNT_DISABLE,
@@ -57,22 +113,211 @@ enum {
 static int attach_signals(PurpleConversation *conv);
 static void detach_signals(PurpleConversation *conv);
 
+/* Optional trace of the conversation events we handle, for replaying real
+ * traffic later. The file starts with TRACE_MAGIC, followed by records laid
+ * out as [type][time][length][fields], with the time in microseconds since
+ * the trace was started as a big-endian guint64 and the length of the
+ * fields as a big-endian guint32. Fields are NUL-terminated strings: the
+ * conversation's type, name, account and protocol, and for 'M' (a message
+ * displayed) its flags and text, so highlights match on replay as they
+ * did. The other types are 'S' (a message sent), 'N' (a conversation
+ * created), 'D' (a conversation deleted) and 'F' (a conversation focused).
+ * The replay benchmark in bench/ feeds it to the handlers again. */
+#define TRACE_MAGIC "UITRACE\2"
+#define TRACE_RECORD_HEADER (1 + 8 + 4)
+
+static FILE *trace_file = NULL;
+static gint64 trace_start;
+static gboolean trace_replaying = FALSE;  /* replayed events are not traced */
+
+static char *
+trace_path(void)
+{
+	return g_build_filename(purple_user_dir(), "unityinteg.trace", NULL);
+}
+
+static void
+trace_event(char type, PurpleConversation *conv, PurpleMessageFlags flags,
+            const char *message)
+{
+	PurpleAccount *account;
+	GString *fields;
+	guint8 header[TRACE_RECORD_HEADER];
+	guint64 when;
+	guint32 len;
+
+	if (trace_file == NULL || trace_replaying || conv == NULL)
+		return;
+
+	account = purple_conversation_get_account(conv);
+	fields = g_string_sized_new(128);
+	g_string_append_printf(fields, "%d", purple_conversation_get_type(conv));
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, purple_conversation_get_name(conv));
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, purple_account_get_username(account));
+	g_string_append_c(fields, '\0');
+	g_string_append(fields, purple_account_get_protocol_id(account));
+	g_string_append_c(fields, '\0');
+	if (type == 'M') {
+		g_string_append_printf(fields, "%d", flags);
+		g_string_append_c(fields, '\0');
+		g_string_append(fields, message ? message : "");
+		g_string_append_c(fields, '\0');
+	}
+
+	when = GUINT64_TO_BE(g_get_monotonic_time() - trace_start);
+	len = GUINT32_TO_BE(fields->len);
+	header[0] = type;
+	memcpy(header + 1, &when, 8);
+	memcpy(header + 9, &len, 4);
+	if (fwrite(header, sizeof(header), 1, trace_file) != 1 ||
+	    fwrite(fields->str, fields->len, 1, trace_file) != 1)
+		purple_debug_error("unityinteg", "Unable to write to the trace: %s\n",
+		                   g_strerror(errno));
+	g_string_free(fields, TRUE);
+}
+
+/* Starts a new trace, replacing the last one */
+static void
+trace_start_recording(void)
+{
+	char *path = trace_path();
+
+	if ((trace_file = g_fopen(path, "wb")) == NULL) {
+		purple_debug_error("unityinteg", "Unable to create %s: %s\n",
+		                   path, g_strerror(errno));
+	} else {
+		fwrite(TRACE_MAGIC, strlen(TRACE_MAGIC), 1, trace_file);
+		trace_start = g_get_monotonic_time();
+	}
+	g_free(path);
+}
+
+static void
+trace_stop_recording(void)
+{
+	if (trace_file != NULL)
+		fclose(trace_file);
+	trace_file = NULL;
+}
+
+static ConvState *
+conv_state(PurpleConversation *conv)
+{
+	ConvState *state = g_hash_table_lookup(conv_states, conv);
+
+	if (state == NULL) {
+		state = g_slice_new0(ConvState);
+		g_hash_table_insert(conv_states, conv, state);
+	}
+	return state;
+}
+
+static void
+conv_state_free(gpointer data)
+{
+	ConvState *state = data;
+
+	if (state->id != NULL)
+		g_string_free(state->id, TRUE);
+	if (state->gather_source != 0)
+		g_source_remove(state->gather_source);
+	g_slice_free(ConvState, state);
+}
+
+/* The unread count, without making state for conversations we have none for */
+static gint
+conv_unread(PurpleConversation *conv)
+{
+	ConvState *state = g_hash_table_lookup(conv_states, conv);
+	return state != NULL ? state->count : 0;
+}
+
+/* Recounts the unread totals, and complains if they have drifted from
+ * what set_unread() keeps. Only done with verbose debugging on. */
+static void
+check_unread(void)
+{
+	GHashTable *accounts;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint sources = 0, messages = 0;
+	GList *convs;
+
+	if (!purple_debug_is_verbose())
+		return;
+
+	accounts = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (convs = purple_get_conversations(); convs != NULL; convs = convs->next) {
+		PurpleConversation *conv = convs->data;
+		PurpleAccount *account = purple_conversation_get_account(conv);
+		gint count = conv_unread(conv);
+		if (count > 0) {
+			sources++;
+			messages += count;
+			g_hash_table_insert(accounts, account, GINT_TO_POINTER(count +
+				GPOINTER_TO_INT(g_hash_table_lookup(accounts, account))));
+		}
+	}
+
+	if (sources != n_sources || messages != n_messages)
+		purple_debug_error("unityinteg", "Unread totals are %u conversations and %u messages, "
+		                   "but a recount finds %u and %u\n",
+		                   n_sources, n_messages, sources, messages);
+
+	g_hash_table_iter_init(&iter, account_unread);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		if (value != g_hash_table_lookup(accounts, key))
+			purple_debug_error("unityinteg", "Unread total for %s is %d, but a recount finds %d\n",
+			                   purple_account_get_username(key), GPOINTER_TO_INT(value),
+			                   GPOINTER_TO_INT(g_hash_table_lookup(accounts, key)));
+	if (g_hash_table_size(accounts) != g_hash_table_size(account_unread))
+		purple_debug_error("unityinteg", "Unread totals are kept for %u accounts, "
+		                   "but a recount finds %u\n",
+		                   g_hash_table_size(account_unread), g_hash_table_size(accounts));
+
+	g_hash_table_destroy(accounts);
+}
+
+/* Sets the unread count of a conversation, keeping the totals up to date */
+static void
+set_unread(PurpleConversation *conv, gint count)
+{
+	ConvState *state = conv_state(conv);
+	PurpleAccount *account = purple_conversation_get_account(conv);
+	gint old = state->count;
+	gint total;
+
+	if (count == old)
+		return;
+
+	if (old == 0)
+		++n_sources;
+	else if (count == 0)
+		--n_sources;
+	n_messages += count - old;
+
+	total = GPOINTER_TO_INT(g_hash_table_lookup(account_unread, account)) + count - old;
+	if (total > 0)
+		g_hash_table_insert(account_unread, account, GINT_TO_POINTER(total));
+	else
+		g_hash_table_remove(account_unread, account);
+
+	state->count = count;
+	check_unread();
+}
+
 static void
 update_launcher()
 {
 	guint count = 0;
-	GList *convs = NULL;
 	g_return_if_fail(launcher != NULL && launcher_count != LAUNCHER_COUNT_DISABLE);
 
-	if (launcher_count == LAUNCHER_COUNT_MESSAGES) {
-		for (convs = purple_get_conversations(); convs != NULL; convs = convs->next) {
-			PurpleConversation *conv = convs->data;
-			count += GPOINTER_TO_INT(purple_conversation_get_data(conv,
-			                         "unityinteg-message-count"));
-		}
-	} else {
+	if (launcher_count == LAUNCHER_COUNT_MESSAGES)
+		count = n_messages;
+	else
 		count = n_sources;
-	}
 
 	if (launcher != NULL) {
 		if (count > 0)
@@ -83,24 +328,58 @@ update_launcher()
 	}
 }
 
-static gchar *
+/* Appends a part of an ID, escaping the ':' between parts */
+static void
+append_id_part(GString *id, const char *part)
+{
+	g_string_append_c(id, ':');
+	for (; *part; part++) {
+		if (*part == ':' || *part == '%')
+			g_string_append_printf(id, "%%%02X", (guchar)*part);
+		else
+			g_string_append_c(id, *part);
+	}
+}
+
+/* The messaging menu ID of a conversation, made once and kept until the
+ * conversation is deleted, along with the way back to it. */
+static const gchar *
 conversation_id(PurpleConversation *conv)
 {
-	PurpleConversationType conv_type = purple_conversation_get_type(conv);
-	PurpleAccount *account = purple_conversation_get_account(conv);
-	char type[2] = "0";
-	type[0] += conv_type;
+	ConvState *state = conv_state(conv);
+	PurpleAccount *account;
 
-	return g_strconcat(type, ":",
-	                   purple_conversation_get_name(conv), ":",
-	                   purple_account_get_username(account), ":",
-	                   purple_account_get_protocol_id(account), NULL);
+	if (state->id != NULL)
+		return state->id->str;
+
+	account = purple_conversation_get_account(conv);
+	state->id = g_string_new(NULL);
+	g_string_append_c(state->id, '0' + purple_conversation_get_type(conv));
+	append_id_part(state->id, purple_conversation_get_name(conv));
+	append_id_part(state->id, purple_account_get_username(account));
+	append_id_part(state->id, purple_account_get_protocol_id(account));
+
+	g_hash_table_insert(id_convs, state->id->str, conv);
+	return state->id->str;
+}
+
+/* Drops everything kept for a conversation that is being deleted */
+static void
+forget_conversation(PurpleConversation *conv)
+{
+	ConvState *state = g_hash_table_lookup(conv_states, conv);
+
+	if (state != NULL) {
+		if (state->id != NULL)
+			g_hash_table_remove(id_convs, state->id->str);
+		g_hash_table_remove(conv_states, conv);
+	}
 }
 
 static void
 messaging_menu_add_conversation(PurpleConversation *conv, gint count)
 {
-	gchar *id;
+	const gchar *id;
 	g_return_if_fail(count > 0);
 	id = conversation_id(conv);
 
@@ -115,17 +394,14 @@ messaging_menu_add_conversation(PurpleConversation *conv, gint count)
 	else if (messaging_menu_text == MESSAGING_MENU_COUNT)
 		messaging_menu_app_set_source_count(mmapp, id, count);
 	messaging_menu_app_draw_attention(mmapp, id);
-
-	g_free(id);
 }
 
 static void
 messaging_menu_remove_conversation(PurpleConversation *conv)
 {
-	gchar *id = conversation_id(conv);
+	const gchar *id = conversation_id(conv);
 	if (messaging_menu_app_has_source(mmapp, id))
 		messaging_menu_app_remove_source(mmapp, id);
-	g_free(id);
 }
 
 static void
@@ -135,67 +411,454 @@ refill_messaging_menu()
 
 	for (convs = purple_get_conversations(); convs != NULL; convs = convs->next) {
 		PurpleConversation *conv = convs->data;
-		messaging_menu_add_conversation(conv,
-			GPOINTER_TO_INT(purple_conversation_get_data(conv, "unityinteg-message-count")));
+		messaging_menu_add_conversation(conv, conv_unread(conv));
+	}
+}
+
+static void
+flush_updates(void)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (update_source != 0)
+		g_source_remove(update_source);
+	update_source = 0;
+
+	g_hash_table_iter_init(&iter, dirty_convs);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		PurpleConversation *conv = key;
+		gint count = conv_unread(conv);
+		if (count > 0)
+			messaging_menu_add_conversation(conv, count);
+		else
+			messaging_menu_remove_conversation(conv);
+		source_updates_made++;
+	}
+	g_hash_table_remove_all(dirty_convs);
+
+	if (launcher_dirty && launcher_count != LAUNCHER_COUNT_DISABLE) {
+		update_launcher();
+		launcher_updates_made++;
+	}
+	launcher_dirty = FALSE;
+}
+
+static gboolean
+flush_updates_cb(gpointer data)
+{
+	update_source = 0;
+	flush_updates();
+	return FALSE;
+}
+
+/* Updates the messaging menu entry of conv, if any, and the launcher */
+static void
+queue_update(PurpleConversation *conv)
+{
+	if (conv != NULL) {
+		g_hash_table_add(dirty_convs, conv);
+		source_updates_queued++;
+	}
+	launcher_dirty = TRUE;
+	launcher_updates_queued++;
+
+	if (update_interval <= 0)
+		flush_updates();
+	else if (update_source == 0)
+		update_source = g_timeout_add(update_interval, flush_updates_cb, NULL);
+}
+
+static gboolean
+gather_cb(gpointer data)
+{
+	PurpleConversation *conv = data;
+
+	conv_state(conv)->gather_source = 0;
+	queue_update(conv);
+	return FALSE;
+}
+
+/* Counts an alert, updating the menu and launcher for it unless it comes
+ * in a burst. The count stays exact either way. */
+static void
+alert_throttled(PurpleConversation *conv, ConvState *state)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (state->last_alert != 0) {
+		double instant = G_USEC_PER_SEC / (double)MAX(now - state->last_alert, 1000);
+		state->rate = state->rate * 0.8 + instant * 0.2;
+	}
+	state->last_alert = now;
+
+	if (now - state->burst_start > G_USEC_PER_SEC) {
+		state->burst_start = now;
+		state->burst = 0;
+	}
+	state->burst++;
+
+	set_unread(conv, state->count + 1);
+
+	if (alert_burst <= 0 || state->burst <= (guint)alert_burst) {
+		queue_update(conv);
+	} else {
+		alerts_gathered++;
+		/* 250ms at a few messages a second, up to 5s in a flood */
+		if (state->gather_source == 0)
+			state->gather_source = g_timeout_add(CLAMP((guint)(state->rate * 50), 250, 5000),
+			                                     gather_cb, conv);
 	}
 }
 
 static int
 alert(PurpleConversation *conv)
 {
-	gint count;
+	ConvState *state;
 	PidginWindow *purplewin = NULL;
 	if (conv == NULL || PIDGIN_CONVERSATION(conv) == NULL)
 		return 0;
 
-	purplewin = PIDGIN_CONVERSATION(conv)->win;
-
-	if (!pidgin_conv_window_has_focus(purplewin) ||
-		!pidgin_conv_window_is_active_conversation(conv))
-	{
-		count = GPOINTER_TO_INT(purple_conversation_get_data(conv,
-		                        "unityinteg-message-count"));
-		if (!count++)
-			++n_sources;
-
-		purple_conversation_set_data(conv, "unityinteg-message-count",
-		                             GINT_TO_POINTER(count));
-		messaging_menu_add_conversation(conv, count);
-		update_launcher();
+	state = conv_state(conv);
+	if (state->visible_epoch == focus_epoch) {
+		focus_cache_hits++;
+	} else {
+		focus_cache_misses++;
+		purplewin = PIDGIN_CONVERSATION(conv)->win;
+		state->visible = pidgin_conv_window_has_focus(purplewin) &&
+			pidgin_conv_window_is_active_conversation(conv);
+		state->visible_epoch = focus_epoch;
 	}
 
+	if (!state->visible)
+		alert_throttled(conv, state);
+
 	return 0;
 }
 
 static void
 unalert(PurpleConversation *conv)
 {
-	if (GPOINTER_TO_INT(purple_conversation_get_data(conv, "unityinteg-message-count")) > 0)
-		--n_sources;
-	purple_conversation_set_data(conv, "unityinteg-message-count",
-	                             GINT_TO_POINTER(0));
-	messaging_menu_remove_conversation(conv);
-	update_launcher();
+	/* Conversations without unread messages have nothing to take down,
+	 * which spares the updates for each focus change */
+	ConvState *state;
+
+	if (conv == NULL ||
+	    (conv_unread(conv) == 0 && !g_hash_table_contains(dirty_convs, conv)))
+		return;
+
+	state = conv_state(conv);
+	if (state->gather_source != 0)
+		g_source_remove(state->gather_source);
+	state->gather_source = 0;
+	state->burst = 0;
+
+	set_unread(conv, 0);
+	queue_update(conv);
 }
 
 static int
 unalert_cb(GtkWidget *widget, gpointer data, PurpleConversation *conv)
 {
+	trace_event('F', conv, 0, NULL);
 	unalert(conv);
+
+	/* The user is looking, so don't leave the entry up any longer */
+	flush_updates();
 	return 0;
 }
 
+/* Chat messages also alert when they match one of the highlight patterns.
+ * Patterns written as /regex/ are regular expressions, run together as one;
+ * the rest are words, found in a single pass ignoring ASCII case by an
+ * Aho-Corasick automaton. Both run on the message text with its markup
+ * taken out. Bytes are mapped to classes first, one for each byte found in
+ * a word and one for the rest, so the transition table stays small.
+ * A word only counts where it is not run into other letters or digits, so
+ * "al" is not found in "all"; regexes match anywhere. */
+typedef struct {
+	guint8 classes[256];
+	guint n_classes;
+	GArray *delta;           /* guint32 next state, n_classes for each state */
+	GArray *matches;         /* gboolean for each state, some word ends there */
+	GArray *lengths;         /* guint32 for each state, the word ending there or 0 */
+	GArray *outputs;         /* guint32 for each state, the next state down its
+	                          * failure links that a word ends in, or G_MAXUINT32 */
+	GRegex *regex;
+} HighlightMatcher;
+
+static HighlightMatcher *highlights = NULL;
+static GString *highlight_text = NULL;   /* reused for every message */
+
+static gboolean
+highlight_is_regex(const char *pattern)
+{
+	gsize len = strlen(pattern);
+	return len > 2 && pattern[0] == '/' && pattern[len - 1] == '/';
+}
+
+static guint32
+highlight_add_state(HighlightMatcher *matcher)
+{
+	guint32 none = G_MAXUINT32, zero = 0;
+	gboolean no = FALSE;
+	guint i;
+
+	for (i = 0; i < matcher->n_classes; i++)
+		g_array_append_val(matcher->delta, none);
+	g_array_append_val(matcher->matches, no);
+	g_array_append_val(matcher->lengths, zero);
+	g_array_append_val(matcher->outputs, none);
+	return matcher->matches->len - 1;
+}
+
+static void
+highlight_matcher_free(HighlightMatcher *matcher)
+{
+	if (matcher == NULL)
+		return;
+	g_array_free(matcher->delta, TRUE);
+	g_array_free(matcher->matches, TRUE);
+	g_array_free(matcher->lengths, TRUE);
+	g_array_free(matcher->outputs, TRUE);
+	if (matcher->regex != NULL)
+		g_regex_unref(matcher->regex);
+	g_free(matcher);
+}
+
+static HighlightMatcher *
+highlight_matcher_new(GList *patterns)
+{
+	HighlightMatcher *matcher = g_new0(HighlightMatcher, 1);
+	GString *regex = g_string_new(NULL);
+	GArray *fail;
+	GQueue queue = G_QUEUE_INIT;
+	GList *l;
+	guint n, c;
+
+	/* Bytes of words get classes of their own, upper case sharing them */
+	matcher->n_classes = 1;
+	for (l = patterns; l != NULL; l = l->next) {
+		const guchar *p = l->data;
+		if (highlight_is_regex(l->data))
+			continue;
+		for (; *p; p++)
+			if (matcher->classes[(guchar)g_ascii_tolower(*p)] == 0)
+				matcher->classes[(guchar)g_ascii_tolower(*p)] = matcher->n_classes++;
+	}
+	for (c = 0; c < 256; c++)
+		matcher->classes[c] = matcher->classes[(guchar)g_ascii_tolower(c)];
+	n = matcher->n_classes;
+
+	matcher->delta = g_array_new(FALSE, FALSE, sizeof(guint32));
+	matcher->matches = g_array_new(FALSE, FALSE, sizeof(gboolean));
+	matcher->lengths = g_array_new(FALSE, FALSE, sizeof(guint32));
+	matcher->outputs = g_array_new(FALSE, FALSE, sizeof(guint32));
+	highlight_add_state(matcher);
+
+	for (l = patterns; l != NULL; l = l->next) {
+		const char *pattern = l->data;
+		gsize len = strlen(pattern);
+		guint32 s = 0;
+
+		if (highlight_is_regex(pattern)) {
+			char *body = g_strndup(pattern + 1, len - 2);
+			GError *error = NULL;
+			GRegex *check = g_regex_new(body, G_REGEX_CASELESS, 0, &error);
+
+			if (check == NULL) {
+				purple_debug_warning("unityinteg", "Ignoring highlight %s: %s\n",
+				                     pattern, error->message);
+				g_error_free(error);
+			} else {
+				g_regex_unref(check);
+				g_string_append_printf(regex, "%s(?:%s)", regex->len ? "|" : "", body);
+			}
+			g_free(body);
+			continue;
+		}
+
+		for (; *pattern; pattern++) {
+			guint32 *next = &g_array_index(matcher->delta, guint32,
+			                               s * n + matcher->classes[(guchar)*pattern]);
+			if (*next == G_MAXUINT32) {
+				guint32 added = highlight_add_state(matcher);
+				/* Adding a state may have moved the table */
+				g_array_index(matcher->delta, guint32,
+				              s * n + matcher->classes[(guchar)*pattern]) = added;
+				s = added;
+			} else {
+				s = *next;
+			}
+		}
+		if (s != 0) {
+			g_array_index(matcher->matches, gboolean, s) = TRUE;
+			g_array_index(matcher->lengths, guint32, s) = len;
+		}
+	}
+
+	/* Fill in the missing transitions from the failure links, breadth first,
+	 * so scanning never has to follow them */
+	fail = g_array_sized_new(FALSE, TRUE, sizeof(guint32), matcher->matches->len);
+	g_array_set_size(fail, matcher->matches->len);
+	for (c = 0; c < n; c++) {
+		guint32 *t = &g_array_index(matcher->delta, guint32, c);
+		if (*t == G_MAXUINT32) {
+			*t = 0;
+		} else {
+			g_array_index(fail, guint32, *t) = 0;
+			g_queue_push_tail(&queue, GUINT_TO_POINTER(*t));
+		}
+	}
+	while (!g_queue_is_empty(&queue)) {
+		guint32 s = GPOINTER_TO_UINT(g_queue_pop_head(&queue));
+		guint32 f = g_array_index(fail, guint32, s);
+
+		if (g_array_index(matcher->matches, gboolean, f))
+			g_array_index(matcher->matches, gboolean, s) = TRUE;
+		g_array_index(matcher->outputs, guint32, s) =
+			g_array_index(matcher->lengths, guint32, f) != 0 ?
+			f : g_array_index(matcher->outputs, guint32, f);
+		for (c = 0; c < n; c++) {
+			guint32 *t = &g_array_index(matcher->delta, guint32, s * n + c);
+			if (*t == G_MAXUINT32) {
+				*t = g_array_index(matcher->delta, guint32, f * n + c);
+			} else {
+				g_array_index(fail, guint32, *t) = g_array_index(matcher->delta, guint32, f * n + c);
+				g_queue_push_tail(&queue, GUINT_TO_POINTER(*t));
+			}
+		}
+	}
+	g_array_free(fail, TRUE);
+
+	if (regex->len > 0)
+		matcher->regex = g_regex_new(regex->str, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, NULL);
+	g_string_free(regex, TRUE);
+
+	return matcher;
+}
+
+/* Copies the text of an HTML message into out, without tags and with
+ * entities decoded. Only a '<' followed by a letter, '/' or '!' starts a
+ * tag, so a literal "a < b" stays text. */
+static void
+highlight_strip(GString *out, const char *message)
+{
+	const char *p = message;
+
+	g_string_truncate(out, 0);
+	while (*p) {
+		gsize run = strcspn(p, "<&");
+
+		g_string_append_len(out, p, run);
+		p += run;
+
+		if (*p == '<' && (g_ascii_isalpha(p[1]) || p[1] == '/' || p[1] == '!')) {
+			const char *end = strchr(p, '>');
+			if (end == NULL)
+				break;
+			p = end + 1;
+		} else if (*p == '&') {
+			int len = 0;
+			const char *entity = purple_markup_unescape_entity(p, &len);
+
+			if (entity != NULL && len > 0) {
+				g_string_append(out, entity);
+				p += len;
+			} else {
+				g_string_append_c(out, *p++);
+			}
+		} else if (*p) {
+			g_string_append_c(out, *p++);
+		}
+	}
+}
+
+/* Bytes of UTF-8 sequences count as letters */
+static gboolean
+highlight_is_word_byte(guchar c)
+{
+	return g_ascii_isalnum(c) || c == '_' || c >= 0x80;
+}
+
+/* Whether one of the words ending at p, reached in state s, stands on its
+ * own. Only an edge of the word that is a letter or digit itself needs
+ * something else next to it, so "@team" is found in "x@team". */
+static gboolean
+highlight_word_found(const HighlightMatcher *matcher, const guchar *text,
+                     const guchar *p, guint32 s)
+{
+	const guint32 *lengths = (const guint32 *)matcher->lengths->data;
+	const guint32 *outputs = (const guint32 *)matcher->outputs->data;
+
+	/* Every word ending here ends at the same byte */
+	if (highlight_is_word_byte(p[0]) && highlight_is_word_byte(p[1]))
+		return FALSE;
+
+	for (; s != G_MAXUINT32; s = outputs[s]) {
+		const guchar *start = p - lengths[s] + 1;
+
+		if (lengths[s] != 0 &&
+		    (start == text || !highlight_is_word_byte(start[0]) ||
+		     !highlight_is_word_byte(start[-1])))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean
+highlight_matcher_match(const HighlightMatcher *matcher, const char *message)
+{
+	const guint32 *delta = (const guint32 *)matcher->delta->data;
+	const gboolean *matches = (const gboolean *)matcher->matches->data;
+	const guchar *p;
+	guint32 s = 0;
+
+	if (matcher->n_classes == 1 && matcher->regex == NULL)
+		return FALSE;
+
+	if (highlight_text == NULL)
+		highlight_text = g_string_sized_new(1024);
+	highlight_strip(highlight_text, message);
+
+	if (matcher->n_classes > 1) {
+		const guchar *text = (const guchar *)highlight_text->str;
+
+		for (p = text; *p; p++) {
+			s = delta[s * matcher->n_classes + matcher->classes[*p]];
+			if (matches[s] && highlight_word_found(matcher, text, p, s))
+				return TRUE;
+		}
+	}
+
+	return matcher->regex != NULL &&
+	       g_regex_match(matcher->regex, highlight_text->str, 0, NULL);
+}
+
+static void
+highlights_pref_cb(const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+{
+	GList *patterns = purple_prefs_get_string_list("/plugins/gtk/unityinteg/highlights");
+
+	highlight_matcher_free(highlights);
+	highlights = highlight_matcher_new(patterns);
+	g_list_free_full(patterns, g_free);
+}
+
 static gboolean
 message_displayed_cb(PurpleAccount *account, const char *who, char *message,
                      PurpleConversation *conv, PurpleMessageFlags flags)
 {
-	if ((purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT &&
-	     alert_chat_nick && !(flags & PURPLE_MESSAGE_NICK)))
+	trace_event('M', conv, flags, message);
+	if (!(flags & PURPLE_MESSAGE_RECV) || (flags & PURPLE_MESSAGE_DELAYED))
 		return FALSE;
 
-	if ((flags & PURPLE_MESSAGE_RECV) && !(flags & PURPLE_MESSAGE_DELAYED))
-		alert(conv);
+	if ((purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT &&
+	     alert_chat_nick && !(flags & PURPLE_MESSAGE_NICK) &&
+	     (message == NULL || !highlight_matcher_match(highlights, message))))
+		return FALSE;
 
+	alert(conv);
 	return FALSE;
 }
 
@@ -205,6 +868,7 @@ im_sent_im(PurpleAccount *account, const char *receiver, const char *message)
 	PurpleConversation *conv = NULL;
 	conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, receiver,
 	                                             account);
+	trace_event('S', conv, 0, NULL);
 	unalert(conv);
 }
 
@@ -213,42 +877,63 @@ chat_sent_im(PurpleAccount *account, const char *message, int id)
 {
 	PurpleConversation *conv = NULL;
 	conv = purple_find_chat(purple_account_get_connection(account), id);
+	trace_event('S', conv, 0, NULL);
 	unalert(conv);
 }
 
 static void
 conv_created(PurpleConversation *conv)
 {
-	purple_conversation_set_data(conv, "unityinteg-message-count",
-	                             GINT_TO_POINTER(0));
+	trace_event('N', conv, 0, NULL);
+	conversation_id(conv);
 	attach_signals(conv);
 }
 
 static void
 deleting_conv(PurpleConversation *conv)
 {
+	trace_event('D', conv, 0, NULL);
 	detach_signals(conv);
-	unalert(conv);
+
+	/* The conversation is gone by the next update, so its entry goes now */
+	g_hash_table_remove(dirty_convs, conv);
+	messaging_menu_remove_conversation(conv);
+	forget_conversation(conv);
+	queue_update(NULL);
+}
+
+static void
+update_stats_action(PurplePluginAction *action)
+{
+	char *msg = g_strdup_printf(_("Messaging menu updates: %u made for %u changes\n"
+	                              "Launcher updates: %u made for %u changes\n"
+	                              "Alerts gathered from bursts: %u\n"
+	                              "Focus checks: %u cached, %u looked up"),
+	                            source_updates_made, source_updates_queued,
+	                            launcher_updates_made, launcher_updates_queued,
+	                            alerts_gathered, focus_cache_hits, focus_cache_misses);
+
+	purple_notify_info(action->plugin, _("Update Statistics"),
+	                   _("Messaging menu and launcher updates"), msg);
+	g_free(msg);
+}
+
+static GList *
+actions(PurplePlugin *plugin, gpointer context)
+{
+	GList *list = NULL;
+
+	list = g_list_append(list, purple_plugin_action_new(_("Update Statistics"),
+	                                                    update_stats_action));
+	return list;
 }
 
 static void
 message_source_activated(MessagingMenuApp *app, const gchar *id,
                          gpointer user_data)
 {
-	gchar **sections = g_strsplit(id, ":", 0);
-	PurpleConversation *conv = NULL;
-	PurpleAccount *account;
+	PurpleConversation *conv = g_hash_table_lookup(id_convs, id);
 	PidginWindow *purplewin = NULL;
-	PurpleConversationType conv_type;
-
-	char *type     = sections[0];
-	char *cname    = sections[1];
-	char *aname    = sections[2];
-	char *protocol = sections[3];
-
-	conv_type = type[0] - '0';
-	account = purple_accounts_find(aname, protocol);
-	conv = purple_find_conversation_with_account(conv_type, cname, account);
 
 	if (conv) {
 		unalert(conv);
@@ -256,7 +941,6 @@ message_source_activated(MessagingMenuApp *app, const gchar *id,
 		pidgin_conv_window_switch_gtkconv(purplewin, PIDGIN_CONVERSATION(conv));
 		gdk_window_focus(gtk_widget_get_window(purplewin->window), time(NULL));
 	}
-	g_strfreev (sections);
 }
 
 static PurpleSavedStatus *
@@ -359,6 +1043,111 @@ alert_config_cb(GtkWidget *widget, gpointer data)
 	alert_chat_nick = on;
 }
 
+static void
+trace_config_cb(GtkWidget *widget, gpointer data)
+{
+	gboolean on = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+	purple_prefs_set_bool("/plugins/gtk/unityinteg/trace", on);
+	trace_stop_recording();
+	if (on)
+		trace_start_recording();
+}
+
+static void
+update_interval_config_cb(GtkSpinButton *spin, gpointer data)
+{
+	update_interval = gtk_spin_button_get_value_as_int(spin);
+	purple_prefs_set_int("/plugins/gtk/unityinteg/update_interval", update_interval);
+	flush_updates();
+}
+
+static void
+alert_burst_config_cb(GtkSpinButton *spin, gpointer data)
+{
+	alert_burst = gtk_spin_button_get_value_as_int(spin);
+	purple_prefs_set_int("/plugins/gtk/unityinteg/alert_burst", alert_burst);
+}
+
+/* Edits to the highlights are applied once typing pauses or the box loses
+ * focus, rather than recompiling half-typed patterns on every keystroke */
+#define HIGHLIGHTS_CONFIG_DELAY 500  /* ms */
+
+static guint highlights_config_source = 0;
+static GtkTextBuffer *highlights_config_buffer = NULL;  /* held while an edit is pending */
+
+static void
+highlights_config_apply(GtkTextBuffer *buffer)
+{
+	GtkTextIter start, end;
+	GList *patterns = NULL;
+	char *text, **lines;
+	int i;
+
+	gtk_text_buffer_get_bounds(buffer, &start, &end);
+	text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+	lines = g_strsplit(text, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_strstrip(lines[i]);
+		if (*lines[i])
+			patterns = g_list_append(patterns, lines[i]);
+	}
+
+	/* Recompiled by highlights_pref_cb() */
+	purple_prefs_set_string_list("/plugins/gtk/unityinteg/highlights", patterns);
+
+	g_list_free(patterns);
+	g_strfreev(lines);
+	g_free(text);
+}
+
+/* Applies a pending edit now */
+static void
+highlights_config_flush(void)
+{
+	GtkTextBuffer *buffer = highlights_config_buffer;
+
+	if (buffer == NULL)
+		return;
+
+	if (highlights_config_source != 0)
+		g_source_remove(highlights_config_source);
+	highlights_config_source = 0;
+	highlights_config_buffer = NULL;
+
+	highlights_config_apply(buffer);
+	g_object_unref(buffer);
+}
+
+static gboolean
+highlights_config_timeout_cb(gpointer data)
+{
+	highlights_config_source = 0;
+	highlights_config_flush();
+	return FALSE;
+}
+
+static void
+highlights_config_cb(GtkTextBuffer *buffer, gpointer data)
+{
+	/* From a preferences window opened since */
+	if (highlights_config_buffer != NULL && highlights_config_buffer != buffer)
+		highlights_config_flush();
+
+	if (highlights_config_source != 0)
+		g_source_remove(highlights_config_source);
+	if (highlights_config_buffer == NULL)
+		highlights_config_buffer = g_object_ref(buffer);
+	highlights_config_source = g_timeout_add(HIGHLIGHTS_CONFIG_DELAY,
+	                                         highlights_config_timeout_cb, NULL);
+}
+
+static gboolean
+highlights_focus_out_cb(GtkWidget *widget, GdkEvent *event, gpointer data)
+{
+	highlights_config_flush();
+	return FALSE;
+}
+
 static void
 launcher_config_cb(GtkWidget *widget, gpointer data)
 {
@@ -384,23 +1173,70 @@ messaging_menu_config_cb(GtkWidget *widget, gpointer data)
 	refill_messaging_menu();
 }
 
+static gboolean
+window_focus_cb(GtkWidget *window, GdkEvent *event, gpointer data)
+{
+	focus_epoch++;
+	return FALSE;
+}
+
+static void
+window_destroy_cb(GtkWidget *window, gpointer data)
+{
+	g_hash_table_remove(watched_windows, window);
+	focus_epoch++;
+}
+
+static void
+unwatch_window(gpointer key, gpointer value, gpointer data)
+{
+	g_signal_handlers_disconnect_by_func(key, G_CALLBACK(window_focus_cb), NULL);
+	g_signal_handlers_disconnect_by_func(key, G_CALLBACK(window_destroy_cb), NULL);
+}
+
+/* Watches the focus of the window the conversation is in */
+static void
+watch_window(PurpleConversation *conv)
+{
+	PidginConversation *gtkconv = PIDGIN_CONVERSATION(conv);
+	GtkWidget *window;
+
+	if (gtkconv == NULL || gtkconv->win == NULL)
+		return;
+	window = gtkconv->win->window;
+	if (g_hash_table_contains(watched_windows, window))
+		return;
+
+	g_hash_table_add(watched_windows, window);
+	g_signal_connect(G_OBJECT(window), "focus-in-event", G_CALLBACK(window_focus_cb), NULL);
+	g_signal_connect(G_OBJECT(window), "focus-out-event", G_CALLBACK(window_focus_cb), NULL);
+	g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(window_destroy_cb), NULL);
+}
+
+/* A new active tab, possibly in a window we have not seen */
+static void
+conversation_switched_cb(PurpleConversation *conv)
+{
+	watch_window(conv);
+	focus_epoch++;
+}
+
 static int
 attach_signals(PurpleConversation *conv)
 {
 	PidginConversation *gtkconv = NULL;
-	guint id;
+	ConvState *state;
 
 	gtkconv = PIDGIN_CONVERSATION(conv);
 	if (!gtkconv)
 		return 0;
 
-	id = g_signal_connect(G_OBJECT(gtkconv->entry), "focus-in-event",
-	                      G_CALLBACK(unalert_cb), conv);
-	purple_conversation_set_data(conv, "unityinteg-entry-signal", GUINT_TO_POINTER(id));
-
-	id = g_signal_connect(G_OBJECT(gtkconv->webview), "focus-in-event",
-	                      G_CALLBACK(unalert_cb), conv);
-	purple_conversation_set_data(conv, "unityinteg-webview-signal", GUINT_TO_POINTER(id));
+	state = conv_state(conv);
+	state->entry_signal = g_signal_connect(G_OBJECT(gtkconv->entry), "focus-in-event",
+	                                       G_CALLBACK(unalert_cb), conv);
+	state->webview_signal = g_signal_connect(G_OBJECT(gtkconv->webview), "focus-in-event",
+	                                         G_CALLBACK(unalert_cb), conv);
+	watch_window(conv);
 
 	return 0;
 }
@@ -409,19 +1245,19 @@ static void
 detach_signals(PurpleConversation *conv)
 {
 	PidginConversation *gtkconv = NULL;
-	guint id;
+	ConvState *state;
 	gtkconv = PIDGIN_CONVERSATION(conv);
 	if (!gtkconv)
 		return;
 
-	id = GPOINTER_TO_INT(purple_conversation_get_data(conv, "unityinteg-webview-signal"));
-	g_signal_handler_disconnect(gtkconv->webview, id);
+	state = conv_state(conv);
+	if (state->webview_signal != 0)
+		g_signal_handler_disconnect(gtkconv->webview, state->webview_signal);
+	if (state->entry_signal != 0)
+		g_signal_handler_disconnect(gtkconv->entry, state->entry_signal);
+	state->webview_signal = state->entry_signal = 0;
 
-	id = GPOINTER_TO_INT(purple_conversation_get_data(conv, "unityinteg-entry-signal"));
-	g_signal_handler_disconnect(gtkconv->entry, id);
-
-	purple_conversation_set_data(conv, "unityinteg-message-count",
-	                             GINT_TO_POINTER(0));
+	set_unread(conv, 0);
 }
 
 static GtkWidget *
@@ -429,6 +1265,10 @@ get_config_frame(PurplePlugin *plugin)
 {
 	GtkWidget *ret = NULL, *frame = NULL;
 	GtkWidget *vbox = NULL, *toggle = NULL;
+	GtkWidget *hbox = NULL, *label = NULL, *spin = NULL;
+	GtkWidget *scroll = NULL, *view = NULL;
+	GtkTextBuffer *buffer;
+	GList *patterns, *l;
 
 	ret = gtk_box_new(GTK_ORIENTATION_VERTICAL, 18);
 	gtk_container_set_border_width(GTK_CONTAINER (ret), 12);
@@ -446,6 +1286,32 @@ get_config_frame(PurplePlugin *plugin)
 	g_signal_connect(G_OBJECT(toggle), "toggled",
 	                 G_CALLBACK(alert_config_cb), NULL);
 
+	label = gtk_label_new_with_mnemonic(_("Or where it contains one of these, one to a line (/regex/ for regular expressions):"));
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	view = gtk_text_view_new();
+	buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(view));
+	patterns = purple_prefs_get_string_list("/plugins/gtk/unityinteg/highlights");
+	for (l = patterns; l != NULL; l = l->next) {
+		gtk_text_buffer_insert_at_cursor(buffer, l->data, -1);
+		gtk_text_buffer_insert_at_cursor(buffer, "\n", -1);
+	}
+	g_list_free_full(patterns, g_free);
+	gtk_label_set_mnemonic_widget(GTK_LABEL(label), view);
+	g_signal_connect(G_OBJECT(buffer), "changed",
+	                 G_CALLBACK(highlights_config_cb), NULL);
+	g_signal_connect(G_OBJECT(view), "focus-out-event",
+	                 G_CALLBACK(highlights_focus_out_cb), NULL);
+
+	scroll = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
+	                               GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(scroll), GTK_SHADOW_IN);
+	gtk_widget_set_size_request(scroll, -1, 100);
+	gtk_container_add(GTK_CONTAINER(scroll), view);
+	gtk_box_pack_start(GTK_BOX(vbox), scroll, TRUE, TRUE, 0);
+
 	/* Launcher integration */
 
 	frame = pidgin_make_frame(ret, _("Launcher Icon"));
@@ -497,6 +1363,51 @@ get_config_frame(PurplePlugin *plugin)
 	g_signal_connect(G_OBJECT(toggle), "toggled",
 	                 G_CALLBACK(messaging_menu_config_cb), GUINT_TO_POINTER(MESSAGING_MENU_TIME));
 
+	/* Updates */
+
+	frame = pidgin_make_frame(ret, _("Updates"));
+	vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+	gtk_container_add(GTK_CONTAINER(frame), vbox);
+
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+
+	label = gtk_label_new_with_mnemonic(_("_Gather changes for this long before updating (ms):"));
+	gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, 0);
+	spin = gtk_spin_button_new_with_range(0, 5000, 10);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin),
+	                          purple_prefs_get_int("/plugins/gtk/unityinteg/update_interval"));
+	gtk_label_set_mnemonic_widget(GTK_LABEL(label), spin);
+	gtk_box_pack_start(GTK_BOX(hbox), spin, FALSE, FALSE, 0);
+	g_signal_connect(G_OBJECT(spin), "value-changed",
+	                 G_CALLBACK(update_interval_config_cb), NULL);
+
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+
+	label = gtk_label_new_with_mnemonic(_("Alerts in a _burst before the rest are gathered (0 for no limit):"));
+	gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, 0);
+	spin = gtk_spin_button_new_with_range(0, 1000, 1);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin),
+	                          purple_prefs_get_int("/plugins/gtk/unityinteg/alert_burst"));
+	gtk_label_set_mnemonic_widget(GTK_LABEL(label), spin);
+	gtk_box_pack_start(GTK_BOX(hbox), spin, FALSE, FALSE, 0);
+	g_signal_connect(G_OBJECT(spin), "value-changed",
+	                 G_CALLBACK(alert_burst_config_cb), NULL);
+
+	/* Tracing */
+
+	frame = pidgin_make_frame(ret, _("Tracing"));
+	vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+	gtk_container_add(GTK_CONTAINER(frame), vbox);
+
+	toggle = gtk_check_button_new_with_mnemonic(_("_Record a trace of conversation events for replaying"));
+	gtk_box_pack_start(GTK_BOX(vbox), toggle, FALSE, FALSE, 0);
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggle),
+	                             purple_prefs_get_bool("/plugins/gtk/unityinteg/trace"));
+	g_signal_connect(G_OBJECT(toggle), "toggled",
+	                 G_CALLBACK(trace_config_cb), NULL);
+
 	gtk_widget_show_all(ret);
 	return ret;
 }
@@ -511,6 +1422,17 @@ plugin_load(PurplePlugin *plugin)
 	void *savedstat_handle = purple_savedstatuses_get_handle();
 
 	alert_chat_nick = purple_prefs_get_bool("/plugins/gtk/unityinteg/alert_chat_nick");
+	n_sources = n_messages = 0;
+	account_unread = g_hash_table_new(g_direct_hash, g_direct_equal);
+	conv_states = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, conv_state_free);
+	watched_windows = g_hash_table_new(g_direct_hash, g_direct_equal);
+	id_convs = g_hash_table_new(g_str_hash, g_str_equal);
+	update_interval = purple_prefs_get_int("/plugins/gtk/unityinteg/update_interval");
+	alert_burst = purple_prefs_get_int("/plugins/gtk/unityinteg/alert_burst");
+	highlights_pref_cb(NULL, PURPLE_PREF_STRING_LIST, NULL, NULL);
+	purple_prefs_connect_callback(plugin, "/plugins/gtk/unityinteg/highlights",
+	                              highlights_pref_cb, NULL);
+	dirty_convs = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	mmapp = messaging_menu_app_new("pidgin.desktop");
 	g_object_ref(mmapp);
@@ -544,6 +1466,8 @@ plugin_load(PurplePlugin *plugin)
 	                    PURPLE_CALLBACK(conv_created), NULL);
 	purple_signal_connect(conv_handle, "deleting-conversation", plugin,
 	                    PURPLE_CALLBACK(deleting_conv), NULL);
+	purple_signal_connect(gtk_conv_handle, "conversation-switched", plugin,
+	                    PURPLE_CALLBACK(conversation_switched_cb), NULL);
 
 	while (convs) {
 		PurpleConversation *conv = (PurpleConversation *)convs->data;
@@ -551,6 +1475,9 @@ plugin_load(PurplePlugin *plugin)
 		convs = convs->next;
 	}
 
+	if (purple_prefs_get_bool("/plugins/gtk/unityinteg/trace"))
+		trace_start_recording();
+
 	return TRUE;
 }
 
@@ -558,18 +1485,40 @@ static gboolean
 plugin_unload(PurplePlugin *plugin)
 {
 	GList *convs = purple_get_conversations();
+
+	trace_stop_recording();
+	highlights_config_flush();
+
 	while (convs) {
 		PurpleConversation *conv = (PurpleConversation *)convs->data;
 		unalert(conv);
 		detach_signals(conv);
 		convs = convs->next;
 	}
+	flush_updates();
+	g_hash_table_destroy(dirty_convs);
+	dirty_convs = NULL;
 	
 	unity_launcher_entry_set_count_visible(launcher, FALSE);
 	messaging_menu_app_unregister(mmapp);
 
 	g_object_unref(launcher);
 	g_object_unref(mmapp);
+	g_hash_table_destroy(account_unread);
+	account_unread = NULL;
+	g_hash_table_destroy(id_convs);
+	id_convs = NULL;
+	g_hash_table_destroy(conv_states);
+	conv_states = NULL;
+	purple_prefs_disconnect_by_handle(plugin);
+	g_hash_table_foreach(watched_windows, unwatch_window, NULL);
+	g_hash_table_destroy(watched_windows);
+	watched_windows = NULL;
+	highlight_matcher_free(highlights);
+	highlights = NULL;
+	if (highlight_text != NULL)
+		g_string_free(highlight_text, TRUE);
+	highlight_text = NULL;
 	return TRUE;
 }
 
@@ -615,7 +1564,7 @@ static PurplePluginInfo info =
 	&ui_info,                                         /**< ui_info        */
 	NULL,                                             /**< extra_info     */
 	NULL,
-	NULL,
+	actions,
 
 	/* padding */
 	NULL,
@@ -632,6 +1581,10 @@ init_plugin(PurplePlugin *plugin)
 	purple_prefs_add_int("/plugins/gtk/unityinteg/launcher_count", LAUNCHER_COUNT_SOURCES);
 	purple_prefs_add_int("/plugins/gtk/unityinteg/messaging_menu_text", MESSAGING_MENU_COUNT);
 	purple_prefs_add_bool("/plugins/gtk/unityinteg/alert_chat_nick", TRUE);
+	purple_prefs_add_bool("/plugins/gtk/unityinteg/trace", FALSE);
+	purple_prefs_add_int("/plugins/gtk/unityinteg/update_interval", 100);
+	purple_prefs_add_int("/plugins/gtk/unityinteg/alert_burst", 5);
+	purple_prefs_add_string_list("/plugins/gtk/unityinteg/highlights", NULL);
 }
 
 PURPLE_INIT_PLUGIN(unityinteg, init_plugin, info)